@@ -2,6 +2,7 @@
 
 version = "v0.1"
 description = "[lua_baranoki_fnt::init] lua plugin to decode BaranoKiniBaranoSaku 4bpp non monospace font"
+parallel = true
 
 -- struct declear
 ---@class xtx_t -- 10 bytes
@@ -10,7 +10,6 @@ description = "[lua_hatsuyuki_fnt::init] lua plugin to decode hatsuyuki fnt lz77
 g_datap = nil --- @type lightuserdata
 g_tilecfg = {} ---@type tilecfg_t
 g_ntile = 0 ---@type integer
-g_tilesp = nil ---@type lightuserdata
 
 ---@class fnt_t
 ---@field magic string
@@ -148,9 +147,8 @@ function decode_pre()
     return true
 end
 
-function decode_pixels()
+function decode_pixels(pixels, npixel) -- fill the pixels from host in place
     local tilesize = g_tilecfg.w * g_tilecfg.h * 4
-    g_tilesp = memnew(g_ntile * tilesize)
     local i = 0
     local outdatap = memnew(128 * 128 * 4)
     
@@ -182,7 +180,7 @@ function decode_pixels()
                 local offset2 = y * g_fntglphys[glphyi].texturew + x
                 local d = memreadi(outdatap, 1, offset2)
                 local pixel = d + (d << 8) + (d << 16) + (255 << 24)
-                memwrite(g_tilesp, pixel, 4, outoffset + offset1)
+                memwrite(pixels, pixel, 4, outoffset + offset1)
                 ::continue::
             end
         end
@@ -194,7 +192,7 @@ function decode_pixels()
     ui.progress_del(progdlg)
 
     memdel(outdatap)
-    return g_tilesp, g_ntile * g_tilecfg.w * g_tilecfg.h, 0
+    return math.min(npixel, g_ntile * g_tilecfg.w * g_tilecfg.h)
 end
 
 function decode_post()
@@ -205,10 +203,6 @@ function decode_post()
     g_ntile = 0
     g_fntglphys = {}
     g_glphylist = {}
-    if g_tilesp ~= nil then
-        memdel(g_tilesp)
-        g_tilesp = nil
-    end
     return true
 end
 
@@ -2,33 +2,36 @@
 
 version = "v0.1"
 description = "[lua_konosuba_gof::init] lua plugin to decode Konosuba 4bpp non monospace font"
+parallel = true -- decode functions only read the globals from decode_pre, so tiles can be decoded on several lua states
 
 -- global declear 
-g_data = nil --- @type string
+g_view = nil --- @type rawview_t
 g_tilecfg = nil ---@type tilecfg_t
 g_fontmap = {}
 
 function decode_pre()
     --- get neccessory data for decoding
     g_tilecfg = get_tilecfg()
-    g_data = get_rawdata()
+    g_view = get_rawview()
 
     --- set the information for decoding
-    local bpp, w = string.unpack("<I1I1", g_data, 6+1)
-    local count = string.unpack("<I4", g_data, 0x20+1)
+    local bpp, w = g_view:u8(6), g_view:u8(7)
+    local count = g_view:u32(0x20)
     g_tilecfg.w, g_tilecfg.h, g_tilecfg.bpp = w, w, bpp
     g_tilecfg.nbytes = 1
     g_tilecfg.size = count
     set_tilecfg(g_tilecfg)
 
     log(string.format("[lua_baranoki_fnt::pre] datasize=%d w=%d h=%d bpp=%d nbytes=%d",
-        g_data:len(), g_tilecfg.w, g_tilecfg.h, g_tilecfg.bpp, g_tilecfg.nbytes))
+        g_view:len(), g_tilecfg.w, g_tilecfg.h, g_tilecfg.bpp, g_tilecfg.nbytes))
 
     -- set other intormations
-    offset_entry = string.unpack("<I4", g_data, 0x1c+1)
-    offset2, offset3, offset_glphy = string.unpack("<I4I4I4", g_data, 0x30+1)
+    offset_entry = g_view:u32(0x1c)
+    offset2, offset3, offset_glphy = g_view:u32(0x30), g_view:u32(0x34), g_view:u32(0x38)
     for i=0,count do
-        local wchar, nbytes, tilew, tileh, x, y, padding, offset = string.unpack("<I2I2I1I1I1I1I4I4", g_data, offset_entry + i*24 + 1)
+        local entry = g_view:sub(offset_entry + i*24, 24)
+        local wchar, nbytes, tilew, tileh = entry:u16(0), entry:u16(2), entry:u8(4), entry:u8(5)
+        local offset = entry:u32(12)
         tilew = tilew + tilew %2
         g_fontmap[i] = {wchar=wchar, nbytes=nbytes, tilew=tilew, tileh=tileh, offset=offset_glphy+offset}
     end
@@ -36,18 +39,18 @@ function decode_pre()
     return true
 end
 
-function decode_pixel(i, x, y)
-    if(g_fontmap[i]==nil) then return 0 end
-    if(g_fontmap[i].nbytes==0) then return 0 end
+function decode_glyph(glyph, x, y)
+    if(glyph==nil) then return 0 end
+    if(glyph.nbytes==0) then return 0 end
     
     local bpp = 4 -- supposed 4bpp
-    local w, h = g_fontmap[i].tilew, g_fontmap[i].tileh
+    local w, h = glyph.tilew, glyph.tileh
     if(x >= w or y >= h) then return 0 end
     local pixeli = y*w + x
-    local offset = g_fontmap[i].offset + pixeli * bpp // 8
-    if(offset >= g_data:len()) then return 0 end
+    local offset = glyph.offset + pixeli * bpp // 8
+    if(offset >= g_view:len()) then return 0 end
 
-    d = string.byte(g_data, offset + 1)
+    local d = g_view:u8(offset)
     if(pixeli%2 == 0) then d = (d>>4) & 0xf
     else d = d & 0xf end
     d = 255 * d // (2<<bpp-1)
@@ -55,11 +58,28 @@ function decode_pixel(i, x, y)
     return d + (d << 8) + (d << 16) + (255 << 24)
 end
 
+function decode_pixel(i, x, y)
+    return decode_glyph(g_fontmap[i], x, y)
+end
+
+-- the whole tile in one call, packed row by row
+function decode_tile(i, out)
+    local w, h = g_tilecfg.w, g_tilecfg.h
+    local glyph = g_fontmap[i]
+    local rowfmt = "<" .. string.rep("I4", w)
+    local row = {}
+    for y=0,h-1 do
+        for x=0,w-1 do row[x+1] = decode_glyph(glyph, x, y) end
+        memwrite(out, string.pack(rowfmt, table.unpack(row, 1, w)), w*4, y*w*4)
+    end
+    return true
+end
+
 function decode_post()
     log("[lua_baranoki_fnt::post] decode finished")
     set_tilenav({index=0, offset=-1})
     set_tilestyle({scale=1, style=0})
-    g_data = nil
+    g_view = nil
     return true
 end
 
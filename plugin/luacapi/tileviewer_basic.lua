@@ -15,11 +15,30 @@
 ---@field offset integer
 ---@field scrollto boolean
 
+-- read-only view of rawdata without copy, offset start from 0, the readers return nil if out of range
+---@class rawview_t
+---@field u8 fun(self: rawview_t, offset: integer): integer|nil
+---@field u16 fun(self: rawview_t, offset: integer): integer|nil
+---@field u32 fun(self: rawview_t, offset: integer): integer|nil
+---@field i32 fun(self: rawview_t, offset: integer): integer|nil
+---@field u16be fun(self: rawview_t, offset: integer): integer|nil
+---@field u32be fun(self: rawview_t, offset: integer): integer|nil
+---@field i32be fun(self: rawview_t, offset: integer): integer|nil
+---@field sub fun(self: rawview_t, offset?: integer, size?: integer): rawview_t|nil view of the range without copy
+---@field str fun(self: rawview_t, offset?: integer, size?: integer): string|nil copy the range into string
+---@field len fun(self: rawview_t): integer
+
 ---@class tilestyle_t
 ---@field style integer
 ---@field scale integer
 ---@field reset_scale boolean
 
+-- plugin declear
+-- set true if the decode functions only read the globals from decode_pre and decode_recvui,
+-- then tiles are decoded in parallel, each thread with its own lua state running decode_pre again
+---@type boolean
+parallel = false
+
 -- c apis declear 
 
 -- use log(...) to redirect to log window
@@ -59,6 +78,11 @@ function memreads(p, size, offset) end --c api
 ---@return integer ...
 function memwrite(p, data, size, offset1, offset2) end --c api
 
+-- raw address of the memblock, on luajit use memview(p) to get uint8_t* by ffi
+---@param p lightuserdata|userdata
+---@return lightuserdata|nil ...
+function memptr(p) end --c api
+
 -- set or get tile informations
 ---@return tilecfg_t ...
 function get_tilecfg() end -- c api
@@ -81,16 +105,26 @@ function set_tilestyle(style) end -- ca pi
 ---@return integer ...
 function get_rawsize() end -- c api
 
--- get tiles bytes, usually used in decode_pre, and then use this to decode pixel
+-- (legacy) get tiles bytes by copy, use get_rawview instead for large data
 ---@param offset? integer
 ---@param size? integer
 ---@return string ...
 function get_rawdata(offset, size) end --c api
 
+-- get the read-only view of tiles bytes without copy, usually used in decode_pre, and then use this to decode pixel
+---@param offset? integer
+---@param size? integer to the end if 0 or nil
+---@return rawview_t | nil ...
+function get_rawview(offset, size) end --c api
+
 -- get the lightuserdata pointer for userptr 
 ---@return lightuserdata ...
 function get_rawdatap() end --c api
 
+-- get the host pixels lent to decode_pixels, valid until decode_post returns
+---@return userdata | nil ...
+function get_pixels() end --c api
+
 ---@return boolean ...
 function decode_pre() end -- c callback
 
@@ -100,10 +134,26 @@ function decode_pre() end -- c callback
 ---@return integer ... pixel value packed in rgba
 function decode_pixel(i, x, y)  end -- c callback
 
----@return lightuserdata | string ... pixels memory 
----@return integer ... npixels
----@return integer ... offset
-function decode_pixels() end -- c callback
+-- write the rgba pixels of tile i by memwrite, prior to decode_pixels and decode_pixel
+---@param i integer ith tile
+---@param out userdata w*h pixels of the tile row by row, the same as memblock and only valid in this call
+---@return boolean ...
+function decode_tile(i, out) end -- c callback
+
+-- write the rgba pixels of rows [y0, y1) in tile i, for the large tiles, used if no decode_tile
+---@param i integer ith tile
+---@param y0 integer first row
+---@param y1 integer end row, not included
+---@param out userdata w*(y1-y0) pixels, the same as memblock and only valid in this call
+---@return boolean ...
+function decode_rows(i, y0, y1, out) end -- c callback
+
+-- fill the host pixels of all tiles in place by memwrite, the pixels can not be memdel
+-- (legacy) return lightuserdata or string, npixels and offset, which are copied to host
+---@param pixels userdata rgba pixels of all tiles in order, the same as memblock for mem functions
+---@param npixel integer
+---@return integer ... npixels filled
+function decode_pixels(pixels, npixel) end -- c callback
 
 ---@return boolean ...
 function decode_post() end -- c callback
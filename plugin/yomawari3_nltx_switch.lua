@@ -56,15 +56,20 @@ function decode_pre()
     return true
 end
 
-function decode_pixel(i, x, y)
-    offset = tegrax1_deswizzle(x, y, g_tilecfg.w, g_bytesperpixel, 0, g_blockheight)
+function read_pixel(x, y)
+    local offset = tegrax1_deswizzle(x, y, g_tilecfg.w, g_bytesperpixel, 0, g_blockheight)
     if(offset + g_bytesperpixel >= g_data:len()) then return 0 end
-    pixel = 0
+    local pixel = 0
     if(g_bytesperpixel == 4) then
         pixel = string.unpack("<I4", g_data, offset + 1)
     elseif(g_bytesperpixel == 3) then
         pixel = string.unpack("<I3", g_data, offset + 1)
     end
+    return pixel
+end
+
+function decode_pixel(i, x, y)
+    local pixel = read_pixel(x, y)
 
     -- update progress
     local done = y * g_tilecfg.w + x
@@ -76,6 +81,23 @@ function decode_pixel(i, x, y)
     return pixel
 end
 
+-- the image is one large tile, decoded by rows rather than by pixels
+function decode_rows(i, y0, y1, out)
+    local w = g_tilecfg.w
+    local rowfmt = "<" .. string.rep("I4", w)
+    local row = {}
+    for y=y0,y1-1 do
+        for x=0,w-1 do row[x+1] = read_pixel(x, y) end
+        memwrite(out, string.pack(rowfmt, table.unpack(row, 1, w)), w*4, (y-y0)*w*4)
+    end
+
+    -- update progress
+    local done = y1 * w
+    local all = w * g_tilecfg.h
+    ui.progress_update(g_progdlg, done, string.format("decoding pixels %d/%d", done,  all))
+    return true
+end
+
 function decode_post()
     log("[lua_yomawari3_nltx::post] decode finished")
     set_tilenav({index=0, offset=-1})
@@ -0,0 +1,24 @@
+# build with lua 5.4 and luajit, then show the lua lines of --benchmark side by side
+# usage: bash script/benchmark_lua.sh
+if [ -z "$BUILD_TYPE" ]; then BUILD_TYPE=Release; fi
+if [ -z "$BENCH_DIR" ]; then BENCH_DIR=$(pwd)/build/benchmark; fi
+mkdir -p $BENCH_DIR
+
+for BACKEND in lua luajit; do
+    if [ "$BACKEND" = "luajit" ]; then USE_LUAJIT=ON; else USE_LUAJIT=OFF; fi
+    echo "## build $BACKEND in $BENCH_DIR/$BACKEND"
+    if ! BUILD_DIR=$BENCH_DIR/$BACKEND BUILD_TYPE=$BUILD_TYPE USE_LUAJIT=$USE_LUAJIT \
+        bash script/build_linux.sh > $BENCH_DIR/$BACKEND.log 2>&1; then
+        echo "## build $BACKEND failed, see $BENCH_DIR/$BACKEND.log"
+        exit 1
+    fi
+    # the log lines are prefixed with time, keep from the tag
+    if ! $BENCH_DIR/$BACKEND/TileViewerCli --benchmark 2>&1 \
+        | grep -o "\[TileCli::Benchmark\] Lua.*Mpixel/s" > $BENCH_DIR/$BACKEND.txt; then
+        echo "## benchmark $BACKEND has no lua result"
+        exit 1
+    fi
+done
+
+echo "## lua 5.4 | luajit"
+paste -d "|" $BENCH_DIR/lua.txt $BENCH_DIR/luajit.txt | sed "s/|/ | /"
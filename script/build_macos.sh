@@ -3,6 +3,7 @@ if [ -z "$CC" ]; then CC=clang; fi
 if [ -z "$CXX" ]; then CXX=clang++; fi
 if [ -z "$BUILD_DIR" ]; then BUILD_DIR=$(pwd)/build/darwin; fi
 if [ -z "$BUILD_TYPE" ]; then BUILD_TYPE=Debug; fi
+if [ -z "$USE_LUAJIT" ]; then USE_LUAJIT=OFF; fi
 
 # CORE_NUM=$(cat /proc/cpuinfo | grep -c ^processor)
 echo "## CC=$CC BUILD_DIR=$BUILD_DIR BUILD_TYPE=$BUILD_TYPE"
@@ -11,11 +12,13 @@ echo "## CC=$CC BUILD_DIR=$BUILD_DIR BUILD_TYPE=$BUILD_TYPE"
 mkdir -p depend
 source script/fetch_depend.sh
 fetch_lua
+if [ "$USE_LUAJIT" = "ON" ]; then fetch_luajit; fi
 fetch_cjson
 
 # build project
 cmake -G "Unix Makefiles" -B $BUILD_DIR \
     -DCMAKE_BUILD_TYPE=$BUILD_TYPE \
+    -DTILEVIEWER_USE_LUAJIT=$USE_LUAJIT \
     -DCMAKE_C_COMPILER=$CC -DCMAKE_CXX_COMPILER=$CXX
     
 make -C $BUILD_DIR -j8
\ No newline at end of file
@@ -4,6 +4,7 @@ if [ -z "$CXX" ]; then CXX=${CC}++; fi
 if [ -z "$WINDRES" ]; then WINDRES=windres; fi
 if [ -z "$BUILD_DIR" ]; then BUILD_DIR=$(pwd)/build/mingw64; fi
 if [ -z "$BUILD_TYPE" ]; then BUILD_TYPE=Debug; fi
+if [ -z "$USE_LUAJIT" ]; then USE_LUAJIT=OFF; fi
 
 CORE_NUM=$(cat /proc/cpuinfo | grep -c ^processor)
 echo "## CC=$CC BUILD_DIR=$BUILD_DIR BUILD_TYPE=$BUILD_TYPE"
@@ -12,12 +13,14 @@ echo "## CC=$CC BUILD_DIR=$BUILD_DIR BUILD_TYPE=$BUILD_TYPE"
 mkdir -p depend
 source script/fetch_depend.sh
 fetch_lua
+if [ "$USE_LUAJIT" = "ON" ]; then fetch_luajit; fi
 fetch_cjson
 fetch_wxwidgets
 
 # build project
 cmake -G "Unix Makefiles" -B $BUILD_DIR \
     -DCMAKE_BUILD_TYPE=$BUILD_TYPE \
+    -DTILEVIEWER_USE_LUAJIT=$USE_LUAJIT \
     -DCMAKE_SYSTEM_NAME=Windows \
     -DCMAKE_C_COMPILER=$CC -DCMAKE_CXX_COMPILER=${CXX} \
     -DCMAKE_RC_COMPILER=$WINDRES
@@ -0,0 +1,29 @@
+# check that the decoded image on stdout is a valid pam, without the logs of the lua plugin in it
+# usage: sh script/check_stdout.sh [path/to/TileViewerCli]
+if [ -z "$CLI" ]; then CLI=${1:-build/linux64/TileViewerCli}; fi
+INFILE=asset/sample/Nobara1.bmp
+PLUGIN=plugin/util_bmp.lua
+OUTFILE=$(mktemp)
+trap 'rm -f $OUTFILE' EXIT
+
+if ! "$CLI" --inpath $INFILE --plugin $PLUGIN --outpath - > $OUTFILE; then
+    echo "## $CLI failed"
+    exit 1
+fi
+
+# the header is text lines until ENDHDR, followed by width * height * depth bytes
+HEADER=$(LC_ALL=C awk 'NR == 1 && $0 != "P7" { exit 1 } { print } $0 == "ENDHDR" { exit }' $OUTFILE)
+if [ $? -ne 0 ] || [ "$(echo "$HEADER" | tail -n 1)" != "ENDHDR" ]; then
+    echo "## invalid pam header: $(head -c 64 $OUTFILE | tr -c '[:print:]' '.')"
+    exit 1
+fi
+W=$(echo "$HEADER" | awk '$1 == "WIDTH" { print $2 }')
+H=$(echo "$HEADER" | awk '$1 == "HEIGHT" { print $2 }')
+D=$(echo "$HEADER" | awk '$1 == "DEPTH" { print $2 }')
+EXPECT=$(( $(echo "$HEADER" | wc -c) + W * H * D ))
+ACTUAL=$(wc -c < $OUTFILE)
+if [ "$ACTUAL" -ne "$EXPECT" ]; then
+    echo "## pam ${W}x${H}x${D} should be $EXPECT bytes, but $ACTUAL bytes"
+    exit 1
+fi
+echo "## pam ${W}x${H}x${D} ok, $ACTUAL bytes"
@@ -11,6 +11,20 @@ function fetch_lua()
     fi
 }
 
+function fetch_luajit()
+{
+    # a tag rather than the v2.1 branch, as LUAJIT_VERSION keys the cached lua chunks
+    LUAJIT_VERSION=2.1.0-beta3
+    LUAJIT_NAME=LuaJIT-$LUAJIT_VERSION
+    LUAJIT_DIR=depend/$LUAJIT_NAME
+    if ! [ -d "$LUAJIT_DIR" ]; then
+        echo "## fetch_luajit $LUAJIT_NAME"
+        curl -fsSL https://github.com/LuaJIT/LuaJIT/archive/refs/tags/v$LUAJIT_VERSION.zip -o depend/$LUAJIT_NAME.zip
+        7z x depend/$LUAJIT_NAME.zip -odepend
+        cp -r script/patch/luajit.cmake $LUAJIT_DIR/CMakeLists.txt
+    fi
+}
+
 function fetch_wxwidgets()
 {
     WXWIDGETS_VERSION=3.2.9
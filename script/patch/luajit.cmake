@@ -0,0 +1,33 @@
+cmake_minimum_required(VERSION 3.12)
+set(PROJECT_NAME lua)
+
+# luajit generates its vm by the host buildvm, so the static lib is made by its own makefile
+set(LUAJIT_CODE_DIR ${CMAKE_CURRENT_SOURCE_DIR}/src)
+set(LUAJIT_LIB ${LUAJIT_CODE_DIR}/libluajit.a)
+set(LUAJIT_HOST_CC "cc" CACHE STRING "host compiler for buildvm, such as gcc -m32 for 32-bit target")
+set(LUAJIT_MAKE_ARGS
+    BUILDMODE=static
+    CC=${CMAKE_C_COMPILER}
+    "HOST_CC=${LUAJIT_HOST_CC}"
+    XCFLAGS=-DLUAJIT_ENABLE_LUA52COMPAT
+)
+if(CMAKE_SYSTEM_NAME MATCHES "Windows")
+    list(APPEND LUAJIT_MAKE_ARGS TARGET_SYS=Windows)
+elseif(CMAKE_SYSTEM_NAME MATCHES "Darwin")
+    list(APPEND LUAJIT_MAKE_ARGS MACOSX_DEPLOYMENT_TARGET=${CMAKE_OSX_DEPLOYMENT_TARGET})
+endif()
+
+add_custom_command(
+    OUTPUT ${LUAJIT_LIB}
+    COMMAND make -C ${LUAJIT_CODE_DIR} ${LUAJIT_MAKE_ARGS} libluajit.a
+    COMMENT "Building luajit"
+)
+add_custom_target(luajit_build DEPENDS ${LUAJIT_LIB})
+
+# the interface library passes the build order to the targets linking it
+add_library(${PROJECT_NAME} INTERFACE)
+target_link_libraries(${PROJECT_NAME} INTERFACE ${LUAJIT_LIB})
+if(CMAKE_SYSTEM_NAME MATCHES "Linux")
+    target_link_libraries(${PROJECT_NAME} INTERFACE ${CMAKE_DL_LIBS} m)
+endif()
+add_dependencies(${PROJECT_NAME} luajit_build)
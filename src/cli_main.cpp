@@ -0,0 +1,34 @@
+/**
+ * implement the entry of headless cli, only wxbase without the gui toolkit
+ *   developed by devseed
+ */
+
+#include <iostream>
+#include <wx/init.h>
+#include <wx/cmdline.h>
+#include "core.hpp"
+
+int main(int argc, char **argv)
+{
+    wxInitializer initializer(argc, argv);
+    if(!initializer.IsOk())
+    {
+        std::cerr << "[main] can not initialize wxbase" << std::endl;
+        return -1;
+    }
+
+    wxString cmdline;
+    for(int i=1; i < argc; i++)
+    {
+        cmdline += wxString(argv[i]) + " ";
+    }
+
+    TileSolver solver;
+    TileCli cli(solver);
+    wxCmdLineParser parser(TileCli::GetCmdDesc(), argc, argv);
+    parser.AddSwitch("h", "help", "show this help message", wxCMD_LINE_OPTION_HELP);
+    if(parser.Parse() != 0) return 1; // usage is shown by parser
+    cli.ParseCmdLine(parser);
+    cli.m_cmdline = cmdline;
+    return cli.Run() ? 0 : 1;
+}
@@ -1,80 +1,520 @@
 #ifndef _CORE_APP_H
 #define _CORE_APP_H
-#include <wx/wx.h>
-#include <wx/bitmap.h>
+#include <wx/string.h>
+#include <wx/log.h>
+#include <wx/buffer.h>
+#include <wx/datetime.h>
 #include <wx/filename.h>
+#include <wx/file.h>
 #include <wx/dynlib.h>
+#include <wx/cmdline.h>
+#include <list>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <condition_variable>
 #include "plugin.h"
 
 #define APP_VERSION "v0.3.6"
 
-extern struct tilecfg_t g_tilecfg;
+extern struct tilecfg64_t g_tilecfg;
+extern struct tilenav_t g_tilenav;
+extern struct tilestyle_t g_tilestyle;
 
-class TileWindow;
-class ConfigWindow;
+void SetTilecfg(wxString& text, struct tilecfg64_t &tilecfg); // tilecfg object in json text -> tilecfg
+void OverridePluginCfg(wxString& jtext, wxString& param); // plugincfg values in jtext by param
+bool SaveImage(wxString path, const struct pixel_t *pixels,
+    size_t w, size_t h, bool opaque = false); // the whole image by ImageWriter
+
+enum TILE_ACCESS
+{
+    TILE_ACCESS_NORMAL = 0,
+    TILE_ACCESS_SEQUENTIAL, // decode tiles in order
+    TILE_ACCESS_RANDOM, // plugin parsing, jump around the file
+    TILE_ACCESS_WILLNEED // prefetch the range
+};
+
+// read-only input, use mmap for regular file, buffered read for pipes
+class TileFile
+{
+public:
+    TileFile();
+    ~TileFile();
+    TileFile(const TileFile&) = delete;
+    TileFile& operator=(const TileFile&) = delete;
+
+    size_t Open(wxString path, bool usemmap = true);
+    bool Close();
+    bool Advise(enum TILE_ACCESS access, size_t offset = 0, size_t size = 0); // hint for mapping
+    const uint8_t* GetData() const;
+    size_t GetDataLen() const;
+    bool IsMapped() const;
+    bool IsShrunk() const; // the mapped file is truncated by others, reading the lost pages faults
+
+private:
+    bool OpenMap(wxString path);
+    wxMemoryBuffer m_buf; // fallback for pipes
+    void *m_map;
+    size_t m_mapsize;
+#ifdef _WIN32
+    void *m_hfile, *m_hmap;
+#else
+    int m_fd; // kept for checking the size of mapped file
+#endif
+};
+
+#define TILE_STORE_ALIGN 64 // cache line
+
+// contiguous rgba pixels for all decoded tiles, addressed by tile index and row,
+// opaque tiles are still 4 bytes per pixel, as the decoders write pixel_t into the store in place
+class TileStore
+{
+public:
+    TileStore();
+    ~TileStore();
+    TileStore(const TileStore&) = delete;
+    TileStore& operator=(const TileStore&) = delete;
+
+    bool Reset(size_t ntile, size_t w, size_t h, bool opaque = false); // alloc and clear to 0
+    bool Shift(int64_t delta, size_t ntile); // new tile i is tile i + delta, the others are cleared
+    void Clear();
+
+    bool IsOk() const { return m_ntile > 0; }
+    bool IsOpaque() const { return m_opaque; } // alpha is ignored by render and save, but still stored
+    size_t GetCount() const { return m_ntile; }
+    size_t GetTileW() const { return m_w; }
+    size_t GetTileH() const { return m_h; }
+    size_t GetTilePixels() const { return m_w * m_h; }
+    size_t GetDataLen() const { return m_ntile * m_w * m_h * sizeof(struct pixel_t); }
+    struct pixel_t* GetData() const { return m_data; }
+    struct pixel_t* GetTile(size_t i) const { return m_data + i * m_w * m_h; }
+    struct pixel_t* GetRow(size_t i, size_t y) const { return m_data + (i * m_h + y) * m_w; }
+
+private:
+    void *m_raw; // unaligned block from malloc
+    struct pixel_t *m_data;
+    size_t m_ntile, m_w, m_h;
+    bool m_opaque;
+};
+
+#define PNG_IDAT_SIZE (1 << 16) // bytes of deflated data in an IDAT chunk
+#define PNG_DEFLATE_CHUNK (1 << 17) // bytes of filtered rows deflated by a thread
+#define PNG_DEFLATE_DICT (1 << 15) // the deflate window from the previous chunk
+#define IMAGE_STRIP_SIZE (4 << 20) // bytes of pixels composed at once for saving
+
+enum IMAGE_FORMAT
+{
+    IMAGE_FORMAT_NONE = 0, // by the ext of path
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_BMP,
+    IMAGE_FORMAT_RAW, // rgba8 rows without header
+    IMAGE_FORMAT_PAM, // P7 with rgb or rgb_alpha
+    IMAGE_FORMAT_PPM, // P6 rgb, alpha is dropped
+    IMAGE_FORMAT_IDX, // 8-bit palette indexes without header, palette in path.json
+    IMAGE_FORMAT_COUNT
+};
+
+enum IMAGE_PROFILE
+{
+    IMAGE_PROFILE_FASTEST = 0, // level 1, no filter
+    IMAGE_PROFILE_BALANCED, // level 6, none, sub and up filters
+    IMAGE_PROFILE_SMALLEST, // level 9, all filters
+    IMAGE_PROFILE_COUNT
+};
+
+extern const char *g_image_profile_names[IMAGE_PROFILE_COUNT];
+bool ParseImageProfile(const wxString& name, enum IMAGE_PROFILE *profile); // by g_image_profile_names
+extern const char *g_image_format_names[IMAGE_FORMAT_COUNT];
+bool ParseImageFormat(const wxString& name, enum IMAGE_FORMAT *format); // by g_image_format_names, rgba and index also
+
+class TilePool;
+
+// image or pixel dump by ext without the gui, rows are written from top by strips, "-" for stdout
+class ImageWriter
+{
+public:
+    ImageWriter();
+    ~ImageWriter();
+    ImageWriter(const ImageWriter&) = delete;
+    ImageWriter& operator=(const ImageWriter&) = delete;
+
+    static bool MakePalette(const struct pixel_t *pixels, size_t n, bool opaque,
+        std::vector<struct pixel_t>& palette); // add the colors of pixels, false if over 256
+    static enum IMAGE_FORMAT GetFormat(const wxString& path); // by ext, pam for stdout
+    bool Open(wxString path, size_t w, size_t h, bool opaque = false,
+        enum IMAGE_FORMAT format = IMAGE_FORMAT_NONE);
+    bool WriteRows(const struct pixel_t *pixels, size_t nrow, size_t stride); // stride in pixels
+    bool Close(); // false if not all rows are written, and the broken file is removed
+    bool IsOk() const { return m_ok; }
+    size_t GetRow() const { return m_y; } // rows written
+
+    enum IMAGE_PROFILE m_profile; // compression level and filters of png
+    TilePool *m_pool; // deflate chunks in parallel, nullptr for serial, not owned
+    std::vector<struct pixel_t> m_palette; // indexed png if not empty, all pixels must be in it, needed by idx
+
+private:
+    bool BeginPng();
+    bool BeginBmp();
+    bool BeginPnm();
+    bool WriteSidecar(); // palette of idx in path.json
+    bool PackRow(const struct pixel_t *src); // -> m_row by format
+    bool DeflateRaw(bool last); // m_raw -> m_idat
+    bool WriteIdat(const uint8_t *data, size_t size); // write IDAT chunks when full
+
+    wxFile m_file;
+    wxString m_path;
+    enum IMAGE_FORMAT m_format;
+    size_t m_w, m_h, m_y;
+    uint8_t m_depth; // bits of a png sample
+    uint8_t m_channels; // bytes of a pixel, 1 for palette index
+    unsigned long m_adler; // adler32 of all filtered rows
+    bool m_opaque, m_ok;
+    bool m_indexed; // pixels -> m_palette indexes
+    bool m_stdout;
+    std::unordered_map<uint32_t, uint8_t> m_index; // color -> palette index
+    std::vector<uint8_t> m_row, m_prev; // the packed row and the row above
+    std::vector<uint8_t> m_filtered; // filter type and row of the trying filter
+    std::vector<uint8_t> m_raw; // filtered rows not deflated
+    std::vector<uint8_t> m_dict; // the last filtered rows deflated
+    std::vector<uint8_t> m_idat; // deflated data of the next IDAT
+};
+
+#define TILE_CACHE_BUDGET (256 << 20) // bytes of pixels in TileCache
+
+// decoded tiles of recent configs by FNV-1a key, evict the least recently used over budget
+class TileCache
+{
+public:
+    struct Entry
+    {
+        uint64_t key;
+        struct tilecfg64_t cfg; // after pre and post processing
+        size_t ntile, w, h;
+        bool opaque;
+        std::vector<struct pixel_t> pixels;
+        bool hasnav, hasstyle; // set by post, applied again on hit
+        struct tilenav_t nav;
+        struct tilestyle_t style;
+    };
+
+    TileCache(size_t budget = TILE_CACHE_BUDGET);
+    static uint64_t Hash(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL);
+    const Entry* Find(uint64_t key); // count hit or miss, nullptr if missed
+    bool Put(uint64_t key, const struct tilecfg64_t &cfg, const TileStore &tiles,
+        const struct tilenav_t *nav = nullptr, const struct tilestyle_t *style = nullptr); // nullptr if post does not set
+    void Clear();
+    void SetBudget(size_t budget); // 0 to disable
+    size_t GetBudget() const { return m_budget; }
+    size_t GetSize() const { return m_size; }
+    size_t GetCount() const { return m_entries.size(); }
+    size_t GetHits() const { return m_hits; }
+    size_t GetMisses() const { return m_misses; }
+
+private:
+    void Evict(size_t budget); // until m_size <= budget
+    std::list<Entry> m_entries; // front is the most recent
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+    size_t m_budget, m_size;
+    size_t m_hits, m_misses;
+};
+
+// work stealing pool, the caller thread also works until Run returns
+class TilePool
+{
+public:
+    typedef std::function<void(size_t begin, size_t end)> TaskFunc;
+
+    TilePool(size_t nthread = 1); // 0 for the hardware threads
+    ~TilePool();
+    TilePool(const TilePool&) = delete;
+    TilePool& operator=(const TilePool&) = delete;
+
+    static size_t GetHardwareThreads();
+    size_t GetThreads() const;
+    bool Resize(size_t nthread); // 0 for the hardware threads
+    void Run(size_t n, size_t grain, const TaskFunc& func); // func on [0, n) by grain, not nestable
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::pair<size_t, size_t>> ranges;
+    };
+    void Stop();
+    void WorkerMain(size_t id);
+    void Work(size_t id, const TaskFunc& func);
+    bool Pop(size_t id, std::pair<size_t, size_t>& range); // own front, then steal others back
+
+    std::vector<std::thread> m_threads;
+    std::vector<std::unique_ptr<Queue>> m_queues; // queue 0 for the caller
+    std::mutex m_mutex;
+    std::condition_variable m_cv, m_donecv;
+    const TaskFunc *m_func;
+    size_t m_generation, m_pending, m_active;
+    bool m_stop;
+};
+
+enum TILE_STATE
+{
+    TILE_STATE_NONE = 0, // not decoded yet in lazy mode
+    TILE_STATE_READY,
+    TILE_STATE_FAILED // decode failed, cleared to 0 and not retried
+};
+
+// lock-free ring for one producer thread and one consumer thread
+template<typename T, size_t N = 1024>
+class TileQueue
+{
+public:
+    TileQueue() : m_head(0), m_tail(0) {}
+    TileQueue(const TileQueue&) = delete;
+    TileQueue& operator=(const TileQueue&) = delete;
+
+    bool Push(const T& item) // producer, false if full
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if(tail - m_head.load(std::memory_order_acquire) == N) return false;
+        m_items[tail % N] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T& item) // consumer, false if empty
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if(head == m_tail.load(std::memory_order_acquire)) return false;
+        item = m_items[head % N];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T m_items[N];
+    std::atomic<size_t> m_head, m_tail;
+};
+
+enum TILE_JOB
+{
+    TILE_JOB_STORE = 0, // tile store is prepared with count tiles
+    TILE_JOB_TILES, // tiles [first, first + count) are decoded
+    TILE_JOB_DONE // the worker finished
+};
+
+struct tilejob_msg_t
+{
+    enum TILE_JOB type;
+    size_t first, count;
+};
+
+struct tilesize_t
+{
+    size_t w, h;
+};
+
+// events from TileSolver to the front end such as the gui, the solver works without it
+class TileListener
+{
+public:
+    virtual ~TileListener() {}
+    virtual void OnError(const wxString& msg, const wxString& title) {} // any thread
+    virtual void OnPluginLoad(const wxString& plugincfg) {} // empty plugincfg when unloaded
+    virtual wxString OnPluginConfig(const wxString& plugincfg) { return plugincfg; } // plugincfg to decode with
+    virtual void OnTilecfg(const struct tilecfg64_t& cfg) {} // written by decoding, or nrow reduced by render
+    virtual void OnJob() {} // worker thread, new messages for PollJob
+};
 
 class TileSolver
 {
 
 public:
     TileSolver();
+    ~TileSolver();
     bool LoadDecoder();
     bool LoadDecoder(wxFileName pluginfile);
     bool UnloadDecoder();
     wxString LoadPlugincfg();
 
-    size_t Open(wxFileName infile = wxFileName()); // file -> m_filebuf
-    int Decode(struct tilecfg_t *tilecfg, wxFileName pluginfile = wxFileName()); // m_filebuf -> m_tiles
-    bool Render(); // m_tiles -> m_bitmap
-    bool Save(wxFileName outfile = wxFileName()); // m_bitmap -> outfile
+    size_t Open(wxFileName infile = wxFileName()); // file -> m_file
+    int Decode(struct tilecfg64_t *tilecfg, wxFileName pluginfile = wxFileName()); // m_file -> m_tiles
+    bool DecodeAsync(struct tilecfg64_t *tilecfg, wxFileName pluginfile = wxFileName()); // Decode on worker, tilecfg is written when done
+    size_t PollJob(std::vector<struct tilejob_msg_t>& msgs); // ui thread, drain the messages from worker
+    void Cancel(); // stop the worker and drop its result
+    void Wait(); // wait for the worker to finish
+    bool IsBusy() const { return m_busy; } // the worker is decoding
+    bool Save(wxFileName outfile = wxFileName()); // m_tiles -> strips -> outfile without the whole image, "-" for stdout
+    struct tilesize_t GetImageSize(size_t nrow = 0); // logical image with nrow tiles in a row, 0 for m_tilecfg.nrow
+    struct tilesize_t GetTileSize();
+    size_t GetTileCount();
+    void Compose(size_t x, size_t y, size_t w, size_t h, size_t nrow,
+        struct pixel_t *out, size_t stride); // region of the logical image -> out, tiles must be ready
+    bool ComposeRegion(size_t x, size_t y, size_t w, size_t h, size_t nrow,
+        struct pixel_t *out, size_t stride); // ensure the tiles and compose the rows in parallel
+    bool EnsureTiles(size_t first, size_t count, bool parallel = true); // decode the tiles not ready in lazy mode
+    bool EnsureRegion(size_t x, size_t y, size_t w, size_t h, size_t nrow); // tiles in the region of the logical image
+    void Prefetch(size_t first, size_t count); // decode in background, replace the previous request
     bool Close();
 
     bool DecodeOk();
-    bool RenderOk();
+    bool IsLazy(); // tiles of current decoding are decoded on demand
 
-    struct tilecfg_t m_tilecfg;
-    struct tile_decoder_t *m_decoder;
+    struct tilecfg64_t m_tilecfg;
+    struct tile_decoder_t *m_decoder; // points to m_decoderinst when loaded
+    struct tile_decoder_t m_decoderinst; // copy after open, the context is only for this solver
     wxDynamicLibrary m_cmodule;
     wxFileName m_infile, m_outfile;
     wxFileName m_pluginfile;
     wxFileName m_plugincfgfile;
     wxString m_pluginparam; // override default value for plugincfg
     wxString m_plugincfg;
-    wxMemoryBuffer m_filebuf;
-    wxVector<wxImage> m_tiles; // use wxImage to store tiles, because wxBitmap hard to set pixel
-    wxBitmap m_bitmap;
+    TileFile m_file; // mapped or buffered file content
+    bool m_usemmap; // false to force buffered read
+    bool m_opaque; // decode tiles without alpha
+    TileStore m_tiles; // all decoded tiles in one contiguous buffer, m_storemutex for realloc
+    TileCache m_cache; // decoded tiles of recent configs, not for lazy decoding
+    TilePool m_pool; // decode tiles in parallel for reentrant decoders
+    std::atomic<size_t> m_nthread; // 0 for the hardware threads, applied at next decode
+    std::atomic<bool> m_lazy; // decode tiles when they are needed, applied at next decode
+    std::atomic<size_t> m_prefetch; // tile rows to decode ahead of the scroll direction in lazy mode
+    std::atomic<size_t> m_cachesize; // bytes of m_cache, applied at next decode
+    enum IMAGE_PROFILE m_saveprofile; // png compression for saving
+    enum IMAGE_FORMAT m_saveformat; // IMAGE_FORMAT_NONE for the ext of outfile
+    bool m_savepalette; // indexed png when the tile bpp <= 8 and colors <= 256
+    TileListener *m_listener = nullptr; // not owned, nullptr for headless
 
 private:
+    bool DecodeBegin(struct tilecfg64_t *tilecfg, wxFileName pluginfile, bool async); // ui thread, load decoder
+    void DecodeTiles(); // ui or worker thread, pre and decode
+    int DecodeEnd(); // ui thread, post and notify
+    void PushJob(enum TILE_JOB type, size_t first, size_t count); // worker thread
+    void ClearTiles();
+    void ReportError(const wxString& msg, const wxString& title); // show by the listener, the caller logs it
+    size_t GetDatasize(); // bytes from start, limited by size and file
     size_t PrepareTilebuf();
+    size_t ShiftTilebuf(uint64_t shiftkey, std::vector<std::pair<size_t, size_t>>& ranges); // 0 if can not shift
+    uint64_t MakeCacheKey(const wxString& plugincfg, bool withrange = true); // input, tilecfg, plugin and plugincfg
+    void StopPrefetch();
+    void PrefetchMain();
+    void EndLazy(); // ui thread, stop the lazy decoding and run the post deferred by it
+    PLUGIN_STATUS DecodeRange(const uint8_t *data, size_t datasize,
+        size_t first, size_t count, size_t *failtile, bool parallel = true); // decodetiles or decodeone into m_tiles
+    bool HasParse(bool post);
+    PLUGIN_STATUS CallParse(bool post, struct tilecfg64_t *cfg); // pre or post, with 32-bit shim
+    bool HasDecodeOne();
+    bool HasDecodeTiles();
+    bool HasDecodeRange(); // decodetiles, or decodeone without decodeall
+    bool IsReentrant();
+    bool IsShiftable(); // the tiles kept when start moves by whole tiles
+    PLUGIN_STATUS CallDecodeOne(const uint8_t *data, size_t datasize,
+        struct tilepos64_t *pos, struct pixel_t *pixel, bool remain_index);
+
+    // the decoding passed from DecodeBegin to DecodeEnd
+    struct DecodeState
+    {
+        struct tilecfg64_t *cfg; // for pre and decode
+        struct tilecfg64_t *out; // write back from m_jobcfg when done, nullptr for Decode
+        wxString plugincfg;
+        uint64_t cachekey, shiftkey;
+        uint16_t nrow; // before pre, to know if the plugin sets nrow
+        bool async, ok, cached, shiftable;
+        int result; // ntile, 0 for no data, -1 for failed or cancelled
+        wxDateTime time_start;
+        const char *decodename; // decodeall, decodetiles or decodeone, nullptr if not decoded
+        wxLongLong decodeus; // time in the decode function, for pixels/s
+        bool hasnav, hasstyle; // set by post, or kept in the cache entry
+        struct tilenav_t nav;
+        struct tilestyle_t style;
+    } m_state;
+
+    // worker for DecodeAsync
+    std::thread m_jobthread;
+    struct tilecfg64_t m_jobcfg;
+    TileQueue<struct tilejob_msg_t> m_jobqueue;
+    std::vector<uint8_t> m_jobready; // ui thread, tiles can be composed while busy
+    std::atomic<bool> m_busy, m_cancel, m_jobnotified;
+    std::mutex m_storemutex; // m_tiles is reset by worker while the ui composes
+
+    // lazy decoding, m_tilestate is empty if all tiles are decoded
+    std::vector<uint8_t> m_tilestate; // TILE_STATE for each tile, guarded by m_decodemutex
+    std::atomic<bool> m_islazy; // m_tilestate is not empty
+    std::atomic<size_t> m_lazytiles; // size of m_tilestate, for the readers without m_decodemutex
+    size_t m_lazystart, m_lazysize; // rawdata of the lazy tiles, guarded by m_decodemutex
+    bool m_lazypost; // post is deferred until the lazy decoding ends, as it may free the state of pre
+    std::mutex m_decodemutex; // one decoding at a time, lua decoders are not reentrant
+    size_t m_datasize; // bytes from m_tilecfg.start for decoding
+
+    // the previous decoding, to shift the tiles when only start moves
+    bool m_shiftok;
+    uint64_t m_shiftkey; // MakeCacheKey without start and size
+    size_t m_shiftstart;
+    std::thread m_prefetchthread;
+    std::mutex m_prefetchmutex;
+    std::condition_variable m_prefetchcv;
+    size_t m_prefetchfirst, m_prefetchcount;
+    bool m_prefetchstop;
 };
 
-class MainApp : public wxApp
+// one file of TileBatch, the plugin and config can be different for each file
+struct tilejob_t
+{
+    wxFileName infile, outfile;
+    wxFileName pluginfile;
+    struct tilecfg64_t cfg;
+    wxString pluginparam; // override the plugincfg of this file
+};
+
+// decode many files in parallel without gui, each worker keeps the decoders it loaded
+class TileBatch
 {
 public:
-    int SearchPlugins(wxString dirpath);
-    bool Gui(wxString cmdstr = *wxEmptyString);
-    bool Cli(wxString cmdstr = *wxEmptyString);
-
-    // window
-    TileWindow *m_tilewindow;
-    ConfigWindow *m_configwindow;
-    wxLogWindow *m_logwindow;
-
-    // for solve tile
-    int m_pluginindex;
-    wxVector<wxFileName> m_pluginfiles;
-    TileSolver m_tilesolver;
-    bool m_usegui;
+    TileBatch();
+    size_t Load(wxString source, wxFileName outdir = wxFileName()); // directory, glob or jsonl manifest -> m_jobs
+    bool Run(size_t njob = 0); // 0 for the hardware threads, false if any file failed
 
-    // others
-    void* m_filewatcher = nullptr;
+    std::vector<struct tilejob_t> m_jobs;
+    wxFileName m_pluginfile; // default for the files not in manifest
+    wxFileName m_plugincfgfile; // only for m_pluginfile
+    wxString m_pluginparam;
+    struct tilecfg64_t m_tilecfg;
+    bool m_usemmap, m_opaque;
+    enum IMAGE_PROFILE m_saveprofile;
+    enum IMAGE_FORMAT m_saveformat; // also the ext of output, png for IMAGE_FORMAT_NONE
+    bool m_savepalette;
+    size_t m_nthread; // threads of each solver, 0 for the hardware threads shared by the workers
 
 private:
-    virtual bool OnInit() wxOVERRIDE;
-    virtual void OnInitCmdLine(wxCmdLineParser& parser) wxOVERRIDE;
-    virtual bool OnCmdLineParsed(wxCmdLineParser& parser) wxOVERRIDE;
-    virtual void OnEventLoopEnter(wxEventLoopBase *loop) wxOVERRIDE;
+    size_t LoadManifest(wxString path, wxFileName outdir);
+    struct tilejob_t MakeJob(wxFileName infile, wxFileName outdir);
+    void WorkerMain();
+    bool RunJob(TileSolver *solver, const wxString& plugincfg, const struct tilejob_t& job);
+
+    size_t m_solverthread; // m_nthread applied in Run
+    std::atomic<size_t> m_next, m_done, m_failed;
+    std::atomic<uint64_t> m_insize, m_outpixels;
+};
+
+// the command line without gui, shared by the cli and the --nogui of gui app
+class TileCli
+{
+public:
+    TileCli(TileSolver& solver);
+    static const wxCmdLineEntryDesc* GetCmdDesc();
+    bool ParseCmdLine(const wxCmdLineParser& parser); // options -> m_solver and g_tilecfg
+    bool Run(); // benchmark, batch or decode by the options
+    bool Decode(); // m_solver.m_infile -> m_solver.m_outfile
+    bool Batch(); // decode the files of m_batchsource in parallel
+    bool Benchmark(); // MB/s of builtin decoder for each kernel and format
+
+    TileSolver& m_solver;
+    bool m_usegui;
+    bool m_benchmark;
+    wxString m_batchsource; // directory, glob or jsonl manifest for --batch
+    size_t m_batchjobs; // 0 for the hardware threads
+    wxString m_cmdline;
 };
 
-wxDECLARE_APP(MainApp);
 #endif
\ No newline at end of file
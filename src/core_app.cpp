@@ -4,8 +4,12 @@
  */
 
 #include <map>
+#include <vector>
 #include <wx/wx.h>
 #include <wx/cmdline.h>
+extern "C" {
+#include <lua.h>
+}
 #include "ui.hpp"
 #include "core.hpp"
 
@@ -13,43 +17,14 @@ using std::pair;
 using std::map;
 
 extern std::map<wxString, struct tile_decoder_t> g_builtin_plugin_map;
-
-static const wxCmdLineEntryDesc s_cmd_desc[] =
-{
-    { wxCMD_LINE_SWITCH, "n", "nogui", "decode tiles without gui",
-        wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL},
-    { wxCMD_LINE_OPTION, "i", "inpath", "tile file inpath",
-        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
-    { wxCMD_LINE_OPTION, "o", "outpath", "outpath for decoded file",
-        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
-    { wxCMD_LINE_OPTION, "p", "plugin", "plugin path to decode",
-        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
-    { wxCMD_LINE_OPTION, "", "plugincfg", "plugin config path (default pluginpath.json)",
-        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
-    { wxCMD_LINE_OPTION, "", "pluginparam", "set the plugincfg values, for example {\"name1\": value1,\"name2\": value2}",
-        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
-    { wxCMD_LINE_OPTION, "", "start", "tile start offset",
-        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
-    { wxCMD_LINE_OPTION, "", "size", "whole tile size",
-        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
-    { wxCMD_LINE_OPTION, "", "nrow", "how many tiles in a row",
-        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
-    { wxCMD_LINE_OPTION, "", "width", "tile width",
-        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
-    { wxCMD_LINE_OPTION, "", "height", "tile height",
-        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
-    { wxCMD_LINE_OPTION, "", "bpp", "tile bpp",
-        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
-    { wxCMD_LINE_OPTION, "", "nbytes", "bytes number in a tile",
-        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
-    wxCMD_LINE_DESC_END
-};
+extern "C" lua_CFunction g_luaopen_ui;
+extern "C" int luaopen_ui(lua_State *L);
 
 wxIMPLEMENT_APP(MainApp); // program entry
 
 void MainApp::OnInitCmdLine(wxCmdLineParser& parser)
 {
-    parser.SetDesc(s_cmd_desc);
+    parser.SetDesc(TileCli::GetCmdDesc());
     wxApp::OnInitCmdLine(parser);
 }
 
@@ -57,22 +32,8 @@ bool MainApp::OnCmdLineParsed(wxCmdLineParser& parser)
 {
     std::cout << parser.GetUsageString() << std::flush;
     
-    wxString val;
-    long num;
-    if(parser.FoundSwitch("nogui") == wxCMD_SWITCH_ON) m_usegui = false;
-    else m_usegui = true;
-    if(parser.Found("inpath", &val)) m_tilesolver.m_infile = val;
-    if(parser.Found("outpath", &val)) m_tilesolver.m_outfile = val;
-    if(parser.Found("plugin", &val)) m_tilesolver.m_pluginfile = val;
-    if(parser.Found("plugincfg", &val)) m_tilesolver.m_plugincfgfile = val;
-    if(parser.Found("pluginparam", &val)) m_tilesolver.m_pluginparam = val;
-    if(parser.Found("start", &num)) g_tilecfg.start = num;
-    if(parser.Found("size", &num)) g_tilecfg.size = num;
-    if(parser.Found("nrow", &num)) g_tilecfg.nrow = num;
-    if(parser.Found("width", &num)) g_tilecfg.w = num;
-    if(parser.Found("height", &num)) g_tilecfg.h = num;
-    if(parser.Found("bpp", &num)) g_tilecfg.bpp = num;
-    if(parser.Found("nbytes", &num)) g_tilecfg.nbytes = num;
+    m_cli.ParseCmdLine(parser);
+    m_usegui = m_cli.m_usegui;
     
     return wxApp::OnCmdLineParsed(parser);
 }
@@ -156,6 +117,8 @@ bool MainApp::Gui(wxString cmdline)
     logwindow->GetFrame()->SetIcon(wxICON(IDI_ICON1));
 #endif
     logwindow->GetFrame()->SetSize(wxSize(720, 540));
+    m_tilesolver.m_listener = &m_listener;
+    g_luaopen_ui = luaopen_ui; // dialogs for lua plugins, only in gui
     logwindow->PassMessages(false); // disable pass to mesasgebox
     wxLog::SetActiveTarget(logwindow);
     wxLogMessage("[MainApp::OnInit] TileViewer " APP_VERSION " start, " + cmdline);
@@ -174,8 +137,8 @@ bool MainApp::Gui(wxString cmdline)
     if(m_tilesolver.m_infile.Exists())
     {
         m_tilesolver.Open();
-        m_tilesolver.Decode(&g_tilecfg);
-        m_tilesolver.Render();
+        if(m_tilesolver.m_outfile.GetFullPath().Length()) m_tilesolver.Decode(&g_tilecfg); // save the whole decoding
+        else m_tilesolver.DecodeAsync(&g_tilecfg);
         NOTIFY_UPDATE_TILES(); // notify all
         m_tilesolver.Save();
     }
@@ -185,42 +148,6 @@ bool MainApp::Gui(wxString cmdline)
     return true;
 }
 
-bool MainApp::Cli(wxString cmdline)
-{
-    wxLog::SetActiveTarget(new wxLogStream(&std::cout));
-    wxLogMessage("[MainApp::Cli] TileViewer " APP_VERSION " start, " + cmdline);
-
-    if(!m_tilesolver.Open())
-    {
-        wxLogError(wxString::Format("[MainApp::Cli] open %s failed", 
-            m_tilesolver.m_infile.GetFullPath()));
-        return false;
-    }
-    if(m_tilesolver.Decode(&g_tilecfg) <= 0)
-    {
-        wxLogError(wxString::Format("[MainApp::Cli] decode %s with %s failed", 
-            m_tilesolver.m_infile.GetFullPath(), 
-            m_tilesolver.m_pluginfile.GetFullPath()));
-        return false;
-    }
-    if(!m_tilesolver.Render())
-    {
-        auto ntiles = m_tilesolver.m_tiles.size();
-        auto w = m_tilesolver.m_tilecfg.w;
-        auto h = m_tilesolver.m_tilecfg.h;
-        wxLogError(wxString::Format("[MainApp::Cli] render %s with %zu ntiles, (%u, %u) failed", 
-            m_tilesolver.m_infile.GetFullPath(), ntiles, w, h));
-        return false;
-    }
-    if(!m_tilesolver.Save())
-    {
-        wxLogError(wxString::Format("[MainApp::Cli] save %s failed", 
-            m_tilesolver.m_outfile.GetFullPath()));
-        return false;
-    }
-    return true;
-}
-
 bool MainApp::OnInit()
 {
     if (!wxApp::OnInit()) return false;
@@ -232,6 +159,18 @@ bool MainApp::OnInit()
         cmdline += argv[i] + " ";
     }
 
+    // the same as the headless cli, without the gui windows
+    bool res = true;
+    if(!m_usegui)
+    {
+        m_cli.m_cmdline = cmdline;
+        res = m_cli.Run();
+        if(res && m_cli.m_benchmark) res = TileView::BenchmarkRender(m_tilesolver); // needs the gui toolkit
+        if(!res) wxLogError("[MainApp::OnInit] init failed!");
+        Exit();
+        return res;
+    }
+
     // load decode methods
     wxImage::AddHandler(new wxPNGHandler);
     // wxImage::AddHandler(new wxJPEGHandler); // on linux libjpeg.so.8 not work
@@ -239,14 +178,11 @@ bool MainApp::OnInit()
     if(!m_tilesolver.m_pluginfile.GetFullPath().Length()) 
         m_tilesolver.m_pluginfile = m_pluginfiles[0];
     
-    bool res = true;
-    if(!m_usegui) res = Cli(cmdline);
-    else res = Gui(cmdline);
+    res = Gui(cmdline);
     if(!res)
     {
         wxLogError("[MainApp::OnInit] init failed!");
     }
-    if(!m_usegui)  Exit();
 
     return res;
 }
\ No newline at end of file
@@ -0,0 +1,279 @@
+/**
+ * implement the batch decoding for many files without gui
+ *   developed by devseed
+ *
+ *  the source is a directory, a glob like *.bin, or a jsonl manifest with a job in each line,
+ *    {"input": "a.bin", "plugin": "x.lua", "tilecfg": {"w": 8}, "pluginparam": {"name": 1}, "output": "a.png"}
+ *  each worker takes the next file, and keeps a solver with the decoder loaded for each plugin
+ */
+
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <wx/dir.h>
+#include <wx/file.h>
+#include <wx/tokenzr.h>
+#include <wx/stopwatch.h>
+#include <wx/utils.h>
+#include <cJSON.h>
+#include "core.hpp"
+
+// relative path in manifest is from the manifest directory, the builtin plugin name is kept
+static wxFileName resolve_path(const wxString& path, const wxString& basedir)
+{
+    wxFileName filename(path);
+    if(filename.IsRelative())
+    {
+        wxFileName resolved(filename);
+        resolved.MakeAbsolute(basedir);
+        if(resolved.Exists()) return resolved;
+    }
+    return filename;
+}
+
+TileBatch::TileBatch()
+{
+    m_tilecfg = g_tilecfg;
+    m_usemmap = true;
+    m_opaque = false;
+    m_saveprofile = IMAGE_PROFILE_BALANCED;
+    m_saveformat = IMAGE_FORMAT_NONE;
+    m_savepalette = true;
+    m_nthread = 0;
+    m_solverthread = 1;
+    m_next = m_done = m_failed = 0;
+    m_insize = m_outpixels = 0;
+}
+
+struct tilejob_t TileBatch::MakeJob(wxFileName infile, wxFileName outdir)
+{
+    struct tilejob_t job;
+    job.infile = infile;
+    job.pluginfile = m_pluginfile;
+    job.cfg = m_tilecfg;
+    job.pluginparam = m_pluginparam;
+
+    // name.ext.png, to avoid the same name with different ext
+    wxString outdirpath = outdir.GetFullPath();
+    if(!outdirpath.Length()) outdirpath = infile.GetPath();
+    wxString outext = m_saveformat != IMAGE_FORMAT_NONE ? g_image_format_names[m_saveformat] : "png";
+    job.outfile = wxFileName(outdirpath, infile.GetFullName() + "." + outext);
+    return job;
+}
+
+size_t TileBatch::Load(wxString source, wxFileName outdir)
+{
+    m_jobs.clear();
+    if(outdir.GetFullPath().Length() && !outdir.DirExists())
+    {
+        outdir.Mkdir(wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL);
+    }
+
+    wxArrayString files;
+    if(wxDirExists(source))
+    {
+        wxDir::GetAllFiles(source, &files, wxEmptyString, wxDIR_FILES);
+    }
+    else if(source.find_first_of("*?") != wxString::npos)
+    {
+        wxFileName pattern(source);
+        wxString dirpath = pattern.GetPath();
+        if(!dirpath.Length()) dirpath = ".";
+        if(wxDirExists(dirpath)) wxDir::GetAllFiles(dirpath, &files, pattern.GetFullName(), wxDIR_FILES);
+    }
+    else if(wxFileName(source).GetExt().Lower() == "jsonl")
+    {
+        return LoadManifest(source, outdir);
+    }
+    else
+    {
+        wxLogError("[TileBatch::Load] %s is not a directory, glob or jsonl manifest", source);
+        return 0;
+    }
+
+    files.Sort();
+    for(auto& file : files) m_jobs.push_back(MakeJob(file, outdir));
+    wxLogMessage("[TileBatch::Load] %zu files from %s", m_jobs.size(), source);
+    return m_jobs.size();
+}
+
+size_t TileBatch::LoadManifest(wxString path, wxFileName outdir)
+{
+    wxFile f(path);
+    if(!f.IsOpened())
+    {
+        wxLogError("[TileBatch::LoadManifest] open %s failed", path);
+        return 0;
+    }
+    wxString text;
+    f.ReadAll(&text);
+    f.Close();
+    wxString basedir = wxFileName(path).GetPath();
+    if(!basedir.Length()) basedir = ".";
+
+    size_t lineno = 0;
+    wxStringTokenizer lines(text, "\r\n");
+    while(lines.HasMoreTokens())
+    {
+        wxString line = lines.GetNextToken();
+        lineno++;
+        line.Trim().Trim(false);
+        if(!line.Length() || line[0] == '#') continue;
+
+        cJSON *root = cJSON_Parse(line.mb_str());
+        const cJSON *input = root ? cJSON_GetObjectItem(root, "input") : nullptr;
+        if(!cJSON_IsString(input))
+        {
+            wxLogError("[TileBatch::LoadManifest] line %zu, invalid job without input", lineno);
+            cJSON_Delete(root);
+            continue;
+        }
+        auto job = MakeJob(resolve_path(input->valuestring, basedir), outdir);
+        const cJSON *v = nullptr;
+        v = cJSON_GetObjectItem(root, "plugin");
+        if(cJSON_IsString(v)) job.pluginfile = resolve_path(v->valuestring, basedir);
+        v = cJSON_GetObjectItem(root, "output");
+        if(cJSON_IsString(v))
+        {
+            job.outfile = wxFileName(v->valuestring);
+            if(job.outfile.IsRelative())
+            {
+                job.outfile.MakeAbsolute(outdir.GetFullPath().Length() ? outdir.GetFullPath() : basedir);
+            }
+        }
+        v = cJSON_GetObjectItem(root, "pluginparam");
+        if(cJSON_IsString(v)) job.pluginparam = v->valuestring;
+        else if(cJSON_IsObject(v))
+        {
+            char *param = cJSON_PrintUnformatted(v);
+            job.pluginparam = param;
+            cJSON_free(param);
+        }
+        SetTilecfg(line, job.cfg); // the tilecfg object in the line
+        cJSON_Delete(root);
+        m_jobs.push_back(job);
+    }
+
+    wxLogMessage("[TileBatch::LoadManifest] %zu jobs from %s", m_jobs.size(), path);
+    return m_jobs.size();
+}
+
+bool TileBatch::RunJob(TileSolver *solver, const wxString& plugincfg, const struct tilejob_t& job)
+{
+    wxString infile = job.infile.GetFullPath();
+    if(!solver)
+    {
+        wxLogError("[TileBatch::RunJob] %s, decoder %s is invalid", infile, job.pluginfile.GetFullName());
+        return false;
+    }
+
+    bool res = false;
+    struct tilecfg64_t cfg = job.cfg;
+    wxString param = job.pluginparam;
+    wxString text = plugincfg;
+    OverridePluginCfg(text, param);
+    solver->m_plugincfg = text;
+
+    if(!solver->Open(job.infile))
+    {
+        wxLogError("[TileBatch::RunJob] open %s failed", infile);
+        goto batch_runjob_end;
+    }
+    m_insize += solver->m_file.GetDataLen();
+    if(solver->Decode(&cfg) <= 0)
+    {
+        wxLogError("[TileBatch::RunJob] decode %s with %s failed", infile, job.pluginfile.GetFullName());
+        goto batch_runjob_end;
+    }
+    if(!solver->Save(job.outfile))
+    {
+        wxLogError("[TileBatch::RunJob] save %s failed", job.outfile.GetFullPath());
+        goto batch_runjob_end;
+    }
+    m_outpixels += (uint64_t)solver->GetImageSize().w * solver->GetImageSize().h;
+    res = true;
+
+batch_runjob_end:
+    solver->Close();
+    return res;
+}
+
+void TileBatch::WorkerMain()
+{
+    // the solver for each plugin path, with the plugincfg before override
+    std::map<wxString, std::unique_ptr<TileSolver>> solvers;
+    std::map<wxString, wxString> plugincfgs;
+
+    for(size_t i = m_next++; i < m_jobs.size(); i = m_next++)
+    {
+        auto& job = m_jobs[i];
+        wxString key = job.pluginfile.GetFullPath();
+        auto it = solvers.find(key);
+        if(it == solvers.end())
+        {
+            std::unique_ptr<TileSolver> solver(new TileSolver());
+            solver->m_usemmap = m_usemmap;
+            solver->m_opaque = m_opaque;
+            solver->m_saveprofile = m_saveprofile;
+            solver->m_saveformat = m_saveformat;
+            solver->m_savepalette = m_savepalette;
+            solver->m_nthread = m_solverthread;
+            solver->m_cachesize = 0; // each file is decoded once
+            solver->m_pluginfile = job.pluginfile;
+            if(job.pluginfile == m_pluginfile) solver->m_plugincfgfile = m_plugincfgfile;
+            solver->m_pluginparam = m_pluginparam;
+            if(!solver->LoadDecoder(job.pluginfile)) solver.reset(); // not retried for the other files
+            if(solver) plugincfgs[key] = solver->m_plugincfg;
+            it = solvers.emplace(key, std::move(solver)).first;
+        }
+        if(!RunJob(it->second.get(), plugincfgs[key], job)) m_failed++;
+        m_done++;
+    }
+
+    for(auto& it : solvers)
+    {
+        if(it.second) it.second->UnloadDecoder();
+    }
+}
+
+bool TileBatch::Run(size_t njob)
+{
+    if(!m_jobs.size())
+    {
+        wxLogError("[TileBatch::Run] no files to decode");
+        return false;
+    }
+    size_t nhardware = TilePool::GetHardwareThreads();
+    if(!njob) njob = nhardware;
+    njob = wxMin(njob, m_jobs.size());
+    m_solverthread = m_nthread ? m_nthread : wxMax<size_t>(1, nhardware / njob);
+    m_next = m_done = m_failed = 0;
+    m_insize = m_outpixels = 0;
+    wxLogMessage("[TileBatch::Run] %zu files in %zu jobs, %zu threads for each job",
+        m_jobs.size(), njob, m_solverthread);
+
+    // the logs of workers are buffered, and flushed here
+    wxStopWatch sw;
+    std::vector<std::thread> workers;
+    for(size_t i=0; i < njob; i++) workers.emplace_back(&TileBatch::WorkerMain, this);
+    size_t reported = 0;
+    while(reported < m_jobs.size())
+    {
+        wxMilliSleep(100);
+        wxLog::FlushActive();
+        size_t done = m_done;
+        if(done == reported) continue;
+        reported = done;
+        wxLogMessage("[TileBatch::Run] %zu/%zu files, %zu failed", done, m_jobs.size(), (size_t)m_failed);
+    }
+    for(auto& worker : workers) worker.join();
+    wxLog::FlushActive();
+
+    double seconds = wxMax<double>(sw.Time() / 1000.0, 0.001);
+    double mbin = m_insize / 1048576.0;
+    wxLogMessage("[TileBatch::Run] %zu files, %zu failed, %.1f MB in, %.1f Mpixels out, "
+        "in %.2f s, %.1f files/s, %.1f MB/s",
+        m_jobs.size(), (size_t)m_failed, mbin, m_outpixels / 1e6,
+        seconds, m_jobs.size() / seconds, mbin / seconds);
+    return m_failed == 0;
+}
@@ -0,0 +1,98 @@
+/**
+ * implement the cache for decoded tiles
+ *   developed by devseed
+ *
+ *  the key is FNV-1a of input file, tilecfg, plugin and plugincfg,
+ *  so that going back to a previous config needs no decoding
+ */
+
+#include <cstring>
+#include "core.hpp"
+
+TileCache::TileCache(size_t budget)
+{
+    m_budget = budget;
+    m_size = 0;
+    m_hits = m_misses = 0;
+}
+
+uint64_t TileCache::Hash(const void *data, size_t size, uint64_t hash)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    for(size_t i=0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+const TileCache::Entry* TileCache::Find(uint64_t key)
+{
+    auto it = m_index.find(key);
+    if(it == m_index.end())
+    {
+        m_misses++;
+        return nullptr;
+    }
+    m_hits++;
+    m_entries.splice(m_entries.begin(), m_entries, it->second); // move to the front
+    return &*it->second;
+}
+
+bool TileCache::Put(uint64_t key, const struct tilecfg64_t &cfg, const TileStore &tiles,
+    const struct tilenav_t *nav, const struct tilestyle_t *style)
+{
+    size_t size = tiles.GetDataLen();
+    if(!tiles.IsOk() || size > m_budget) return false;
+
+    auto it = m_index.find(key);
+    if(it != m_index.end())
+    {
+        m_size -= it->second->pixels.size() * sizeof(struct pixel_t);
+        m_entries.erase(it->second);
+        m_index.erase(it);
+    }
+    Evict(m_budget - size);
+
+    Entry entry;
+    entry.key = key;
+    entry.cfg = cfg;
+    entry.ntile = tiles.GetCount();
+    entry.w = tiles.GetTileW();
+    entry.h = tiles.GetTileH();
+    entry.opaque = tiles.IsOpaque();
+    entry.pixels.assign(tiles.GetData(), tiles.GetData() + tiles.GetCount() * tiles.GetTilePixels());
+    entry.hasnav = nav != nullptr;
+    if(nav) entry.nav = *nav;
+    entry.hasstyle = style != nullptr;
+    if(style) entry.style = *style;
+    m_entries.push_front(std::move(entry));
+    m_index[key] = m_entries.begin();
+    m_size += size;
+    return true;
+}
+
+void TileCache::Clear()
+{
+    m_index.clear();
+    m_entries.clear();
+    m_size = 0;
+}
+
+void TileCache::SetBudget(size_t budget)
+{
+    m_budget = budget;
+    Evict(budget);
+}
+
+void TileCache::Evict(size_t budget)
+{
+    while(m_size > budget && !m_entries.empty())
+    {
+        auto& last = m_entries.back();
+        m_size -= last.pixels.size() * sizeof(struct pixel_t);
+        m_index.erase(last.key);
+        m_entries.pop_back();
+    }
+}
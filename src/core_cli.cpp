@@ -0,0 +1,303 @@
+/**
+ * implement the command line without gui
+ *   developed by devseed
+ *
+ *  used by the headless cli and --nogui of the gui app, only links the core
+ */
+
+#include <map>
+#include <vector>
+#include <iostream>
+#include <wx/stopwatch.h>
+#include "core.hpp"
+#include "plugin_builtin_simd.h"
+
+extern std::map<wxString, struct tile_decoder_t> g_builtin_plugin_map;
+extern "C" struct tile_decoder_t* STDCALL get_decoder_lua();
+extern "C" const char *g_lua_backend;
+
+// in the syntax of both lua 5.4 and luajit, build with TILEVIEWER_USE_LUAJIT to compare the backends
+static const char *s_benchmark_lua = R"(
+function decode_pre()
+    g_data = get_rawdata()
+    g_cfg = get_tilecfg()
+    return true
+end
+
+function decode_pixel(i, x, y)
+    local v = string.byte(g_data, ((i * g_cfg.h + y) * g_cfg.w + x) % #g_data + 1)
+    return v + v * 0x100 + v * 0x10000 + 0xff000000
+end
+
+function decode_tile(i, out)
+    local w, h = g_cfg.w, g_cfg.h
+    local rowfmt = "<" .. string.rep("I4", w)
+    local row = {}
+    for y=0,h-1 do
+        for x=0,w-1 do row[x+1] = decode_pixel(i, x, y) end
+        memwrite(out, string.pack(rowfmt, table.unpack(row, 1, w)), w*4, y*w*4)
+    end
+    return true
+end
+
+function decode_post()
+    return true
+end
+)";
+
+static const wxCmdLineEntryDesc s_cmd_desc[] =
+{
+    { wxCMD_LINE_SWITCH, "n", "nogui", "decode tiles without gui",
+        wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL},
+    { wxCMD_LINE_SWITCH, "", "benchmark", "measure the builtin decoder kernels and the lua backend without gui",
+        wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL},
+    { wxCMD_LINE_SWITCH, "", "nommap", "read the whole file into memory instead of mmap",
+        wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL},
+    { wxCMD_LINE_SWITCH, "", "opaque", "ignore the alpha channel of decoded tiles",
+        wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL},
+    { wxCMD_LINE_SWITCH, "", "lazy", "decode tiles only when they are shown or saved",
+        wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL},
+    { wxCMD_LINE_OPTION, "", "threads", "threads for reentrant decoders (0 for hardware threads)",
+        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "", "batch", "decode a directory, glob or jsonl manifest without gui, outpath is the directory",
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "", "jobs", "files decoded in parallel for batch (0 for hardware threads)",
+        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "", "format", "output format, png, bmp, raw, pam, ppm or idx (default by outpath ext, pam for stdout)",
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "", "compress", "png compression, fastest, balanced (default) or smallest",
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_SWITCH, "", "nopalette", "save rgb(a) png even if the tiles have no more than 256 colors",
+        wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL},
+    { wxCMD_LINE_OPTION, "i", "inpath", "tile file inpath",
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "o", "outpath", "outpath for decoded file, - for stdout",
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "p", "plugin", "plugin path to decode",
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "", "plugincfg", "plugin config path (default pluginpath.json)",
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "", "pluginparam", "set the plugincfg values, for example {\"name1\": value1,\"name2\": value2}",
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "", "start", "tile start offset (64-bit, 0x for hex)",
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "", "size", "whole tile size (64-bit, 0x for hex)",
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "", "nrow", "how many tiles in a row",
+        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "", "width", "tile width",
+        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "", "height", "tile height",
+        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "", "bpp", "tile bpp",
+        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
+    { wxCMD_LINE_OPTION, "", "nbytes", "bytes number in a tile",
+        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
+    wxCMD_LINE_DESC_END
+};
+
+TileCli::TileCli(TileSolver& solver) : m_solver(solver)
+{
+    m_usegui = true;
+    m_benchmark = false;
+    m_batchjobs = 0;
+}
+
+const wxCmdLineEntryDesc* TileCli::GetCmdDesc()
+{
+    return s_cmd_desc;
+}
+
+bool TileCli::ParseCmdLine(const wxCmdLineParser& parser)
+{
+    wxString val;
+    long num;
+    wxULongLong_t num64;
+    if(parser.FoundSwitch("nogui") == wxCMD_SWITCH_ON) m_usegui = false;
+    else m_usegui = true;
+    m_benchmark = parser.FoundSwitch("benchmark") == wxCMD_SWITCH_ON;
+    if(m_benchmark) m_usegui = false;
+    if(parser.Found("batch", &val)) m_batchsource = val;
+    if(m_batchsource.Length()) m_usegui = false;
+    if(parser.Found("jobs", &num) && num >= 0) m_batchjobs = num;
+    if(parser.FoundSwitch("nommap") == wxCMD_SWITCH_ON) m_solver.m_usemmap = false;
+    if(parser.FoundSwitch("opaque") == wxCMD_SWITCH_ON) m_solver.m_opaque = true;
+    if(parser.FoundSwitch("lazy") == wxCMD_SWITCH_ON) m_solver.m_lazy = true;
+    if(parser.Found("threads", &num) && num >= 0) m_solver.m_nthread = num;
+    if(parser.Found("compress", &val) && !ParseImageProfile(val, &m_solver.m_saveprofile))
+    {
+        wxLogError("[TileCli::ParseCmdLine] unknown compress %s, use %s", val,
+            g_image_profile_names[m_solver.m_saveprofile]);
+    }
+    if(parser.FoundSwitch("nopalette") == wxCMD_SWITCH_ON) m_solver.m_savepalette = false;
+    if(parser.Found("format", &val) && !ParseImageFormat(val, &m_solver.m_saveformat))
+    {
+        wxLogError("[TileCli::ParseCmdLine] unknown format %s, use the outpath ext", val);
+    }
+    if(parser.Found("inpath", &val)) m_solver.m_infile = val;
+    if(parser.Found("outpath", &val)) m_solver.m_outfile = val;
+    if(parser.Found("plugin", &val)) m_solver.m_pluginfile = val;
+    if(parser.Found("plugincfg", &val)) m_solver.m_plugincfgfile = val;
+    if(parser.Found("pluginparam", &val)) m_solver.m_pluginparam = val;
+    if(parser.Found("start", &val) && val.ToULongLong(&num64, 0)) g_tilecfg.start = num64;
+    if(parser.Found("size", &val) && val.ToULongLong(&num64, 0)) g_tilecfg.size = num64;
+    if(parser.Found("nrow", &num)) g_tilecfg.nrow = num;
+    if(parser.Found("width", &num)) g_tilecfg.w = num;
+    if(parser.Found("height", &num)) g_tilecfg.h = num;
+    if(parser.Found("bpp", &num)) g_tilecfg.bpp = num;
+    if(parser.Found("nbytes", &num)) g_tilecfg.nbytes = num;
+    return true;
+}
+
+bool TileCli::Run()
+{
+    bool tostdout = m_solver.m_outfile.GetFullPath() == "-"; // the pixels are on stdout, logs to stderr
+    delete wxLog::SetActiveTarget(new wxLogStream(tostdout ? &std::cerr : &std::cout));
+    if(!m_solver.m_pluginfile.GetFullPath().Length())
+    {
+        m_solver.m_pluginfile = g_builtin_plugin_map.begin()->first; // default plugin
+    }
+    if(m_benchmark) return Benchmark();
+    if(m_batchsource.Length()) return Batch();
+    return Decode();
+}
+
+bool TileCli::Decode()
+{
+    wxLogMessage("[TileCli::Decode] TileViewer " APP_VERSION " start, " + m_cmdline);
+
+    if(!m_solver.Open())
+    {
+        wxLogError(wxString::Format("[TileCli::Decode] open %s failed", 
+            m_solver.m_infile.GetFullPath()));
+        return false;
+    }
+    if(m_solver.Decode(&g_tilecfg) <= 0)
+    {
+        wxLogError(wxString::Format("[TileCli::Decode] decode %s with %s failed", 
+            m_solver.m_infile.GetFullPath(), 
+            m_solver.m_pluginfile.GetFullPath()));
+        return false;
+    }
+    if(!m_solver.Save()) // streamed by strips, lazy tiles are decoded while saving
+    {
+        wxLogError(wxString::Format("[TileCli::Decode] save %s failed", 
+            m_solver.m_outfile.GetFullPath()));
+        return false;
+    }
+    return true;
+}
+
+bool TileCli::Batch()
+{
+    wxLogMessage("[TileCli::Batch] TileViewer " APP_VERSION " start, %s", m_batchsource);
+
+    // the options of the cli are the default for each file
+    TileBatch batch;
+    batch.m_pluginfile = m_solver.m_pluginfile;
+    batch.m_plugincfgfile = m_solver.m_plugincfgfile;
+    batch.m_pluginparam = m_solver.m_pluginparam;
+    batch.m_tilecfg = g_tilecfg;
+    batch.m_usemmap = m_solver.m_usemmap;
+    batch.m_opaque = m_solver.m_opaque;
+    batch.m_nthread = m_solver.m_nthread;
+    batch.m_saveprofile = m_solver.m_saveprofile;
+    batch.m_saveformat = m_solver.m_saveformat;
+    batch.m_savepalette = m_solver.m_savepalette;
+    if(!batch.Load(m_batchsource, m_solver.m_outfile)) return false;
+    return batch.Run(m_batchjobs);
+}
+
+bool TileCli::Benchmark()
+{
+    wxLogMessage("[TileCli::Benchmark] TileViewer " APP_VERSION " start");
+
+    // decode 4M pixels in 64x64 tiles with every kernel and format
+    auto decoder = &g_builtin_plugin_map["default plugin"];
+    struct tilefmt_t fmt = {64, 64, 8, 0};
+    const size_t ntile = 1024;
+    const int bpps[] = {1, 2, 4, 8, 16, 24, 32};
+    const char *kernels[] = {"scalar", "sse2", "avx2"};
+    std::vector<uint8_t> data(ntile * 64 * 64 * 4);
+    std::vector<struct pixel_t> pixels(ntile * 64 * 64);
+    for(size_t i=0; i < data.size(); i++) data[i] = (uint8_t)(i * 2654435761u >> 13);
+
+    for(auto kernel : kernels)
+    {
+        if(!unpack_kernel_select(kernel))
+        {
+            wxLogMessage("[TileCli::Benchmark] %s not supported", kernel);
+            continue;
+        }
+        for(int bpp : bpps)
+        {
+            fmt.bpp = bpp;
+            size_t datasize = ntile * calc_tile_nbytes(&fmt);
+            long long best = 0;
+            for(int k=0; k < 4; k++) // the first one is for warming up
+            {
+                wxStopWatch sw;
+                decoder->decodetiles(decoder->context, data.data(), datasize,
+                    0, ntile, &fmt, pixels.data(), fmt.w, false);
+                long long t = sw.TimeInMicro().GetValue();
+                if(k == 1 || (k > 1 && t < best)) best = t;
+            }
+            best = wxMax<long long>(best, 1);
+            wxLogMessage("[TileCli::Benchmark] %-6s bpp %2d, %8.1f MB/s in, %8.1f Mpixel/s",
+                kernel, bpp, datasize / (double)best, pixels.size() / (double)best);
+        }
+    }
+    unpack_kernel_select(NULL);
+
+    // lua decoder by decodeone for each pixel and decodetiles for each tile
+    auto luadecoder = get_decoder_lua();
+    void *context = nullptr;
+    const size_t nluatile = 64;
+    struct tilecfg64_t cfg = {0};
+    cfg.size = nluatile * 64 * 64 * 4;
+    cfg.nrow = 8;
+    cfg.fmt = {64, 64, 32, 0};
+    if(!PLUGIN_SUCCESS(luadecoder->open(s_benchmark_lua, &context)))
+    {
+        wxLogError("[TileCli::Benchmark] %s open failed, %s", g_lua_backend, luadecoder->msg);
+        return false;
+    }
+    bool res = PLUGIN_SUCCESS(luadecoder->pre64(context, data.data(), cfg.size, &cfg));
+    for(int way=0; way < 2 && res; way++)
+    {
+        long long best = 0;
+        for(int k=0; k < 3 && res; k++)
+        {
+            wxStopWatch sw;
+            if(way == 0)
+            {
+                for(size_t i=0; i < nluatile && res; i++)
+                {
+                    for(int y=0; y < 64; y++)
+                    {
+                        for(int x=0; x < 64; x++)
+                        {
+                            struct tilepos64_t pos = {(int64_t)i, x, y};
+                            res &= PLUGIN_SUCCESS(luadecoder->decodeone64(context,
+                                data.data(), cfg.size, &pos, &cfg.fmt, &pixels[(i * 64 + y) * 64 + x], false));
+                        }
+                    }
+                }
+            }
+            else
+            {
+                res = PLUGIN_SUCCESS(luadecoder->decodetiles(context, data.data(), cfg.size,
+                    0, nluatile, &cfg.fmt, pixels.data(), 64, false));
+            }
+            long long t = wxMax<long long>(sw.TimeInMicro().GetValue(), 1);
+            if(!k || t < best) best = t;
+        }
+        if(!res) break;
+        wxLogMessage("[TileCli::Benchmark] %s %-11s %8.2f Mpixel/s", g_lua_backend,
+            way == 0 ? "decodeone" : "decodetiles", nluatile * 64 * 64 / (double)best);
+    }
+    if(!res) wxLogError("[TileCli::Benchmark] %s decode failed, %s", g_lua_backend, luadecoder->msg);
+    luadecoder->post64(context, data.data(), cfg.size, &cfg);
+    luadecoder->close(context);
+    return res;
+}
@@ -0,0 +1,186 @@
+/**
+ * implement the input source for tile file
+ *   developed by devseed
+ *
+ *  regular files are mapped read-only, so decode reads straight from the page cache,
+ *  pipes and special files fallback to the buffered read
+ *  the file truncated by others while mapped raises SIGBUS on reading the lost pages,
+ *  so the solver checks IsShrunk before decoding and opens the file again
+ */
+
+#include <wx/file.h>
+#include "core.hpp"
+
+#ifdef _WIN32
+#include <wx/msw/wrapwin.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+TileFile::TileFile()
+{
+    m_map = nullptr;
+    m_mapsize = 0;
+#ifdef _WIN32
+    m_hfile = nullptr;
+    m_hmap = nullptr;
+#else
+    m_fd = -1;
+#endif
+}
+
+TileFile::~TileFile()
+{
+    Close();
+}
+
+size_t TileFile::Open(wxString path, bool usemmap)
+{
+    Close();
+    if(usemmap && OpenMap(path)) return m_mapsize;
+
+    // buffered read, the length of pipe is unknown, so read until eof
+    wxFile f(path, wxFile::read);
+    if(!f.IsOpened()) return 0;
+    const size_t chunksize = 0x100000;
+    while(true)
+    {
+        ssize_t readsize = f.Read(m_buf.GetAppendBuf(chunksize), chunksize);
+        if(readsize == wxInvalidOffset || readsize <= 0) break;
+        m_buf.UngetAppendBuf(readsize);
+    }
+    f.Close();
+    return m_buf.GetDataLen();
+}
+
+bool TileFile::OpenMap(wxString path)
+{
+#ifdef _WIN32
+    HANDLE hfile = CreateFileW(path.wc_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(hfile == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER filesize;
+    if(GetFileType(hfile) != FILE_TYPE_DISK || !GetFileSizeEx(hfile, &filesize)
+        || filesize.QuadPart <= 0 || (uint64_t)filesize.QuadPart > (size_t)-1)
+    {
+        CloseHandle(hfile);
+        return false;
+    }
+    HANDLE hmap = CreateFileMappingW(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(!hmap)
+    {
+        CloseHandle(hfile);
+        return false;
+    }
+    void *map = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+    if(!map)
+    {
+        CloseHandle(hmap);
+        CloseHandle(hfile);
+        return false;
+    }
+    m_hfile = hfile;
+    m_hmap = hmap;
+    m_map = map;
+    m_mapsize = (size_t)filesize.QuadPart;
+#else
+    int fd = open(path.fn_str(), O_RDONLY);
+    if(fd < 0) return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+        || st.st_size <= 0 || (uint64_t)st.st_size > (size_t)-1)
+    {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    m_fd = fd; // the mapping keeps its own reference, but fd is for IsShrunk
+    m_map = map;
+    m_mapsize = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+bool TileFile::Close()
+{
+    if(m_map)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(m_map);
+        CloseHandle((HANDLE)m_hmap);
+        CloseHandle((HANDLE)m_hfile);
+        m_hmap = m_hfile = nullptr;
+#else
+        munmap(m_map, m_mapsize);
+        close(m_fd);
+        m_fd = -1;
+#endif
+        m_map = nullptr;
+        m_mapsize = 0;
+    }
+    m_buf.Clear();
+    return true;
+}
+
+bool TileFile::Advise(enum TILE_ACCESS access, size_t offset, size_t size)
+{
+    if(!m_map || offset >= m_mapsize) return false;
+    if(!size || offset + size > m_mapsize) size = m_mapsize - offset;
+#ifdef _WIN32
+    return false; // the mapping view uses the default read ahead on windows
+#else
+    // madvise needs the page aligned address
+    static size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset / pagesize * pagesize;
+    size += offset - start;
+    int advice = MADV_NORMAL;
+    switch(access)
+    {
+        case TILE_ACCESS_SEQUENTIAL: advice = MADV_SEQUENTIAL; break;
+        case TILE_ACCESS_RANDOM: advice = MADV_RANDOM; break;
+        case TILE_ACCESS_WILLNEED: advice = MADV_WILLNEED; break;
+        default: advice = MADV_NORMAL; break;
+    }
+    return madvise((uint8_t*)m_map + start, size, advice) == 0;
+#endif
+}
+
+const uint8_t* TileFile::GetData() const
+{
+    if(m_map) return (const uint8_t*)m_map;
+    return (const uint8_t*)m_buf.GetData();
+}
+
+size_t TileFile::GetDataLen() const
+{
+    if(m_map) return m_mapsize;
+    return m_buf.GetDataLen();
+}
+
+bool TileFile::IsMapped() const
+{
+    return m_map != nullptr;
+}
+
+bool TileFile::IsShrunk() const
+{
+    if(!m_map) return false; // the buffered content is not affected
+#ifdef _WIN32
+    LARGE_INTEGER filesize;
+    if(!GetFileSizeEx((HANDLE)m_hfile, &filesize)) return true;
+    return (uint64_t)filesize.QuadPart < (uint64_t)m_mapsize;
+#else
+    // fd follows the same inode, so replacing the file by rename is fine
+    struct stat st;
+    if(fstat(m_fd, &st) != 0) return true;
+    return (uint64_t)st.st_size < (uint64_t)m_mapsize;
+#endif
+}
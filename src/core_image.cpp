@@ -0,0 +1,627 @@
+/**
+ * implement the image writer for saving without gui
+ *   developed by devseed
+ *
+ *  rows are written in strips from top, so the whole image is never in memory,
+ *    png rows are filtered by the profile, then deflated by chunks in parallel,
+ *      each chunk is a raw deflate stream ended by sync flush, with the previous 32k as dictionary,
+ *      so that the chunks are joined into one zlib stream, and the adler32 is combined
+ *    png is indexed with 1/2/4/8-bit when the palette is given
+ *    bmp is 24-bit for opaque and 32-bit with alpha mask, top-down by negative height
+ *    raw, pam, ppm and idx are the pixels without encoding, for the pipe to other tools
+ */
+
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <wx/file.h>
+#include <wx/filefn.h>
+#include <zlib.h>
+#include "core.hpp"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+struct crc_table_t
+{
+    uint32_t v[256];
+};
+
+static struct crc_table_t make_crc_table()
+{
+    struct crc_table_t table;
+    for(uint32_t i=0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for(int k=0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        table.v[i] = c;
+    }
+    return table;
+}
+
+static uint32_t update_crc(uint32_t crc, const uint8_t *data, size_t size)
+{
+    static const struct crc_table_t s_table = make_crc_table(); // initialized once in all threads
+    crc = ~crc;
+    for(size_t i=0; i < size; i++) crc = s_table.v[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v; p[1] = v >> 8;
+}
+
+static bool write_png_chunk(wxFile& f, const char *type, const uint8_t *data, size_t size)
+{
+    uint8_t head[8], tail[4];
+    put_be32(head, (uint32_t)size);
+    memcpy(head + 4, type, 4);
+    uint32_t crc = update_crc(0, head + 4, 4);
+    crc = update_crc(crc, data, size);
+    put_be32(tail, crc);
+    if(f.Write(head, sizeof(head)) != sizeof(head)) return false;
+    if(size && f.Write(data, size) != size) return false;
+    return f.Write(tail, sizeof(tail)) == sizeof(tail);
+}
+
+const char *g_image_profile_names[IMAGE_PROFILE_COUNT] = {"fastest", "balanced", "smallest"};
+const char *g_image_format_names[IMAGE_FORMAT_COUNT] = {"", "png", "bmp", "raw", "pam", "ppm", "idx"};
+
+struct image_profile_t
+{
+    int level;
+    int strategy;
+    int nfilter; // try filter types [0, nfilter) for each row, pick the smallest sum
+};
+
+static const struct image_profile_t s_profiles[IMAGE_PROFILE_COUNT] =
+{
+    {1, Z_DEFAULT_STRATEGY, 1}, // fastest, none filter
+    {6, Z_FILTERED, 3}, // balanced, none, sub, up
+    {9, Z_FILTERED, 5} // smallest, all filters with average and paeth
+};
+
+static uint32_t pixel_key(const struct pixel_t& p, bool opaque)
+{
+    return p.r | p.g << 8 | p.b << 16 | (uint32_t)(opaque ? 0xff : p.a) << 24;
+}
+
+static uint8_t paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if(pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// cur -> out by the filter type, prev is the unfiltered row above, return the cost
+static size_t filter_row(int type, const uint8_t *cur, const uint8_t *prev,
+    size_t n, size_t bpp, uint8_t *out)
+{
+    size_t cost = 0;
+    for(size_t i=0; i < n; i++)
+    {
+        int a = i >= bpp ? cur[i - bpp] : 0;
+        int b = prev[i];
+        int c = i >= bpp ? prev[i - bpp] : 0;
+        uint8_t v = cur[i];
+        switch(type)
+        {
+        case 1: v -= a; break;
+        case 2: v -= b; break;
+        case 3: v -= (a + b) >> 1; break;
+        case 4: v -= paeth(a, b, c); break;
+        default: break;
+        }
+        out[i] = v;
+        cost += v < 128 ? v : 256 - v;
+    }
+    return cost;
+}
+
+// a raw deflate stream of data, ended by sync flush to join the next one, or finished for the last
+static bool deflate_chunk(const uint8_t *dict, size_t dictsize, const uint8_t *data, size_t size,
+    const struct image_profile_t& profile, bool last, std::vector<uint8_t>& out)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(deflateInit2(&zs, profile.level, Z_DEFLATED, -15, 8, profile.strategy) != Z_OK) return false;
+    if(dictsize) deflateSetDictionary(&zs, dict, (uInt)dictsize);
+    out.resize(deflateBound(&zs, (uLong)size) + 16); // sync flush marker and the empty last block
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = (uInt)size;
+    zs.next_out = out.data();
+    zs.avail_out = (uInt)out.size();
+    int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    bool res = last ? ret == Z_STREAM_END : (ret == Z_OK && !zs.avail_in && zs.avail_out);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return res;
+}
+
+bool ImageWriter::MakePalette(const struct pixel_t *pixels, size_t n, bool opaque,
+    std::vector<struct pixel_t>& palette)
+{
+    std::unordered_map<uint32_t, uint8_t> index;
+    for(auto& c : palette) index.emplace(pixel_key(c, opaque), 0);
+    uint32_t lastkey = 0;
+    bool haslast = false;
+    for(size_t i=0; i < n; i++)
+    {
+        uint32_t key = pixel_key(pixels[i], opaque);
+        if(haslast && key == lastkey) continue; // tiles are mostly runs of the same color
+        lastkey = key;
+        haslast = true;
+        if(!index.emplace(key, 0).second) continue;
+        if(index.size() > 256) return false;
+        struct pixel_t c = pixels[i];
+        if(opaque) c.a = 0xff;
+        palette.push_back(c);
+    }
+    return true;
+}
+
+ImageWriter::ImageWriter()
+{
+    m_profile = IMAGE_PROFILE_BALANCED;
+    m_pool = nullptr;
+    m_format = IMAGE_FORMAT_NONE;
+    m_w = m_h = m_y = 0;
+    m_depth = 8;
+    m_channels = 4;
+    m_adler = 1;
+    m_opaque = false;
+    m_ok = false;
+    m_indexed = false;
+    m_stdout = false;
+}
+
+ImageWriter::~ImageWriter()
+{
+    if(m_file.IsOpened()) Close();
+}
+
+enum IMAGE_FORMAT ImageWriter::GetFormat(const wxString& path)
+{
+    if(path == "-") return IMAGE_FORMAT_PAM; // the size is in header
+    enum IMAGE_FORMAT format = IMAGE_FORMAT_NONE;
+    ParseImageFormat(wxFileName(path).GetExt(), &format);
+    return format;
+}
+
+bool ImageWriter::Open(wxString path, size_t w, size_t h, bool opaque, enum IMAGE_FORMAT format)
+{
+    if(m_file.IsOpened()) Close();
+    m_format = format != IMAGE_FORMAT_NONE ? format : GetFormat(path);
+    m_stdout = path == "-";
+    if(m_format == IMAGE_FORMAT_NONE)
+    {
+        wxLogError("[ImageWriter::Open] %s, only png, bmp, raw, pam, ppm and idx are supported", path);
+        return false;
+    }
+    if(!w || !h || w > 0x7fffffff || h > 0x7fffffff)
+    {
+        wxLogError("[ImageWriter::Open] %s, invalid image size (%zux%zu)", path, w, h);
+        return false;
+    }
+    if(m_palette.size() > 256)
+    {
+        wxLogError("[ImageWriter::Open] %s, palette with %zu colors", path, m_palette.size());
+        return false;
+    }
+    if(m_format == IMAGE_FORMAT_IDX && (!m_palette.size() || m_stdout))
+    {
+        wxLogError("[ImageWriter::Open] %s, idx needs a palette of no more than 256 colors and a file for it", path);
+        return false;
+    }
+
+    if(m_stdout)
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        m_file.Attach(wxFile::fd_stdout);
+    }
+    else if(!m_file.Create(path, true))
+    {
+        wxLogError("[ImageWriter::Open] can not create %s", path);
+        return false;
+    }
+
+    m_path = path;
+    m_w = w;
+    m_h = h;
+    m_y = 0;
+    m_opaque = opaque;
+    m_indexed = (m_format == IMAGE_FORMAT_PNG || m_format == IMAGE_FORMAT_IDX) && m_palette.size();
+    m_index.clear();
+    for(size_t i=0; m_indexed && i < m_palette.size(); i++)
+    {
+        m_index[pixel_key(m_palette[i], m_opaque)] = (uint8_t)i;
+    }
+    switch(m_format)
+    {
+    case IMAGE_FORMAT_PNG: m_ok = BeginPng(); break;
+    case IMAGE_FORMAT_BMP: m_ok = BeginBmp(); break;
+    case IMAGE_FORMAT_PAM: case IMAGE_FORMAT_PPM: m_ok = BeginPnm(); break;
+    default: // raw and idx without header
+        m_depth = 8;
+        m_channels = m_format == IMAGE_FORMAT_IDX ? 1 : 4;
+        m_row.assign(m_w * m_channels, 0);
+        m_ok = true;
+        break;
+    }
+    if(!m_ok) Close();
+    return m_ok;
+}
+
+bool ImageWriter::BeginPng()
+{
+    static const uint8_t s_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    size_t ncolor = m_palette.size();
+    m_depth = !ncolor ? 8 : ncolor <= 2 ? 1 : ncolor <= 4 ? 2 : ncolor <= 16 ? 4 : 8;
+    uint8_t ihdr[13] = {0};
+    put_be32(ihdr, (uint32_t)m_w);
+    put_be32(ihdr + 4, (uint32_t)m_h);
+    ihdr[8] = m_depth;
+    ihdr[9] = ncolor ? 3 : m_opaque ? 2 : 6; // indexed, rgb or rgba
+    if(m_file.Write(s_signature, sizeof(s_signature)) != sizeof(s_signature)) return false;
+    if(!write_png_chunk(m_file, "IHDR", ihdr, sizeof(ihdr))) return false;
+
+    if(ncolor)
+    {
+        std::vector<uint8_t> plte(ncolor * 3), trns(ncolor);
+        size_t ntrns = 0; // the alpha after the last transparent color is 0xff by default
+        for(size_t i=0; i < ncolor; i++)
+        {
+            auto& c = m_palette[i];
+            plte[i * 3] = c.r;
+            plte[i * 3 + 1] = c.g;
+            plte[i * 3 + 2] = c.b;
+            trns[i] = m_opaque ? 0xff : c.a;
+            if(trns[i] != 0xff) ntrns = i + 1;
+        }
+        if(!write_png_chunk(m_file, "PLTE", plte.data(), plte.size())) return false;
+        if(ntrns && !write_png_chunk(m_file, "tRNS", trns.data(), ntrns)) return false;
+    }
+
+    // the zlib header, then the deflated chunks
+    static const uint8_t s_flevel[IMAGE_PROFILE_COUNT] = {0, 2, 3};
+    uint8_t zhead[2] = {0x78, (uint8_t)(s_flevel[m_profile] << 6)};
+    zhead[1] += 31 - (zhead[0] * 256 + zhead[1]) % 31;
+    m_idat.assign(zhead, zhead + 2);
+    m_adler = adler32(0, Z_NULL, 0);
+    m_channels = ncolor ? 1 : m_opaque ? 3 : 4;
+    size_t rowbytes = (m_w * m_channels * m_depth + 7) / 8;
+    m_row.assign(rowbytes, 0);
+    m_prev.assign(rowbytes, 0);
+    m_filtered.assign(rowbytes + 1, 0);
+    m_raw.clear();
+    m_dict.clear();
+    return true;
+}
+
+bool ImageWriter::BeginBmp()
+{
+    // 40 bytes BITMAPINFOHEADER for 24-bit, 108 bytes BITMAPV4HEADER with alpha mask for 32-bit
+    size_t bpp = m_opaque ? 3 : 4;
+    size_t infosize = m_opaque ? 40 : 108;
+    size_t stride = (m_w * bpp + 3) & ~(size_t)3;
+    uint64_t datasize = (uint64_t)stride * m_h;
+    if(datasize + 14 + infosize > 0xffffffffu) return false;
+
+    uint8_t header[14 + 108] = {0};
+    header[0] = 'B'; header[1] = 'M';
+    put_le32(header + 2, (uint32_t)(14 + infosize + datasize));
+    put_le32(header + 10, (uint32_t)(14 + infosize));
+    uint8_t *info = header + 14;
+    put_le32(info, (uint32_t)infosize);
+    put_le32(info + 4, (uint32_t)m_w);
+    put_le32(info + 8, (uint32_t)-(int32_t)m_h); // top-down
+    put_le16(info + 12, 1);
+    put_le16(info + 14, (uint16_t)(bpp * 8));
+    put_le32(info + 16, m_opaque ? 0 : 3); // BI_RGB or BI_BITFIELDS
+    put_le32(info + 20, (uint32_t)datasize);
+    put_le32(info + 24, 2835); // 72 dpi
+    put_le32(info + 28, 2835);
+    if(!m_opaque)
+    {
+        put_le32(info + 40, 0x00ff0000); // bgra in memory
+        put_le32(info + 44, 0x0000ff00);
+        put_le32(info + 48, 0x000000ff);
+        put_le32(info + 52, 0xff000000);
+        put_le32(info + 56, 0x73524742); // sRGB
+    }
+    if(m_file.Write(header, 14 + infosize) != 14 + infosize) return false;
+    m_depth = 8;
+    m_channels = bpp;
+    m_row.assign(stride, 0); // the padding is kept 0
+    return true;
+}
+
+bool ImageWriter::BeginPnm()
+{
+    wxString header;
+    m_depth = 8;
+    if(m_format == IMAGE_FORMAT_PPM)
+    {
+        m_channels = 3;
+        header = wxString::Format("P6\n%zu %zu\n255\n", m_w, m_h);
+    }
+    else
+    {
+        m_channels = m_opaque ? 3 : 4;
+        header = wxString::Format("P7\nWIDTH %zu\nHEIGHT %zu\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+            m_w, m_h, (int)m_channels, m_opaque ? "RGB" : "RGB_ALPHA");
+    }
+    m_row.assign(m_w * m_channels, 0);
+    return m_file.Write(header.c_str(), header.length()) == header.length();
+}
+
+bool ImageWriter::WriteSidecar()
+{
+    wxString text = wxString::Format("{\"width\": %zu, \"height\": %zu, \"format\": \"idx8\", \"palette\": [",
+        m_w, m_h);
+    for(size_t i=0; i < m_palette.size(); i++)
+    {
+        auto& c = m_palette[i];
+        text += wxString::Format("%s[%d, %d, %d, %d]", i ? ", " : "", c.r, c.g, c.b, m_opaque ? 0xff : c.a);
+    }
+    text += "]}\n";
+
+    wxString path = m_path + ".json";
+    wxFile f;
+    if(!f.Create(path, true))
+    {
+        wxLogError("[ImageWriter::WriteSidecar] can not create %s", path);
+        return false;
+    }
+    auto buf = text.utf8_str();
+    bool res = f.Write(buf.data(), buf.length()) == buf.length();
+    return f.Close() && res;
+}
+
+bool ImageWriter::PackRow(const struct pixel_t *src)
+{
+    uint8_t *dst = m_row.data();
+    if(m_indexed)
+    {
+        // pack the indexes from the high bits
+        memset(dst, 0, m_row.size());
+        uint32_t lastkey = pixel_key(m_palette[0], m_opaque);
+        uint8_t lastidx = 0;
+        for(size_t x=0; x < m_w; x++)
+        {
+            uint32_t key = pixel_key(src[x], m_opaque);
+            if(key != lastkey)
+            {
+                auto it = m_index.find(key);
+                if(it == m_index.end())
+                {
+                    wxLogError("[ImageWriter::PackRow] %s, color 0x%08x at (%zu, %zu) not in palette",
+                        m_path, key, x, m_y);
+                    return false;
+                }
+                lastkey = key;
+                lastidx = it->second;
+            }
+            size_t bit = x * m_depth;
+            dst[bit >> 3] |= lastidx << (8 - m_depth - (bit & 7));
+        }
+    }
+    else if(m_format == IMAGE_FORMAT_BMP)
+    {
+        for(size_t x=0; x < m_w; x++, dst += m_channels)
+        {
+            dst[0] = src[x].b;
+            dst[1] = src[x].g;
+            dst[2] = src[x].r;
+            if(m_channels == 4) dst[3] = src[x].a;
+        }
+    }
+    else if(m_channels == 3)
+    {
+        for(size_t x=0; x < m_w; x++, dst += 3)
+        {
+            dst[0] = src[x].r;
+            dst[1] = src[x].g;
+            dst[2] = src[x].b;
+        }
+    }
+    else
+    {
+        memcpy(dst, src, m_w * sizeof(struct pixel_t)); // the same layout as rgba
+        if(m_opaque) for(size_t x=0; x < m_w; x++) dst[x * 4 + 3] = 0xff; // raw of opaque tiles
+    }
+    return true;
+}
+
+bool ImageWriter::DeflateRaw(bool last)
+{
+    // full chunks in parallel, the rest is kept for the next rows
+    size_t nchunk = last ? (m_raw.size() + PNG_DEFLATE_CHUNK - 1) / PNG_DEFLATE_CHUNK : m_raw.size() / PNG_DEFLATE_CHUNK;
+    if(last && !nchunk) nchunk = 1; // the empty last block
+    if(!nchunk) return true;
+
+    std::vector<std::vector<uint8_t>> outs(nchunk);
+    std::vector<uLong> adlers(nchunk);
+    std::vector<uint8_t> oks(nchunk, 0);
+    const auto& profile = s_profiles[m_profile];
+    auto func = [&](size_t b, size_t e)
+    {
+        for(size_t i=b; i < e; i++)
+        {
+            size_t offset = i * PNG_DEFLATE_CHUNK;
+            size_t size = wxMin<size_t>(PNG_DEFLATE_CHUNK, m_raw.size() - offset);
+            const uint8_t *data = m_raw.data() + offset;
+            const uint8_t *dict = i ? data - PNG_DEFLATE_DICT : m_dict.data();
+            size_t dictsize = i ? PNG_DEFLATE_DICT : m_dict.size();
+            oks[i] = deflate_chunk(dict, dictsize, data, size, profile, last && i == nchunk - 1, outs[i]);
+            adlers[i] = adler32(adler32(0, Z_NULL, 0), data, (uInt)size);
+        }
+    };
+    if(m_pool && nchunk > 1) m_pool->Run(nchunk, 1, func);
+    else func(0, nchunk);
+
+    size_t used = wxMin<size_t>(nchunk * PNG_DEFLATE_CHUNK, m_raw.size());
+    for(size_t i=0; i < nchunk; i++)
+    {
+        if(!oks[i])
+        {
+            wxLogError("[ImageWriter::DeflateRaw] %s, deflate chunk %zu failed", m_path, i);
+            return false;
+        }
+        size_t size = wxMin<size_t>(PNG_DEFLATE_CHUNK, used - i * PNG_DEFLATE_CHUNK);
+        m_adler = adler32_combine(m_adler, adlers[i], (z_off_t)size);
+        if(!WriteIdat(outs[i].data(), outs[i].size())) return false;
+    }
+
+    // the last 32k as dictionary of the next chunk
+    size_t dictsize = wxMin<size_t>(PNG_DEFLATE_DICT, used);
+    if(dictsize < PNG_DEFLATE_DICT) m_dict.insert(m_dict.end(), m_raw.begin(), m_raw.begin() + used);
+    else m_dict.assign(m_raw.begin() + used - dictsize, m_raw.begin() + used);
+    if(m_dict.size() > PNG_DEFLATE_DICT) m_dict.erase(m_dict.begin(), m_dict.end() - PNG_DEFLATE_DICT);
+    m_raw.erase(m_raw.begin(), m_raw.begin() + used);
+    return true;
+}
+
+bool ImageWriter::WriteIdat(const uint8_t *data, size_t size)
+{
+    while(size > 0)
+    {
+        size_t n = wxMin<size_t>(size, PNG_IDAT_SIZE - m_idat.size());
+        m_idat.insert(m_idat.end(), data, data + n);
+        data += n;
+        size -= n;
+        if(m_idat.size() < PNG_IDAT_SIZE) break;
+        if(!write_png_chunk(m_file, "IDAT", m_idat.data(), m_idat.size())) return false;
+        m_idat.clear();
+    }
+    return true;
+}
+
+bool ImageWriter::WriteRows(const struct pixel_t *pixels, size_t nrow, size_t stride)
+{
+    if(!m_ok || !pixels) return false;
+    if(m_y + nrow > m_h)
+    {
+        wxLogError("[ImageWriter::WriteRows] %s, rows %zu over height %zu", m_path, m_y + nrow, m_h);
+        m_ok = false;
+        return false;
+    }
+
+    const auto& profile = s_profiles[m_profile];
+    size_t rowbytes = m_row.size();
+    size_t filterbpp = m_channels;
+    int nfilter = m_indexed ? 1 : profile.nfilter; // indexed rows are better not filtered
+    for(size_t k=0; k < nrow && m_ok; k++, m_y++)
+    {
+        if(!(m_ok = PackRow(pixels + k * stride))) break;
+        if(m_format != IMAGE_FORMAT_PNG)
+        {
+            m_ok = m_file.Write(m_row.data(), rowbytes) == rowbytes;
+            continue;
+        }
+
+        size_t offset = m_raw.size();
+        m_raw.resize(offset + 1 + rowbytes);
+        uint8_t *out = m_raw.data() + offset;
+        size_t bestcost = filter_row(0, m_row.data(), m_prev.data(), rowbytes, filterbpp, out + 1);
+        out[0] = 0;
+        for(int type=1; type < nfilter; type++)
+        {
+            size_t cost = filter_row(type, m_row.data(), m_prev.data(), rowbytes, filterbpp, m_filtered.data() + 1);
+            if(cost >= bestcost) continue;
+            bestcost = cost;
+            m_filtered[0] = (uint8_t)type;
+            memcpy(out, m_filtered.data(), rowbytes + 1);
+        }
+        m_row.swap(m_prev);
+        if(m_raw.size() >= PNG_DEFLATE_CHUNK * (m_pool ? m_pool->GetThreads() : 1))
+        {
+            m_ok = DeflateRaw(false);
+        }
+    }
+    if(!m_ok) wxLogError("[ImageWriter::WriteRows] write %s at row %zu failed", m_path, m_y);
+    return m_ok;
+}
+
+bool ImageWriter::Close()
+{
+    if(!m_file.IsOpened()) return false;
+    bool res = m_ok && m_y == m_h;
+    if(res && m_format == IMAGE_FORMAT_PNG)
+    {
+        // the rest rows, adler32 of zlib, the last IDAT
+        uint8_t adler[4];
+        res = DeflateRaw(true);
+        put_be32(adler, (uint32_t)m_adler);
+        if(res) res = WriteIdat(adler, sizeof(adler));
+        if(res && m_idat.size()) res = write_png_chunk(m_file, "IDAT", m_idat.data(), m_idat.size());
+        if(res) res = write_png_chunk(m_file, "IEND", nullptr, 0);
+    }
+    if(res && m_format == IMAGE_FORMAT_IDX) res = WriteSidecar();
+    m_row.clear();
+    m_prev.clear();
+    m_filtered.clear();
+    m_raw.clear();
+    m_raw.shrink_to_fit();
+    m_dict.clear();
+    m_idat.clear();
+    if(m_stdout) m_file.Detach(); // keep stdout for the others
+    else res = m_file.Close() && res;
+    if(!res)
+    {
+        if(!m_stdout) wxRemoveFile(m_path); // no broken image left
+        wxLogError("[ImageWriter::Close] write %s (%zux%zu) failed at row %zu", m_path, m_w, m_h, m_y);
+    }
+    m_ok = false;
+    return res;
+}
+
+bool ParseImageProfile(const wxString& name, enum IMAGE_PROFILE *profile)
+{
+    for(int i=0; i < IMAGE_PROFILE_COUNT; i++)
+    {
+        if(name.Lower() != g_image_profile_names[i]) continue;
+        *profile = (enum IMAGE_PROFILE)i;
+        return true;
+    }
+    return false;
+}
+
+bool ParseImageFormat(const wxString& name, enum IMAGE_FORMAT *format)
+{
+    wxString lname = name.Lower();
+    if(lname == "rgba") lname = "raw";
+    else if(lname == "index") lname = "idx";
+    for(int i=1; i < IMAGE_FORMAT_COUNT; i++)
+    {
+        if(lname != g_image_format_names[i]) continue;
+        *format = (enum IMAGE_FORMAT)i;
+        return true;
+    }
+    return false;
+}
+
+bool SaveImage(wxString path, const struct pixel_t *pixels, size_t w, size_t h, bool opaque)
+{
+    if(!pixels) return false;
+    ImageWriter writer;
+    if(!writer.Open(path, w, h, opaque)) return false;
+    writer.WriteRows(pixels, h, w);
+    return writer.Close();
+}
@@ -0,0 +1,169 @@
+/**
+ * implement the work stealing pool for decoding and rendering tiles
+ *   developed by devseed
+ *
+ *  each worker owns a queue of continuous ranges, takes from its front,
+ *  and steals from the back of the others when it is empty
+ */
+
+#include <algorithm>
+#include "core.hpp"
+
+TilePool::TilePool(size_t nthread)
+{
+    m_func = nullptr;
+    m_generation = 0;
+    m_pending = 0;
+    m_active = 0;
+    m_stop = false;
+    Resize(nthread);
+}
+
+TilePool::~TilePool()
+{
+    Stop();
+}
+
+size_t TilePool::GetHardwareThreads()
+{
+    size_t n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+size_t TilePool::GetThreads() const
+{
+    return m_threads.size() + 1; // the caller also works
+}
+
+bool TilePool::Resize(size_t nthread)
+{
+    if(!nthread) nthread = GetHardwareThreads();
+    if(nthread == GetThreads() && m_queues.size()) return true;
+
+    Stop();
+    m_stop = false;
+    m_queues.clear();
+    for(size_t i=0; i < nthread; i++)
+    {
+        m_queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for(size_t i=1; i < nthread; i++) // queue 0 is for the caller
+    {
+        m_threads.push_back(std::thread(&TilePool::WorkerMain, this, i));
+    }
+    return true;
+}
+
+void TilePool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    for(auto& t : m_threads) t.join();
+    m_threads.clear();
+}
+
+void TilePool::Run(size_t n, size_t grain, const TaskFunc& func)
+{
+    if(!n) return;
+    if(!grain) grain = 1;
+    size_t nrange = (n + grain - 1) / grain;
+    if(m_threads.empty() || nrange == 1)
+    {
+        func(0, n);
+        return;
+    }
+
+    // split into continuous blocks, so that each worker keeps the locality
+    size_t nqueue = m_queues.size();
+    size_t perqueue = (nrange + nqueue - 1) / nqueue;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for(size_t r=0; r < nrange; r++)
+        {
+            size_t begin = r * grain;
+            size_t end = std::min(begin + grain, n);
+            m_queues[r / perqueue]->ranges.push_back(std::make_pair(begin, end));
+        }
+        m_pending = nrange;
+        m_func = &func;
+        m_generation++;
+    }
+    m_cv.notify_all();
+
+    Work(0, func);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_donecv.wait(lock, [this]{ return m_pending == 0 && m_active == 0; });
+    m_func = nullptr;
+}
+
+void TilePool::WorkerMain(size_t id)
+{
+    size_t generation = 0;
+    while(true)
+    {
+        const TaskFunc *func = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [&]{ return m_stop || m_generation != generation; });
+            if(m_stop) return;
+            generation = m_generation;
+            if(!m_func) continue; // woke up after the job finished
+            func = m_func;
+            m_active++;
+        }
+        Work(id, *func);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_active--;
+        }
+        m_donecv.notify_all();
+    }
+}
+
+void TilePool::Work(size_t id, const TaskFunc& func)
+{
+    std::pair<size_t, size_t> range;
+    while(Pop(id, range))
+    {
+        func(range.first, range.second);
+        bool done = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            done = --m_pending == 0;
+        }
+        if(done) m_donecv.notify_all();
+    }
+}
+
+bool TilePool::Pop(size_t id, std::pair<size_t, size_t>& range)
+{
+    auto& own = *m_queues[id];
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.ranges.empty())
+        {
+            range = own.ranges.front();
+            own.ranges.pop_front();
+            return true;
+        }
+    }
+
+    // steal from others
+    size_t nqueue = m_queues.size();
+    for(size_t k=1; k < nqueue; k++)
+    {
+        auto& other = *m_queues[(id + k) % nqueue];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if(!other.ranges.empty())
+        {
+            range = other.ranges.back();
+            other.ranges.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
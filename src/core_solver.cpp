@@ -2,27 +2,120 @@
  * implement the major methods for tile viewer
  *   developed by devseed
  *
- *  dataflow: ->tilepath -(open)-> filebuf -(decode)-> tiles bytes
+ *  dataflow: ->tilepath -(open)-> mapped file -(decode)-> tiles bytes
  *            -(render)-> logicial bitmap -(scale)-> window bitmap
  */
 
-// #include <omp.h>
 #include <map>
-#include <wx/wx.h>
-#include <wx/bitmap.h>
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <wx/file.h>
+#include <wx/stdpaths.h>
+#include <wx/stopwatch.h>
+#include <wx/thread.h>
+#include <cJSON.h>
 #include "core.hpp"
-#include "ui.hpp"
 
 // init decoders
 extern "C" struct tile_decoder_t g_decoder_default;
 extern "C" struct tile_decoder_t* STDCALL get_decoder_lua();
-struct tilecfg_t g_tilecfg = {0, 0, 32, 24, 24, 8, 0};
+extern "C" const char *g_lua_chunkfile;
+extern "C" uint64_t g_lua_chunkkey;
+struct tilecfg64_t g_tilecfg = {0, 0, 32, 24, 24, 8, 0};
 std::map<wxString, struct tile_decoder_t> g_builtin_plugin_map = {
     std::pair<wxString, struct tile_decoder_t>("default plugin",  g_decoder_default)
 };
 
-extern void SetTilecfg(wxString& text, struct tilecfg_t &tilecfg);
-extern void OverridePluginCfg(wxString& jtext, wxString& param);
+// the lua plugins can also set them for the front end
+struct tilenav_t g_tilenav = {.index=0};
+struct tilestyle_t g_tilestyle = {.scale = 1.f, .style = TILE_STYLE_BOARDER};
+
+static bool same_tilenav(const struct tilenav_t &a, const struct tilenav_t &b)
+{
+    return a.index == b.index && a.offset == b.offset && a.x == b.x && a.y == b.y && a.scrollto == b.scrollto;
+}
+
+static bool same_tilestyle(const struct tilestyle_t &a, const struct tilestyle_t &b)
+{
+    return a.scale == b.scale && a.style == b.style && a.reset_scale == b.reset_scale;
+}
+
+void SetTilecfg(wxString& text, struct tilecfg64_t &cfg)
+{
+    cJSON *root = cJSON_Parse(text.mb_str());
+    if(root)
+    {
+        const cJSON* prop = cJSON_GetObjectItem(root, "tilecfg");
+        const cJSON* v = nullptr;
+        v = cJSON_GetObjectItem(prop, "start"); if(v) cfg.start = (uint64_t)v->valuedouble;
+        v = cJSON_GetObjectItem(prop, "size"); if(v) cfg.size = (uint64_t)v->valuedouble;
+        v = cJSON_GetObjectItem(prop, "nrow"); if(v) cfg.nrow = v->valueint;
+        v = cJSON_GetObjectItem(prop, "w"); if(v) cfg.w = v->valueint;
+        v = cJSON_GetObjectItem(prop, "h"); if(v) cfg.h = v->valueint;
+        v = cJSON_GetObjectItem(prop, "bpp"); if(v) cfg.bpp = v->valueint;
+        v = cJSON_GetObjectItem(prop, "nbytes"); if(v) cfg.nbytes = v->valueint;
+        cJSON_Delete(root);
+    }
+}
+
+/**
+ * override json value by text2
+ * @param jtext1 json text
+ * @param jtext2 {"name1": value1, "name2": value2}
+ */
+void OverridePluginCfg(wxString& jtext1, wxString& jtext2)
+{
+    if(!jtext1.Length() || !jtext2.Length()) return;
+
+    jtext2.Replace('\'', '"');
+    cJSON *root1 = cJSON_Parse(jtext1.mb_str());
+    if(!root1) return;
+    cJSON *root2 = cJSON_Parse(jtext2.mb_str());
+    if(!root2) {cJSON_Delete(root1); return;}
+
+    const cJSON* prop;
+    const cJSON* props = cJSON_GetObjectItem(root1, "plugincfg");
+    cJSON_ArrayForEach(prop, props)
+    {
+        const cJSON* name = cJSON_GetObjectItem(prop, "name");
+        const cJSON* type = cJSON_GetObjectItem(prop, "type");
+        cJSON* value = cJSON_GetObjectItem(prop, "value");
+        if(!name) continue;
+        if(!type) continue;
+
+        const cJSON* value2 = cJSON_GetObjectItem(root2, name->valuestring);
+        if(!value2) continue;
+        if(!strcmp(type->valuestring, "string"))
+        {
+            cJSON_SetValuestring(value, value2->valuestring);
+        }
+        else
+        {
+            value->type = value2->type;
+            value->valuedouble = value2->valuedouble;
+            value->valueint = value2->valueint;
+        }
+    }
+    jtext1.Clear();
+    jtext1.Append(cJSON_PrintUnformatted(root1));
+
+    cJSON_Delete(root1);
+    cJSON_Delete(root2);
+}
+
+// the decoder structs are shared by solvers, and open writes the functions and context into them,
+// so open, close and ui config of plugins are done one at a time in all solvers
+static std::recursive_mutex s_pluginmutex;
+
+// each solver keeps its own copy of the decoder struct after open, with its own context
+static void copy_decoder(struct tile_decoder_t *dst, const struct tile_decoder_t *src)
+{
+    size_t size = src->size ? wxMin<size_t>(src->size, sizeof(struct tile_decoder_t)) : sizeof(struct tile_decoder_t);
+    memset(dst, 0, sizeof(struct tile_decoder_t));
+    memcpy(dst, src, size);
+    dst->size = size;
+}
 
 bool TileSolver::LoadDecoder()
 {
@@ -33,6 +126,9 @@ bool TileSolver::LoadDecoder(wxFileName pluginfile)
 {
     struct tile_decoder_t *decoder = nullptr;
     PLUGIN_STATUS status;
+    Cancel(); // the worker uses the decoder
+    std::lock_guard<std::recursive_mutex> lock(s_pluginmutex);
+    wxStopWatch sw;
 
     // try to find decoder
     auto it = g_builtin_plugin_map.find(pluginfile.GetFullName());
@@ -54,7 +150,22 @@ bool TileSolver::LoadDecoder(wxFileName pluginfile)
         }
         wxString luastr;
         f.ReadAll(&luastr);
+
+        // the compiled chunk is cached by the script path, and used if the size and mtime are the same
+        auto pathbuf = filepath.utf8_str();
+        uint64_t pathkey = TileCache::Hash(pathbuf.data(), pathbuf.length());
+        uint64_t size = f.Length(), mtime = pluginfile.GetModificationTime().GetValue().GetValue();
+        uint64_t chunkkey = TileCache::Hash(&size, sizeof(size), pathkey);
+        chunkkey = TileCache::Hash(&mtime, sizeof(mtime), chunkkey);
+        wxFileName chunkfile(wxStandardPaths::Get().GetUserLocalDataDir(),
+            wxString::Format("%016llx.luac", (unsigned long long)pathkey));
+        chunkfile.AppendDir("luac");
+        auto chunkpath = chunkfile.GetFullPath().mb_str();
+        bool usechunk = chunkfile.DirExists() || chunkfile.Mkdir(wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL);
+        g_lua_chunkfile = usechunk ? chunkpath.data() : nullptr;
+        g_lua_chunkkey = chunkkey;
         status = decoder->open(luastr.c_str().AsChar(), &decoder->context);
+        g_lua_chunkfile = nullptr;
     }
     else if ("." + pluginfile.GetExt() == wxDynamicLibrary::GetDllExt()) // c module decoder
     {
@@ -86,19 +197,21 @@ bool TileSolver::LoadDecoder(wxFileName pluginfile)
         wxLogError("[TileSolver::LoadDecoder] can not find %s", pluginfile.GetFullName());
         return false;
     }
+    double openms = sw.TimeInMicro().ToDouble() / 1000.0;
     if(decoder->msg && decoder->msg[0])
     {
-        wxLogMessage("[TileSolver::LoadDecoder] %s decoder->open msg: \n    %s", pluginfile.GetFullName(), decoder->msg);
+        wxLogMessage("[TileSolver::LoadDecoder] %s decoder->open in %.1f ms, msg: \n    %s",
+            pluginfile.GetFullName(), openms, decoder->msg);
     }
     else
     {
-        wxLogMessage("[TileSolver::LoadDecoder] %s", pluginfile.GetFullName());
+        wxLogMessage("[TileSolver::LoadDecoder] %s in %.1f ms", pluginfile.GetFullName(), openms);
     }
     if(!PLUGIN_SUCCESS(status))
     {
         wxLogError(wxString::Format(
             "[TileSolver::LoadDecoder] %s decoder->open %s", pluginfile.GetFullName(), decode_status_str(status)));
-        if(wxGetApp().m_usegui) wxMessageBox(decoder->msg, "decoder->open error", wxICON_ERROR);
+        ReportError(decoder->msg, "decoder->open error");
         return false;
     }
 
@@ -123,23 +236,24 @@ bool TileSolver::LoadDecoder(wxFileName pluginfile)
         }
         OverridePluginCfg(wxtext, m_pluginparam);
     }
-    if(wxGetApp().m_usegui)
-    {
-        wxGetApp().m_configwindow->SetPlugincfg(wxtext);
-        NOTIFY_UPDATE_TILECFG();
-        NOTIFY_UPDATE_TILENAV();
-    }
-    m_plugincfg = wxtext;
 
     // unload old decoder and use new decoder
+    struct tile_decoder_t decoderinst;
+    copy_decoder(&decoderinst, decoder);
     if(m_decoder) UnloadDecoder();
-    m_decoder = decoder;
+    m_decoderinst = decoderinst;
+    m_decoder = &m_decoderinst;
+    m_plugincfg = wxtext;
+    if(m_listener) m_listener->OnPluginLoad(wxtext);
 
     return true;
 }
 
 bool TileSolver::UnloadDecoder()
 {
+    Cancel();
+    EndLazy(); // the lazy tiles are decoded by this decoder
+    std::lock_guard<std::recursive_mutex> lock(s_pluginmutex);
     if(m_decoder)
     {
         m_decoder->close(m_decoder->context);
@@ -150,10 +264,7 @@ bool TileSolver::UnloadDecoder()
         }
         m_decoder = nullptr;
         m_plugincfgfile = wxString();
-        if(wxGetApp().m_usegui)
-        {
-            wxGetApp().m_configwindow->ClearPlugincfg();
-        }
+        if(m_listener) m_listener->OnPluginLoad(wxEmptyString);
     }
     if(m_cmodule.IsLoaded())
     {
@@ -183,73 +294,352 @@ wxString TileSolver::LoadPlugincfg()
 TileSolver::TileSolver()
 {
     m_decoder = nullptr;
+    memset(&m_decoderinst, 0, sizeof(m_decoderinst));
+    m_usemmap = true;
+    m_opaque = false;
+    m_nthread = 0;
+    m_lazy = false;
+    m_prefetch = 8;
+    m_cachesize = TILE_CACHE_BUDGET;
+    m_saveprofile = IMAGE_PROFILE_BALANCED;
+    m_saveformat = IMAGE_FORMAT_NONE;
+    m_savepalette = true;
+    m_datasize = 0;
+    m_shiftok = false;
+    m_shiftkey = 0;
+    m_shiftstart = 0;
+    m_prefetchfirst = m_prefetchcount = 0;
+    m_prefetchstop = false;
+    m_state.cfg = m_state.out = nullptr;
+    m_state.async = false;
+    m_busy = m_cancel = m_jobnotified = false;
+    m_islazy = false;
+    m_lazytiles = 0;
+    m_lazystart = m_lazysize = 0;
+    m_lazypost = false;
+}
+
+TileSolver::~TileSolver()
+{
+    Cancel();
+    StopPrefetch();
 }
 
 size_t TileSolver::Open(wxFileName infile)
 {
+    Cancel(); // the worker reads from m_file
+    EndLazy(); // so as the lazy decoding and the deferred post
     if(infile.Exists()) m_infile = infile;
     auto inpath = m_infile.GetFullPath();
     if(inpath.Length() == 0) return 0;
 
-    wxFile f(inpath, wxFile::read);
-    size_t readsize = 0;
-    if(!f.IsOpened())
+    auto time_start = wxDateTime::UNow();
+    size_t readsize = m_file.Open(inpath, m_usemmap);
+    auto time_end = wxDateTime::UNow();
+    if(!readsize)
     {
         wxLogError(wxString::Format("[TileSolver::Open] open %s failed",  inpath));
         return 0;
     }
-    readsize = f.Read(m_filebuf.GetWriteBuf(f.Length()), f.Length());
-    m_filebuf.SetDataLen(readsize); // DataSize is not the valid size
-    f.Close();
 
-    wxLogMessage(wxString::Format("[TileSolver::Open] open %s with %zu bytes", inpath, readsize));
+    wxLogMessage(wxString::Format("[TileSolver::Open] open %s with %zu bytes (%s), in %llu ms",
+        inpath, readsize, m_file.IsMapped() ? "mmap" : "buffered",
+        (time_end - time_start).GetMilliseconds()));
 
     return readsize;
 }
 
-size_t TileSolver::PrepareTilebuf()
+void TileSolver::ClearTiles()
+{
+    std::lock_guard<std::mutex> lock(m_storemutex);
+    m_tiles.Clear();
+}
+
+size_t TileSolver::GetDatasize()
 {
     size_t start = m_tilecfg.start;
     size_t datasize = m_tilecfg.size;
+    if(start >= m_file.GetDataLen()) return 0;
+    if(!datasize) return m_file.GetDataLen() - start;
+    return wxMin<size_t, size_t>(datasize, m_file.GetDataLen() - start);
+}
+
+size_t TileSolver::PrepareTilebuf()
+{
+    size_t start = m_tilecfg.start;
     size_t nbytes = calc_tile_nbytes(&m_tilecfg.fmt);
 
     // check datasize avilable
-    if(m_filebuf.GetDataLen() - start < 0)
+    if(start >= m_file.GetDataLen())
     {
-        wxLogError("[TileSolver::Decode] start(%u) is bigger than file (%zu)",
-                    start, m_filebuf.GetDataLen());
+        wxLogError("[TileSolver::Decode] start(%zu) is bigger than file (%zu)",
+                    start, m_file.GetDataLen());
         return 0;
     }
-
-    if(!datasize) datasize = m_filebuf.GetDataLen() - start;
-    else datasize = wxMin<size_t, size_t>(datasize, m_filebuf.GetDataLen() - start);
+    size_t datasize = GetDatasize();
 
     // prepares tiles
-    int ntile = datasize / nbytes;
-    if(ntile <= 0) ntile = 1; // prevent data less than nbytes
-    m_tiles.clear();
-    for(int i=0; i < ntile; i++)
-    {
-        auto tile = wxImage(m_tilecfg.w, m_tilecfg.h);
-        tile.InitAlpha();
-        if (tile.IsOk())
+    size_t ntile = datasize / nbytes;
+    if(!ntile) ntile = 1; // prevent data less than nbytes
+    if(!m_tiles.Reset(ntile, m_tilecfg.w, m_tilecfg.h, m_opaque))
+    {
+        wxString msg = wxString::Format("[TileSolver::PrepareTilebuf] %zu tiles (%dX%d) is not ready, please reduce the tile size", 
+            ntile, m_tilecfg.w, m_tilecfg.h);
+        ReportError(msg, "render error");
+        wxLogError(msg);
+        return 0;
+    }
+    return datasize;
+}
+
+size_t TileSolver::ShiftTilebuf(uint64_t shiftkey, std::vector<std::pair<size_t, size_t>>& ranges)
+{
+    int64_t nbytes = calc_tile_nbytes(&m_tilecfg.fmt);
+    if(!m_shiftok || shiftkey != m_shiftkey || !m_tiles.IsOk() || nbytes <= 0) return 0;
+    int64_t diff = (int64_t)m_tilecfg.start - (int64_t)m_shiftstart;
+    if(diff % nbytes) return 0;
+    size_t datasize = GetDatasize();
+    size_t ntile = datasize / nbytes;
+    if(!ntile) return 0; // less than a tile, decode as usual
+
+    // new tile i is the previous tile i + delta, decode the others
+    int64_t delta = diff / nbytes;
+    int64_t prevntile = m_tiles.GetCount();
+    if(!m_tiles.Shift(delta, ntile)) return 0;
+    int64_t begin = wxMin<int64_t>(wxMax<int64_t>(0, -delta), ntile);
+    int64_t end = wxMax<int64_t>(wxMin<int64_t>(ntile, prevntile - delta), begin);
+    ranges.clear();
+    if(begin > 0) ranges.push_back(std::make_pair((size_t)0, (size_t)begin));
+    if(end < (int64_t)ntile) ranges.push_back(std::make_pair((size_t)end, (size_t)(ntile - end)));
+    wxLogMessage("[TileSolver::Decode] shift %lld tiles, keep %lld tiles", (long long)delta, (long long)(end - begin));
+    return datasize;
+}
+
+uint64_t TileSolver::MakeCacheKey(const wxString& plugincfg, bool withrange)
+{
+    // the input is identified by path, size and mtime, hashing the content is too slow
+    uint64_t key = TileCache::Hash(nullptr, 0);
+    auto hashstr = [&key](const wxString& str)
+    {
+        auto buf = str.utf8_str();
+        key = TileCache::Hash(buf.data(), buf.length(), key);
+    };
+    auto hashval = [&key](uint64_t val)
+    {
+        key = TileCache::Hash(&val, sizeof(val), key);
+    };
+    auto hashmtime = [&hashval](const wxFileName& file)
+    {
+        hashval(file.FileExists() ? file.GetModificationTime().GetValue().GetValue() : 0);
+    };
+
+    hashstr(m_infile.GetFullPath());
+    hashval(m_file.GetDataLen());
+    hashmtime(m_infile);
+    if(withrange) // nrow is only for layout
+    {
+        hashval(m_tilecfg.start);
+        hashval(m_tilecfg.size);
+    }
+    hashval(m_tilecfg.w);
+    hashval(m_tilecfg.h);
+    hashval(m_tilecfg.bpp);
+    hashval(m_tilecfg.nbytes);
+    hashval(m_opaque);
+    hashstr(m_pluginfile.GetFullPath());
+    hashmtime(m_pluginfile);
+    hashstr(plugincfg);
+    return key;
+}
+
+bool TileSolver::HasParse(bool post)
+{
+    auto decoder = m_decoder;
+    if(!decoder) return false;
+    if(post) return TILE_DECODER_HAS(decoder, post64) || decoder->post;
+    else return TILE_DECODER_HAS(decoder, pre64) || decoder->pre;
+}
+
+PLUGIN_STATUS TileSolver::CallParse(bool post, struct tilecfg64_t *cfg)
+{
+    auto decoder = m_decoder;
+    auto rawdata = m_file.GetData();
+    auto rawsize = m_file.GetDataLen();
+    CB_decode_parse64 parse64 = nullptr;
+    if(post && TILE_DECODER_HAS(decoder, post64)) parse64 = decoder->post64;
+    if(!post && TILE_DECODER_HAS(decoder, pre64)) parse64 = decoder->pre64;
+    if(parse64) return parse64(decoder->context, rawdata, rawsize, cfg);
+
+    // shim for the plugins only know 32-bit tilecfg_t
+    CB_decode_parse parse = post ? decoder->post : decoder->pre;
+    if(!parse) return STATUS_OK;
+    struct tilecfg_t cfg32;
+    if(!tilecfg_to32(cfg, &cfg32))
+    {
+        wxLogError("[TileSolver::Decode] %s only supports 32-bit tilecfg, start(%llu) or size(%llu) is too large",
+            m_pluginfile.GetFullName(), (unsigned long long)cfg->start, (unsigned long long)cfg->size);
+        return STATUS_RANGERROR;
+    }
+    auto status = parse(decoder->context, rawdata, rawsize, &cfg32);
+    tilecfg_from32(&cfg32, cfg);
+    return status;
+}
+
+bool TileSolver::HasDecodeOne()
+{
+    auto decoder = m_decoder;
+    if(!decoder) return false;
+    return TILE_DECODER_HAS(decoder, decodeone64) || decoder->decodeone;
+}
+
+PLUGIN_STATUS TileSolver::CallDecodeOne(const uint8_t *data, size_t datasize,
+    struct tilepos64_t *pos, struct pixel_t *pixel, bool remain_index)
+{
+    auto decoder = m_decoder;
+    if(TILE_DECODER_HAS(decoder, decodeone64))
+    {
+        return decoder->decodeone64(decoder->context,
+            data, datasize, pos, &m_tilecfg.fmt, pixel, remain_index);
+    }
+
+    // shim for the plugins only know 32-bit tilepos_t
+    if(pos->i > INT32_MAX) return STATUS_RANGERROR;
+    struct tilepos_t pos32 = {(int)pos->i, pos->x, pos->y};
+    return decoder->decodeone(decoder->context,
+        data, datasize, &pos32, &m_tilecfg.fmt, pixel, remain_index);
+}
+
+bool TileSolver::HasDecodeTiles()
+{
+    auto decoder = m_decoder;
+    if(!decoder) return false;
+    return TILE_DECODER_HAS(decoder, decodetiles);
+}
+
+bool TileSolver::HasDecodeRange()
+{
+    auto decoder = m_decoder;
+    if(!decoder) return false;
+    return HasDecodeTiles() || (!decoder->decodeall && HasDecodeOne());
+}
+
+bool TileSolver::IsReentrant()
+{
+    auto decoder = m_decoder;
+    if(!decoder) return false;
+    return TILE_DECODER_HAS(decoder, flags) && (decoder->flags & TILE_DECODER_FLAG_REENTRANT);
+}
+
+bool TileSolver::IsShiftable()
+{
+    auto decoder = m_decoder;
+    if(!decoder || !TILE_DECODER_HAS(decoder, flags)) return false;
+    return HasDecodeRange() && (decoder->flags & TILE_DECODER_FLAG_TILE_LOCAL);
+}
+
+PLUGIN_STATUS TileSolver::DecodeRange(const uint8_t *data, size_t datasize,
+    size_t first, size_t count, size_t *failtile, bool parallel)
+{
+    auto decoder = m_decoder;
+    bool usetiles = HasDecodeTiles();
+    size_t tilesize = m_tiles.GetTilePixels() * sizeof(struct pixel_t);
+
+    // decode tiles [begin, end), and find out which tile failed
+    auto decodechunk = [&](size_t begin, size_t end, size_t *fail) -> PLUGIN_STATUS
+    {
+        PLUGIN_STATUS status = STATUS_OK;
+        if(usetiles)
         {
-            m_tiles.push_back(tile);
+            status = decoder->decodetiles(decoder->context, data, datasize,
+                begin, end - begin, &m_tilecfg.fmt, m_tiles.GetTile(begin), m_tiles.GetTileW(), false);
+            if(PLUGIN_SUCCESS(status)) return status;
+            PLUGIN_STATUS batchstatus = status;
+            for(size_t i=begin; i < end; i++)
+            {
+                memset(m_tiles.GetTile(i), 0, tilesize);
+                status = decoder->decodetiles(decoder->context, data, datasize,
+                    i, 1, &m_tilecfg.fmt, m_tiles.GetTile(i), m_tiles.GetTileW(), false);
+                if(!PLUGIN_SUCCESS(status))
+                {
+                    *fail = i;
+                    return status;
+                }
+            }
+            // the plugin fails only in batch, and the tiles decoded one by one are the result
+            wxLogMessage("[TileSolver::DecodeRange] decoder->decodetiles %s for tiles [%zu, %zu), ok one by one",
+                decode_status_str(batchstatus), begin, end);
+            return STATUS_OK;
         }
-        else
+
+        for(size_t i=begin; i < end; i++)
+        {
+            for(int y=0; y < m_tilecfg.h; y++)
+            {
+                struct pixel_t *row = m_tiles.GetRow(i, y);
+                for(int x=0; x < m_tilecfg.w; x++)
+                {
+                    struct tilepos64_t pos = {(int64_t)i, x, y};
+                    struct pixel_t pixel = {0};
+                    status = CallDecodeOne(data, datasize, &pos, &pixel, false);
+                    if(!PLUGIN_SUCCESS(status))
+                    {
+                        *fail = i;
+                        return status;
+                    }
+                    row[x] = pixel;
+                }
+            }
+        }
+        return STATUS_OK;
+    };
+
+    // each task takes about 16k pixels, the tiles after the failed one are cleared
+    PLUGIN_STATUS status = STATUS_OK;
+    size_t end = first + count;
+    size_t grain = wxMax<size_t>(1, 0x4000 / m_tiles.GetTilePixels());
+    if(!parallel || !IsReentrant() || m_pool.GetThreads() < 2) // lua function can not be called in parallel, unless on lanes
+    {
+        for(size_t begin=first; begin < end; begin += grain)
+        {
+            status = decodechunk(begin, wxMin<size_t>(begin + grain, end), failtile);
+            if(!PLUGIN_SUCCESS(status)) break;
+        }
+        if(PLUGIN_SUCCESS(status)) return STATUS_OK;
+        if(*failtile + 1 < end)
         {
-            m_tiles.clear();
-            wxString msg = wxString::Format("[TileSolver::PrepareTilebuf] tile (%dX%d) is not ready, please reduce the tile size", m_tilecfg.w, m_tilecfg.h);
-            if(wxGetApp().m_usegui) wxMessageBox(msg, "render error", wxICON_ERROR);
-            return 0;
+            memset(m_tiles.GetTile(*failtile + 1), 0, (end - *failtile - 1) * tilesize);
         }
+        return status;
     }
-    return datasize;
+
+    std::atomic<size_t> fail((size_t)-1);
+    m_pool.Run(count, grain, [&](size_t b, size_t e)
+    {
+        if(first + b > fail.load(std::memory_order_relaxed)) return;
+        size_t i = 0;
+        if(PLUGIN_SUCCESS(decodechunk(first + b, first + e, &i))) return;
+        size_t prev = fail.load();
+        while(i < prev && !fail.compare_exchange_weak(prev, i));
+    });
+    if(fail.load() == (size_t)-1) return STATUS_OK;
+
+    // make the result the same as serial decoding, and get the msg of the first failed tile
+    size_t i = fail.load();
+    memset(m_tiles.GetTile(i), 0, (end - i) * tilesize);
+    status = decodechunk(i, i + 1, failtile);
+    *failtile = i;
+    return PLUGIN_SUCCESS(status) ? STATUS_FAIL : status;
 }
 
-int TileSolver::Decode(struct tilecfg_t *tilecfg, wxFileName pluginfile)
+bool TileSolver::DecodeBegin(struct tilecfg64_t *tilecfg, wxFileName pluginfile, bool async)
 {
-    m_bitmap = wxBitmap(); // disable render bitmap while decode
+    Cancel(); // the new config supersedes the decoding in flight
+    EndLazy(); // post of the previous lazy decoding before the next pre
+    if(m_file.IsShrunk()) // the pages beyond the new end fault when reading, so map again
+    {
+        wxLogWarning("[TileSolver::Decode] %s is truncated, open it again", m_infile.GetFullName());
+        Open(m_infile);
+    }
     if(tilecfg) m_tilecfg = *tilecfg;
     if(pluginfile.GetFullPath().Length() > 0)
     {
@@ -258,39 +648,96 @@ int TileSolver::Decode(struct tilecfg_t *tilecfg, wxFileName pluginfile)
         m_decoder = nullptr;
     }
 
-    // prepare decoder and parameters
+    // prepare decoder and parameters, the config window is only for the ui thread
     if(!m_decoder) LoadDecoder(m_pluginfile);
     auto decoder = m_decoder;
     if(!decoder)
     {
         wxLogError("[TileSolver::Decode] decoder %s is invalid", m_pluginfile.GetFullName());
-        m_tiles.clear();
-        return -1;
+        ClearTiles();
+        return false;
     }
+    wxString plugincfg = m_listener ? m_listener->OnPluginConfig(m_plugincfg) : m_plugincfg;
     if(decoder->recvui)
     {
-        wxString wxtext;
-        if(!wxGetApp().m_usegui) wxtext = m_plugincfg;
-        else wxtext = wxGetApp().m_configwindow->GetPlugincfg();
-        decoder->recvui(decoder->context, wxtext.mb_str(), wxtext.size());
+        std::lock_guard<std::recursive_mutex> lock(s_pluginmutex);
+        decoder->recvui(decoder->context, plugincfg.mb_str(), plugincfg.size());
         if(decoder->msg && decoder->msg[0])
         {
             wxLogMessage("[TileSolver::Decode] %s decoder->recvui msg: \n    %s",
                 m_pluginfile.GetFullName(), decoder->msg);
         }
     }
+    m_pool.Resize(m_nthread);
+    m_cache.SetBudget(m_cachesize);
 
+    // the worker decodes on its own tilecfg, and writes back when done
+    m_state.async = async;
+    if(async)
+    {
+        m_jobcfg = m_tilecfg;
+        m_state.cfg = &m_jobcfg;
+        m_state.out = tilecfg;
+    }
+    else
+    {
+        m_state.cfg = tilecfg ? tilecfg : &m_tilecfg;
+        m_state.out = nullptr;
+    }
+    m_state.plugincfg = plugincfg;
+    m_state.cachekey = m_state.shiftkey = 0;
+    m_state.nrow = m_state.cfg->nrow;
+    m_state.ok = true; // only cache the tiles without error
+    m_state.cached = m_state.shiftable = false;
+    m_state.result = 0;
+    m_state.time_start = wxDateTime::UNow();
+    m_state.decodename = nullptr;
+    m_state.decodeus = 0;
+    m_state.hasnav = m_state.hasstyle = false;
+    return true;
+}
+
+void TileSolver::DecodeTiles()
+{
     // pre processing
-    if(!m_filebuf.GetDataLen()) return 0;
+    if(!m_file.GetDataLen()) return;
     PLUGIN_STATUS status;
-    size_t start = m_tilecfg.start;
+    auto decoder = m_decoder;
     auto context = decoder->context;
-    auto rawdata = (uint8_t*)m_filebuf.GetData();
-    auto rawsize = m_filebuf.GetDataLen();
-    auto time_start = wxDateTime::UNow();
-    if(decoder->pre)
+    auto rawdata = m_file.GetData(); // read straight from the mapping
+    auto cfg = m_state.cfg;
+    m_state.cachekey = MakeCacheKey(m_state.plugincfg);
+
+    // the same config decoded before, skip all the plugin calls
+    auto entry = m_cache.GetBudget() ? m_cache.Find(m_state.cachekey) : nullptr;
+    if(entry)
+    {
+        std::lock_guard<std::mutex> lock(m_storemutex);
+        if(m_tiles.Reset(entry->ntile, entry->w, entry->h, entry->opaque))
+        {
+            memcpy(m_tiles.GetData(), entry->pixels.data(), m_tiles.GetDataLen());
+            m_tilecfg = entry->cfg;
+            if(!m_tilecfg.nrow) m_tilecfg.nrow = m_state.nrow; // plugin did not set nrow, keep current layout
+            *cfg = m_tilecfg;
+            m_state.hasnav = entry->hasnav;
+            m_state.nav = entry->nav;
+            m_state.hasstyle = entry->hasstyle;
+            m_state.style = entry->style;
+            m_state.cached = true;
+            m_state.result = m_tiles.GetCount();
+        }
+    }
+    if(m_state.cached)
+    {
+        PushJob(TILE_JOB_STORE, 0, m_state.result);
+        PushJob(TILE_JOB_TILES, 0, m_state.result);
+        return;
+    }
+
+    if(HasParse(false))
     {
-        status = decoder->pre(context, rawdata, rawsize, tilecfg);
+        m_file.Advise(TILE_ACCESS_RANDOM); // plugins usually parse headers or index tables
+        status = CallParse(false, cfg);
         if(decoder->msg && decoder->msg[0])
         {
             wxLogMessage("[TileSolver::Decode] decoder->pre msg: \n    %s", decoder->msg);
@@ -298,26 +745,61 @@ int TileSolver::Decode(struct tilecfg_t *tilecfg, wxFileName pluginfile)
         if(!PLUGIN_SUCCESS(status))
         {
             wxLogError("[TileSolver::Decode] decoder->pre %s", decode_status_str(status));
-            if(wxGetApp().m_usegui) wxMessageBox(decoder->msg, "decoder->pre error", wxICON_ERROR);
-            m_tiles.clear();
-            return -1;
+            ReportError(decoder->msg, "decoder->pre error");
+            ClearTiles();
+            m_state.result = -1;
+            return;
         }
-        m_tilecfg = *tilecfg; // the pre process can change tilecfg
+        m_tilecfg = *cfg; // the pre process can change tilecfg
     }
 
-    // decoding processing
-    auto datasize  = PrepareTilebuf();
-    size_t ntile = m_tiles.size();
-    size_t nbytes = calc_tile_nbytes(&m_tilecfg.fmt);
+    // decoding processing, only decode the exposed tiles if start moves by whole tiles
+    std::vector<std::pair<size_t, size_t>> ranges;
+    size_t datasize = 0;
+    m_state.shiftkey = MakeCacheKey(m_state.plugincfg, false);
+    m_state.shiftable = !m_lazy && IsShiftable();
+    {
+        std::lock_guard<std::mutex> lock(m_storemutex); // the ui composes from m_tiles
+        if(m_state.shiftable) datasize = ShiftTilebuf(m_state.shiftkey, ranges);
+        if(!datasize)
+        {
+            datasize = PrepareTilebuf();
+            ranges.assign(1, std::make_pair((size_t)0, m_tiles.GetCount()));
+        }
+    }
+    m_shiftok = false;
+    size_t ntile = m_tiles.GetCount();
+    size_t start = m_tilecfg.start;
+    m_datasize = datasize;
+    m_state.result = ntile;
+
+    // the tiles kept by shifting can be shown at once
+    size_t kept = 0;
+    PushJob(TILE_JOB_STORE, 0, ntile);
+    for(auto& range : ranges)
+    {
+        if(range.first > kept) PushJob(TILE_JOB_TILES, kept, range.first - kept);
+        kept = range.first + range.second;
+    }
+    if(kept < ntile) PushJob(TILE_JOB_TILES, kept, ntile - kept);
+
     if(datasize)
     {
-        if(decoder->decodeall)
+        m_file.Advise(TILE_ACCESS_SEQUENTIAL, start, datasize);
+        if(!m_lazy) m_file.Advise(TILE_ACCESS_WILLNEED, start, datasize);
+        if(decoder->decodeall && !HasDecodeTiles())
         {
-            size_t npixel;
-            struct pixel_t *pixels;
+            // the store is lent to the decoder to fill in place, valid until post
+            size_t npixel = ntile * m_tiles.GetTilePixels();
+            struct pixel_t *pixels = m_tiles.GetData();
+            wxStopWatch sw;
             status = decoder->decodeall(context,
                 rawdata + start, datasize, &m_tilecfg.fmt,  &pixels, &npixel, true);
-            wxLogMessage(wxString::Format("[TileSolver::Decode] decoder->decodeall recv %zu pixels", npixel));
+            m_state.decodeus = sw.TimeInMicro();
+            m_state.decodename = "decodeall";
+            bool inplace = pixels == m_tiles.GetData();
+            wxLogMessage(wxString::Format("[TileSolver::Decode] decoder->decodeall recv %zu pixels%s",
+                npixel, inplace ? " in place" : ""));
             if(decoder->msg && decoder->msg[0])
             {
                 wxLogMessage("[TileSolver::Decode] decoder->decodeall msg: \n    %s", decoder->msg);
@@ -325,69 +807,132 @@ int TileSolver::Decode(struct tilecfg_t *tilecfg, wxFileName pluginfile)
             if(!PLUGIN_SUCCESS(status))
             {
                 wxLogError("[TileSolver::Decode] decoder->decodeall %s", decode_status_str(status));
-                if(wxGetApp().m_usegui) wxMessageBox(decoder->msg, "decoder->decodeall error", wxICON_ERROR);
-                goto tilesolver_decode_post_start;
+                m_state.ok = false;
+                ReportError(decoder->msg, "decoder->decodeall error");
+                return;
             }
 
-            size_t ntilepixel = m_tilecfg.fmt.w * m_tilecfg.fmt.h;
-            for(int i=0; i< ntile; i++)
+            // pixels of the decoder are in the same layout as the store, copy all in once
+            size_t ncopy = wxMin<size_t>(npixel / m_tiles.GetTilePixels(), ntile);
+            if(pixels && !inplace)
             {
-                size_t tilestart = i * ntilepixel;
-                if(tilestart + ntilepixel > npixel) break;
-                auto& tile = m_tiles[i];
-                uint8_t *rgbdata = tile.GetData();
-                uint8_t *adata = tile.GetAlpha();
-                for(int pixeli=0; pixeli < ntilepixel; pixeli++)
-                {
-                    memcpy(rgbdata + pixeli*3, (void*)&pixels[tilestart + pixeli], 3);
-                    adata[pixeli] = pixels[tilestart + pixeli].a; // alpah is in seperate channel
-                }
+                memcpy(m_tiles.GetData(), pixels, ncopy * m_tiles.GetTilePixels() * sizeof(struct pixel_t));
             }
+            PushJob(TILE_JOB_TILES, 0, ntile);
         }
-        else if(decoder->decodeone)
+        else if(HasDecodeTiles() || HasDecodeOne())
         {
-            for(int i=0; i< ntile; i++)
+            size_t failtile = 0;
+            const char *name = HasDecodeTiles() ? "decodetiles" : "decodeone";
+            if(m_lazy) // tiles are decoded by EnsureTiles when they are needed
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_decodemutex);
+                    m_tilestate.assign(ntile, TILE_STATE_NONE);
+                    m_lazystart = start; // m_tilecfg and m_datasize are changed by the next decoding
+                    m_lazysize = datasize;
+                    m_lazytiles = ntile;
+                    m_islazy = true;
+                }
+                wxLogMessage("[TileSolver::Decode] lazy decode %zu tiles by decoder->%s", ntile, name);
+                return;
+            }
+
+            // decode by whole tile rows of about 256k pixels, the view shows them and the job can be cancelled between
+            size_t nrow = wxMax<size_t>(1, m_state.nrow);
+            size_t batch = wxMax<size_t>(1, 0x40000 / (nrow * m_tiles.GetTilePixels())) * nrow;
+            status = STATUS_OK;
+            wxStopWatch sw;
+            m_state.decodename = name;
+            for(auto& range : ranges)
             {
-                auto& tile = m_tiles[i];
-                uint8_t *rgbdata = tile.GetData();
-                uint8_t *adata = tile.GetAlpha();
-                for(int y=0; y < m_tilecfg.h; y++)
+                size_t end = range.first + range.second;
+                for(size_t first=range.first; first < end; first += batch)
                 {
-                    for(int x=0; x < m_tilecfg.w; x++)
+                    if(m_cancel)
                     {
-                        struct tilepos_t pos = {i, x, y};
-                        struct pixel_t pixel = {0};
-                        status = decoder->decodeone(context, // lua function might not be in omp parallel
-                            rawdata + start, datasize, &pos, &m_tilecfg.fmt, &pixel, false);
-                        if(!PLUGIN_SUCCESS(status))
-                        {
-                            wxLogMessage("[TileSolver::Decode] decoder->decodeone msg: \n    %s", decoder->msg);
-                            wxLogError("[TileSolver::Decode] decoder->decodeone %s", decode_status_str(status));
-                            if(wxGetApp().m_usegui) wxMessageBox(decoder->msg, "decode_one error", wxICON_ERROR);
-                            goto tilesolver_decode_post_start;
-                        }
-                        auto pixeli = y * m_tilecfg.w  + x;
-                        memcpy(rgbdata + pixeli*3, &pixel, 3);
-                        adata[pixeli] = pixel.a; // alpah is in seperate channel
+                        wxLogMessage("[TileSolver::Decode] cancelled at tile %zu", first);
+                        m_state.result = -1;
+                        return;
                     }
+                    size_t count = wxMin<size_t>(batch, end - first);
+                    sw.Start(); // only the decoding, without the view updates
+                    status = DecodeRange(rawdata + start, datasize, first, count, &failtile);
+                    m_state.decodeus += sw.TimeInMicro();
+                    PushJob(TILE_JOB_TILES, first, count); // tiles after the failed one are cleared
+                    if(!PLUGIN_SUCCESS(status)) break;
                 }
+                if(!PLUGIN_SUCCESS(status)) break;
+            }
+            if(!PLUGIN_SUCCESS(status))
+            {
+                wxLogMessage("[TileSolver::Decode] decoder->%s msg: \n    %s", name, decoder->msg);
+                wxLogError("[TileSolver::Decode] decoder->%s %s at tile %zu", name, decode_status_str(status), failtile);
+                m_state.ok = false;
+                ReportError(decoder->msg, wxString::Format("%s error", name));
+                return;
             }
         }
         else
         {
             wxLogError("[TileSolver::Decode] no decode function");
+            m_state.ok = false;
         }
     }
     else
     {
         wxLogWarning("[TileSolver::Decode] datasize is 0");
+        m_state.ok = false;
+    }
+}
+
+int TileSolver::DecodeEnd()
+{
+    if(m_state.result < 0) return -1; // pre failed or cancelled
+    if(!m_file.GetDataLen()) return 0;
+    PLUGIN_STATUS status;
+    auto decoder = m_decoder;
+    auto cfg = m_state.cfg;
+    bool pluginrow = cfg->nrow != m_state.nrow; // nrow changed by the plugin, not by ui
+    if(m_state.out) // the ui may change nrow while decoding, keep it if plugin did not set
+    {
+        uint16_t nrow = m_state.out->nrow;
+        *m_state.out = m_jobcfg;
+        if(!pluginrow) m_state.out->nrow = nrow;
+        cfg = m_state.out;
+        m_tilecfg.nrow = cfg->nrow;
+    }
+
+    if(m_state.cached)
+    {
+        m_shiftok = IsShiftable() && GetDatasize() >= calc_tile_nbytes(&m_tilecfg.fmt);
+        m_shiftkey = MakeCacheKey(m_state.plugincfg, false);
+        m_shiftstart = m_tilecfg.start;
+        if(m_state.hasnav) g_tilenav = m_state.nav; // as post did
+        if(m_state.hasstyle) g_tilestyle = m_state.style;
+        auto time_end = wxDateTime::UNow();
+        if(m_listener) m_listener->OnTilecfg(*cfg);
+        wxLogMessage(wxString::Format(
+            "[TileSolver::Decode] cache hit %zu tiles in %llu ms, hits %zu, misses %zu, %zu entries with %zu MB",
+            m_tiles.GetCount(), (time_end - m_state.time_start).GetMilliseconds(), m_cache.GetHits(), m_cache.GetMisses(),
+            m_cache.GetCount(), m_cache.GetSize() >> 20));
+        return m_state.result;
     }
 
-    // post processing
-tilesolver_decode_post_start:
-    if(decoder->post)
+    // post processing, lua plugins can set tilenav for the ui
+    if(IsLazy())
+    {
+        m_lazypost = HasParse(true); // the tiles are still decoded by the state of pre
+    }
+    else if(HasParse(true))
     {
-        status = decoder->post(decoder->context, rawdata, rawsize, tilecfg);
+        struct tilenav_t nav = g_tilenav;
+        struct tilestyle_t style = g_tilestyle;
+        status = CallParse(true, cfg);
+        m_state.hasnav = !same_tilenav(nav, g_tilenav); // kept with the cache entry
+        m_state.nav = g_tilenav;
+        m_state.hasstyle = !same_tilestyle(style, g_tilestyle);
+        m_state.style = g_tilestyle;
         if(decoder->msg && decoder->msg[0])
         {
             wxLogMessage("[TileSolver::Decode] decoder->post msg: \n    %s", decoder->msg);
@@ -395,94 +940,341 @@ tilesolver_decode_post_start:
         if(!PLUGIN_SUCCESS(status))
         {
             wxLogError("[TileSolver::Decode] decoder->post %s", decode_status_str(status));
-            if(wxGetApp().m_usegui) wxMessageBox(decoder->msg, "decoder->post error", wxICON_ERROR);
+            m_state.ok = false;
+            ReportError(decoder->msg, "decoder->post error");
         }
     }
     auto time_end = wxDateTime::UNow();
-    if(wxGetApp().m_usegui)
+    size_t ntile = m_tiles.GetCount();
+    size_t nbytes = calc_tile_nbytes(&m_tilecfg.fmt);
+    if(m_state.ok && m_state.shiftable && m_datasize >= nbytes)
+    {
+        m_shiftok = true;
+        m_shiftkey = m_state.shiftkey;
+        m_shiftstart = m_tilecfg.start;
+    }
+    if(m_state.ok && !IsLazy() && m_cache.GetBudget())
     {
-        sync_tilenav(&g_tilenav, &g_tilecfg);
-        NOTIFY_UPDATE_TILENAV();
-        NOTIFY_UPDATE_TILECFG();
+        struct tilecfg64_t cachecfg = *cfg;
+        if(!pluginrow) cachecfg.nrow = 0; // nrow from ui, not from plugin
+        m_cache.Put(m_state.cachekey, cachecfg, m_tiles,
+            m_state.hasnav ? &m_state.nav : nullptr, m_state.hasstyle ? &m_state.style : nullptr);
+        wxLogMessage(wxString::Format(
+            "[TileSolver::Decode] cache miss, hits %zu, misses %zu, %zu entries with %zu MB", 
+            m_cache.GetHits(), m_cache.GetMisses(), m_cache.GetCount(), m_cache.GetSize() >> 20));
     }
+    if(m_listener) m_listener->OnTilecfg(*cfg);
     wxLogMessage(wxString::Format(
-        "[TileSolver::Decode] decode %zu tiles with %zu bytes, in %llu ms",
-        ntile, nbytes, (time_end - time_start).GetMilliseconds()));
+        "[TileSolver::Decode] %s %zu tiles with %zu bytes, %zu threads, in %llu ms",
+        IsLazy() ? "prepare" : "decode", ntile, nbytes, IsReentrant() ? m_pool.GetThreads() : 1, 
+        (time_end - m_state.time_start).GetMilliseconds()));
+    if(m_state.ok && m_state.decodename && m_state.decodeus > 0) // to compare decodeone with decodetiles or decodeall
+    {
+        double npixel = (double)ntile * m_tiles.GetTilePixels();
+        wxLogMessage(wxString::Format("[TileSolver::Decode] decoder->%s %.0f pixels in %.1f ms, %.2f Mpixels/s",
+            m_state.decodename, npixel, m_state.decodeus.ToDouble() / 1000.0, npixel / m_state.decodeus.ToDouble()));
+    }
 
-    return ntile;
+    return m_state.result;
 }
 
-bool TileSolver::Render()
+int TileSolver::Decode(struct tilecfg64_t *tilecfg, wxFileName pluginfile)
 {
-    if(!DecodeOk())
+    if(!DecodeBegin(tilecfg, pluginfile, false)) return -1;
+    DecodeTiles();
+    return DecodeEnd();
+}
+
+bool TileSolver::DecodeAsync(struct tilecfg64_t *tilecfg, wxFileName pluginfile)
+{
+    if(!DecodeBegin(tilecfg, pluginfile, true)) return false;
+    if(!m_file.GetDataLen()) return true; // nothing to decode
+    m_jobready.clear();
+    m_cancel = false;
+    m_jobnotified = false;
+    m_busy = true;
+    m_jobthread = std::thread([this]
     {
-        wxLogError("[TileSolver::Render] no tiles to render");
-        return false;
-    }
+        DecodeTiles();
+        m_busy = false; // m_pool is free for the ui thread
+        PushJob(TILE_JOB_DONE, 0, 0);
+    });
+    return true;
+}
 
-    size_t nrow = m_tilecfg.nrow;
-    if(!nrow)
+void TileSolver::PushJob(enum TILE_JOB type, size_t first, size_t count)
+{
+    if(!m_state.async) return;
+    struct tilejob_msg_t msg = {type, first, count};
+    while(!m_jobqueue.Push(msg)) // the ui has not drained yet, the event is already posted
     {
-        m_bitmap = wxBitmap();
-        wxLogError("[TileSolver::Render] nrow can not be 0");
-        return false;
+        if(m_cancel) return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
+    if(!m_jobnotified.exchange(true) && m_listener) m_listener->OnJob();
+}
 
-    size_t tilew = m_tilecfg.w;
-    size_t tileh = m_tilecfg.h;
-    size_t ntile = m_tiles.size();
-    size_t imgw =  nrow * tilew;
-    size_t imgh = (ntile + nrow - 1) / nrow * tileh ;
-
-    auto time_start = wxDateTime::UNow();
-    wxBitmap bitmap(imgw, imgh);
-    if(!bitmap.IsOk())
-    {
-        // try reduce the nrow number
-        nrow = ntile==1 ? 1 : ((int)sqrt(tilew * tileh * ntile) + tilew - 1) / tilew;
-        imgw = nrow * tilew;
-        imgh = (ntile + nrow - 1) / nrow * tileh;
-        bitmap = wxBitmap(imgw, imgh);
-        if(bitmap.IsOk())
+size_t TileSolver::PollJob(std::vector<struct tilejob_msg_t>& msgs)
+{
+    m_jobnotified = false; // reset before draining, so that no message is missed
+    struct tilejob_msg_t msg;
+    while(m_jobqueue.Pop(msg))
+    {
+        switch(msg.type)
         {
-            m_tilecfg.nrow = nrow;
-            g_tilecfg.nrow = nrow;
-            if(wxGetApp().m_usegui)
+        case TILE_JOB_STORE:
+            m_jobready.assign(msg.count, 0);
+            break;
+        case TILE_JOB_TILES:
+            if(msg.first < m_jobready.size())
             {
-                sync_tilenav(&g_tilenav, &g_tilecfg);
-                NOTIFY_UPDATE_TILECFG();
+                memset(&m_jobready[msg.first], 1, wxMin<size_t>(msg.count, m_jobready.size() - msg.first));
             }
+            break;
+        case TILE_JOB_DONE:
+            if(m_jobthread.joinable()) m_jobthread.join();
+            m_jobready.clear();
+            DecodeEnd();
+            break;
         }
-        else
+        msgs.push_back(msg);
+    }
+    return msgs.size();
+}
+
+void TileSolver::Cancel()
+{
+    if(!m_jobthread.joinable()) return;
+    bool busy = m_busy;
+    m_cancel = true;
+    m_jobthread.join();
+    m_cancel = false;
+    m_busy = false;
+    struct tilejob_msg_t msg;
+    while(m_jobqueue.Pop(msg)); // drop the result
+    m_jobready.clear();
+    if(busy) wxLogMessage("[TileSolver::Cancel] cancel the decoding in flight");
+}
+
+void TileSolver::Wait()
+{
+    if(m_jobthread.joinable()) m_jobthread.join();
+}
+
+struct tilesize_t TileSolver::GetImageSize(size_t nrow)
+{
+    struct tilesize_t size = {0, 0};
+    if(!nrow) nrow = m_tilecfg.nrow;
+    std::lock_guard<std::mutex> lock(m_storemutex);
+    if(!m_tiles.IsOk() || !nrow) return size;
+    size_t ntile = m_tiles.GetCount();
+    size.w = nrow * m_tiles.GetTileW();
+    size.h = (ntile + nrow - 1) / nrow * m_tiles.GetTileH();
+    return size;
+}
+
+struct tilesize_t TileSolver::GetTileSize()
+{
+    std::lock_guard<std::mutex> lock(m_storemutex);
+    struct tilesize_t size = {m_tiles.GetTileW(), m_tiles.GetTileH()};
+    return size;
+}
+
+size_t TileSolver::GetTileCount()
+{
+    std::lock_guard<std::mutex> lock(m_storemutex);
+    return m_tiles.GetCount();
+}
+
+bool TileSolver::ComposeRegion(size_t x, size_t y, size_t w, size_t h, size_t nrow,
+    struct pixel_t *out, size_t stride)
+{
+    std::lock_guard<std::mutex> lock(m_storemutex); // the worker can not reset m_tiles while composing
+    if(!m_tiles.IsOk() || !w || !h || !nrow || !out) return false;
+    EnsureRegion(x, y, w, h, nrow); // failed tiles are composed as cleared
+
+    size_t grain = wxMax<size_t>(1, 0x10000 / w);
+    auto func = [&](size_t b, size_t e)
+    {
+        Compose(x, y + b, w, e - b, nrow, out + b * stride, stride);
+    };
+    if(IsBusy()) func(0, h); // m_pool is used by the worker
+    else m_pool.Run(h, grain, func);
+    return true;
+}
+
+void TileSolver::Compose(size_t x, size_t y, size_t w, size_t h, size_t nrow,
+    struct pixel_t *out, size_t stride)
+{
+    size_t tilew = m_tiles.GetTileW();
+    size_t tileh = m_tiles.GetTileH();
+    size_t ntile = m_tiles.GetCount();
+    bool partial = IsBusy() && wxThread::IsMain(); // only the tiles finished by the worker
+    for(size_t k=0; k < h; k++)
+    {
+        size_t imgy = y + k;
+        size_t r = imgy / tileh, ty = imgy % tileh;
+        struct pixel_t *dst = out + k * stride;
+        for(size_t imgx=x; imgx < x + w;)
+        {
+            size_t c = imgx / tilew, tx = imgx % tilew;
+            size_t n = wxMin<size_t>(tilew - tx, x + w - imgx);
+            size_t i = r * nrow + c;
+            bool ready = !partial || (i < m_jobready.size() && m_jobready[i]);
+            if(c < nrow && i < ntile && ready) memcpy(dst, m_tiles.GetRow(i, ty) + tx, n * sizeof(struct pixel_t));
+            else memset(dst, 0, n * sizeof(struct pixel_t));
+            dst += n;
+            imgx += n;
+        }
+    }
+}
+
+bool TileSolver::EnsureTiles(size_t first, size_t count, bool parallel)
+{
+    std::lock_guard<std::mutex> lock(m_decodemutex);
+    if(m_tilestate.empty()) return true;
+
+    // decode the continuous tiles not ready at once
+    bool ok = true, checked = false;
+    size_t end = wxMin<size_t>(first + count, m_tilestate.size());
+    const uint8_t *data = m_file.GetData() + m_lazystart;
+    for(size_t i=first; i < end;)
+    {
+        if(m_tilestate[i] != TILE_STATE_NONE)
         {
-            m_bitmap = wxBitmap();
-            wxString msg = wxString::Format("[TileSolver::Render] bitmap (%dX%d) is not ready, please reduce the tile size or nrow number", imgw, imgh);
-            if(wxGetApp().m_usegui) wxMessageBox(msg, "render error", wxICON_ERROR);
-            wxLogError(msg);
+            i++;
+            continue;
+        }
+        if(!checked && m_file.IsShrunk()) // the rest can not be read, until decoding again
+        {
+            for(auto &state : m_tilestate) if(state == TILE_STATE_NONE) state = TILE_STATE_FAILED;
+            wxLogError("[TileSolver::EnsureTiles] input file is truncated, decode again to reopen it");
             return false;
         }
+        checked = true;
+        size_t j = i;
+        while(j < end && m_tilestate[j] == TILE_STATE_NONE) j++;
+        size_t failtile = 0;
+        auto status = DecodeRange(data, m_lazysize, i, j - i, &failtile, parallel);
+        if(PLUGIN_SUCCESS(status))
+        {
+            memset(&m_tilestate[i], TILE_STATE_READY, j - i);
+            i = j;
+            continue;
+        }
+
+        // the tiles after the failed one are cleared by DecodeRange, and try them again
+        memset(&m_tilestate[i], TILE_STATE_READY, failtile - i);
+        m_tilestate[failtile] = TILE_STATE_FAILED;
+        if(m_decoder->msg && m_decoder->msg[0])
+        {
+            wxLogMessage("[TileSolver::EnsureTiles] decoder msg: \n    %s", m_decoder->msg);
+        }
+        wxLogError("[TileSolver::EnsureTiles] decode %s at tile %zu", decode_status_str(status), failtile);
+        i = failtile + 1;
+        ok = false;
+    }
+    return ok;
+}
+
+bool TileSolver::EnsureRegion(size_t x, size_t y, size_t w, size_t h, size_t nrow)
+{
+    if(!IsLazy() || !w || !h || !nrow) return true;
+    size_t tilew = m_tiles.GetTileW();
+    size_t tileh = m_tiles.GetTileH();
+    size_t col0 = x / tilew, col1 = wxMin<size_t>((x + w - 1) / tilew, nrow - 1);
+    size_t row0 = y / tileh, row1 = (y + h - 1) / tileh;
+    if(col0 > col1) return true;
+    if(col0 == 0 && col1 == nrow - 1) // whole rows are continuous tiles
+    {
+        return EnsureTiles(row0 * nrow, (row1 - row0 + 1) * nrow, !IsBusy());
     }
-    bitmap.UseAlpha();
 
-    wxMemoryDC dstdc(bitmap);
-    // #pragma omp parallel for, this might cause sementation fault after ?
-    for(int i=0; i < m_tiles.size(); i++)
+    bool ok = true;
+    for(size_t r=row0; r <= row1 && r * nrow + col0 < m_tiles.GetCount(); r++)
     {
-        int x = (i % nrow) * tilew;
-        int y = (i / nrow) * tileh;
-        auto tilebitmap = wxBitmap(m_tiles[i]);
-        tilebitmap.UseAlpha();
-        wxMemoryDC srcdc(tilebitmap);
-        dstdc.Blit(wxPoint(x, y), wxSize(tilew, tileh), &srcdc, wxPoint(0, 0));
+        if(!EnsureTiles(r * nrow + col0, col1 - col0 + 1, !IsBusy())) ok = false;
     }
-    auto time_end = wxDateTime::UNow();
+    return ok;
+}
 
-    wxLogMessage(wxString::Format(
-        "[TileSolver::Render] tile (%zux%zu), image (%zux%zu), in %llu ms",
-        tilew, tileh, imgw, imgh, (time_end - time_start).GetMilliseconds()));
-    m_bitmap = bitmap; // seems automaticly release previous
+void TileSolver::Prefetch(size_t first, size_t count)
+{
+    if(!IsLazy() || !count) return;
+    size_t ntile = m_lazytiles; // m_decodemutex is held by the decoding in background
+    {
+        std::lock_guard<std::mutex> lock(m_prefetchmutex);
+        m_prefetchfirst = first;
+        m_prefetchcount = first < ntile ? wxMin<size_t>(count, ntile - first) : 0;
+        m_prefetchstop = false;
+    }
+    if(!m_prefetchthread.joinable())
+    {
+        m_prefetchthread = std::thread(&TileSolver::PrefetchMain, this);
+    }
+    m_prefetchcv.notify_one();
+}
 
-    return true;
+void TileSolver::StopPrefetch()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_prefetchmutex);
+        m_prefetchstop = true;
+        m_prefetchcount = 0;
+    }
+    m_prefetchcv.notify_all();
+    if(m_prefetchthread.joinable()) m_prefetchthread.join();
+}
+
+void TileSolver::PrefetchMain()
+{
+    // decode by small chunks, so that the request can be replaced or stopped soon
+    size_t grain = wxMax<size_t>(1, 0x4000 / m_tiles.GetTilePixels());
+    while(true)
+    {
+        size_t first, count;
+        {
+            std::unique_lock<std::mutex> lock(m_prefetchmutex);
+            m_prefetchcv.wait(lock, [this]{ return m_prefetchstop || m_prefetchcount > 0; });
+            if(m_prefetchstop) return;
+            first = m_prefetchfirst;
+            count = wxMin<size_t>(grain, m_prefetchcount);
+            m_prefetchfirst += count;
+            m_prefetchcount -= count;
+        }
+        EnsureTiles(first, count, false); // m_pool is only for the ui thread
+    }
+}
+
+void TileSolver::EndLazy()
+{
+    StopPrefetch(); // the background decoding uses m_tiles and the decoder
+    {
+        std::lock_guard<std::mutex> lock(m_decodemutex);
+        m_tilestate.clear();
+        m_lazytiles = 0;
+        m_islazy = false;
+    }
+    if(!m_lazypost) return;
+    m_lazypost = false;
+    auto decoder = m_decoder;
+    if(!decoder || !m_file.GetDataLen()) return;
+
+    // the view has moved on, so the tilecfg, nav and style from the late post are dropped
+    struct tilecfg64_t cfg = m_tilecfg;
+    struct tilenav_t nav = g_tilenav;
+    struct tilestyle_t style = g_tilestyle;
+    PLUGIN_STATUS status = CallParse(true, &cfg);
+    g_tilenav = nav;
+    g_tilestyle = style;
+    if(decoder->msg && decoder->msg[0])
+    {
+        wxLogMessage("[TileSolver::EndLazy] decoder->post msg: \n    %s", decoder->msg);
+    }
+    if(!PLUGIN_SUCCESS(status))
+    {
+        wxLogError("[TileSolver::EndLazy] decoder->post %s", decode_status_str(status));
+    }
 }
 
 bool TileSolver::Save(wxFileName outfile)
@@ -491,28 +1283,86 @@ bool TileSolver::Save(wxFileName outfile)
     auto outpath = m_outfile.GetFullPath();
     if(outpath.Length() == 0) return false;
 
-    if(!m_bitmap.IsOk()) return false;
+    Wait(); // save the whole decoding
+    if(!DecodeOk())
+    {
+        wxLogError("[TileSolver::Save] no tiles to save");
+        return false;
+    }
+    size_t nrow = m_tilecfg.nrow;
+    if(!nrow)
+    {
+        wxLogError("[TileSolver::Save] nrow can not be 0");
+        return false;
+    }
 
-    wxImage image(m_bitmap.ConvertToImage());
+    // strips of whole tile rows, lazy tiles are decoded by strip and each once
+    auto imgsize = GetImageSize(nrow);
+    auto tilesize = GetTileSize();
+    bool opaque = m_tiles.IsOpaque();
+    size_t rowbytes = imgsize.w * tilesize.h * sizeof(struct pixel_t);
+    size_t striph = wxMin(wxMax<size_t>(1, IMAGE_STRIP_SIZE / rowbytes) * tilesize.h, imgsize.h);
+    auto time_start = wxDateTime::UNow();
+    TileStore strip;
+    if(!strip.Reset(1, imgsize.w, striph, opaque))
+    {
+        wxString msg = wxString::Format("[TileSolver::Save] strip (%zux%zu) is not ready, please reduce the tile size or nrow number", imgsize.w, striph);
+        ReportError(msg, "save error");
+        wxLogError(msg);
+        return false;
+    }
+    ImageWriter writer;
+    writer.m_profile = m_saveprofile;
+    writer.m_pool = &m_pool;
+    auto format = m_saveformat != IMAGE_FORMAT_NONE ? m_saveformat : ImageWriter::GetFormat(outpath);
+    if(format == IMAGE_FORMAT_IDX && IsLazy()) EnsureTiles(0, m_tiles.GetCount()); // the palette is before the pixels
+    if(format == IMAGE_FORMAT_IDX || (format == IMAGE_FORMAT_PNG && m_savepalette && !IsLazy() && m_tilecfg.bpp <= 8))
+    {
+        struct pixel_t blank = {0, 0, 0, 0}; // the rest of the last row
+        bool indexed = ImageWriter::MakePalette(m_tiles.GetData(), m_tiles.GetCount() * m_tiles.GetTilePixels(), opaque, writer.m_palette);
+        if(indexed && m_tiles.GetCount() % nrow) indexed = ImageWriter::MakePalette(&blank, 1, opaque, writer.m_palette);
+        if(!indexed) writer.m_palette.clear();
+    }
+    if(!writer.Open(outpath, imgsize.w, imgsize.h, opaque, format)) return false;
+    for(size_t y=0; y < imgsize.h && writer.IsOk(); y += striph)
+    {
+        size_t h = wxMin(striph, imgsize.h - y);
+        ComposeRegion(0, y, imgsize.w, h, nrow, strip.GetData(), imgsize.w);
+        writer.WriteRows(strip.GetData(), h, imgsize.w);
+    }
+    if(!writer.Close()) return false;
+    auto time_end = wxDateTime::UNow();
 
-    return image.SaveFile(m_outfile.GetFullPath());
+    wxLogMessage(wxString::Format(
+        "[TileSolver::Save] tile (%zux%zu), image (%zux%zu), strip %zu rows, %s %s, %zu colors, in %llu ms",
+        tilesize.w, tilesize.h, imgsize.w, imgsize.h, striph, g_image_format_names[format], g_image_profile_names[m_saveprofile],
+        writer.m_palette.size(), (time_end - time_start).GetMilliseconds()));
+    return true;
 }
 
 bool TileSolver::Close()
 {
+    Cancel();
+    EndLazy(); // post reads m_file
     m_infile.Clear(); // inpath
-    m_filebuf.Clear(); // inbuf
-    m_tiles.clear(); // decode
-    m_bitmap = wxBitmap(); // render
+    m_shiftok = false;
+    m_file.Close(); // inbuf
+    ClearTiles(); // decode
     return true;
 }
 
+void TileSolver::ReportError(const wxString& msg, const wxString& title)
+{
+    if(m_listener) m_listener->OnError(msg, title);
+}
+
 bool TileSolver::DecodeOk()
 {
-    return m_tiles.size() > 0;
+    std::lock_guard<std::mutex> lock(m_storemutex);
+    return m_tiles.IsOk();
 }
 
-bool TileSolver::RenderOk()
+bool TileSolver::IsLazy()
 {
-    return m_bitmap.IsOk();
+    return m_islazy;
 }
\ No newline at end of file
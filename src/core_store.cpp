@@ -0,0 +1,96 @@
+/**
+ * implement the decoded tile store
+ *   developed by devseed
+ *
+ *  tiles are packed one after another without padding, so the pixels from
+ *  decodeall can be copied in once, and the row y of tile i is at
+ *  data + (i * h + y) * w
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "core.hpp"
+
+static struct pixel_t* align_pixels(void *raw)
+{
+    return (struct pixel_t*)(((uintptr_t)raw + TILE_STORE_ALIGN - 1)
+        & ~(uintptr_t)(TILE_STORE_ALIGN - 1));
+}
+
+TileStore::TileStore()
+{
+    m_raw = nullptr;
+    m_data = nullptr;
+    m_ntile = m_w = m_h = 0;
+    m_opaque = false;
+}
+
+TileStore::~TileStore()
+{
+    Clear();
+}
+
+bool TileStore::Reset(size_t ntile, size_t w, size_t h, bool opaque)
+{
+    size_t npixel = ntile * w * h;
+    if(!npixel || npixel / ntile / w != h) // overflow
+    {
+        Clear();
+        return false;
+    }
+
+    if(m_data && npixel == m_ntile * m_w * m_h) // reuse the buffer if same size
+    {
+        memset(m_data, 0, npixel * sizeof(struct pixel_t));
+    }
+    else
+    {
+        Clear();
+        m_raw = calloc(npixel * sizeof(struct pixel_t) + TILE_STORE_ALIGN, 1);
+        if(!m_raw) return false;
+        m_data = align_pixels(m_raw);
+    }
+    m_ntile = ntile;
+    m_w = w;
+    m_h = h;
+    m_opaque = opaque;
+    return true;
+}
+
+bool TileStore::Shift(int64_t delta, size_t ntile)
+{
+    size_t npixel = GetTilePixels();
+    size_t tilesize = npixel * sizeof(struct pixel_t);
+    if(!IsOk() || !ntile || ntile * npixel / npixel != ntile) return false;
+
+    // the kept tiles are [begin, end) in the new index
+    int64_t begin = std::max<int64_t>(0, -delta);
+    int64_t end = std::min<int64_t>(ntile, (int64_t)m_ntile - delta);
+    if(begin >= end) begin = end = 0;
+    if(ntile == m_ntile)
+    {
+        if(begin < end) memmove(GetTile(begin), GetTile(begin + delta), (end - begin) * tilesize);
+        memset(GetTile(0), 0, begin * tilesize);
+        memset(GetTile(end), 0, (ntile - end) * tilesize);
+        return true;
+    }
+
+    void *raw = calloc(ntile * tilesize + TILE_STORE_ALIGN, 1);
+    if(!raw) return false;
+    struct pixel_t *data = align_pixels(raw);
+    if(begin < end) memcpy(data + begin * npixel, GetTile(begin + delta), (end - begin) * tilesize);
+    free(m_raw);
+    m_raw = raw;
+    m_data = data;
+    m_ntile = ntile;
+    return true;
+}
+
+void TileStore::Clear()
+{
+    if(m_raw) free(m_raw);
+    m_raw = nullptr;
+    m_data = nullptr;
+    m_ntile = m_w = m_h = 0;
+}
@@ -19,6 +19,7 @@
 
 #ifndef _PLUGIN_H
 #define _PLUGIN_H
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -63,6 +64,13 @@ struct tilepos_t
     int x, y; // x, y coordinate in tile
 };
 
+// 64-bit variant of tilepos_t, for tiles beyond INT_MAX
+struct tilepos64_t
+{
+    int64_t i; // idx th tile
+    int x, y; // x, y coordinate in tile
+};
+
 struct tilefmt_t
 {
     uint32_t w, h;  // tile width, tile height
@@ -87,6 +95,24 @@ struct tilecfg_t
     };
 };
 
+// 64-bit variant of tilecfg_t, for the data beyond 4GB
+struct tilecfg64_t
+{
+    uint64_t start; // tile start offset
+    uint64_t size;   // whole tile size
+    uint16_t nrow;   // how many tiles in a row
+    union
+    {
+        struct
+        {
+            uint32_t w, h;  // tile width, tile height
+            uint8_t bpp;    // tile bpp
+            uint32_t nbytes;  // bytes number in a tile
+        };
+       struct tilefmt_t fmt;
+    };
+};
+
 enum UI_TILE_STYLE
 {
     TILE_STYLE_DEFAULT = 0,
@@ -97,8 +123,8 @@ enum UI_TILE_STYLE
 // tile navagation
 struct tilenav_t
 {
-    int index; // current select position
-    int offset; // tile offset in file (include start)
+    int64_t index; // current select position
+    int64_t offset; // tile offset in file (include start)
     int x, y; // tile start position
     bool scrollto; // scroll to the target position
 };
@@ -132,6 +158,29 @@ typedef enum _PLUGIN_STATUS
 
 #define PLUGIN_SUCCESS(x) (x==STATUS_OK)
 
+/**
+ * convert between tilecfg_t and tilecfg64_t, for the plugins only use 32-bit
+ * @return false if the 64-bit value can not fit in 32-bit
+ */
+inline bool tilecfg_to32(const struct tilecfg64_t *cfg64, struct tilecfg_t *cfg)
+{
+    if(!cfg64 || !cfg) return false;
+    cfg->start = (uint32_t)cfg64->start;
+    cfg->size = (uint32_t)cfg64->size;
+    cfg->nrow = cfg64->nrow;
+    cfg->fmt = cfg64->fmt;
+    return cfg64->start <= UINT32_MAX && cfg64->size <= UINT32_MAX;
+}
+
+inline void tilecfg_from32(const struct tilecfg_t *cfg, struct tilecfg64_t *cfg64)
+{
+    if(!cfg64 || !cfg) return;
+    cfg64->start = cfg->start;
+    cfg64->size = cfg->size;
+    cfg64->nrow = cfg->nrow;
+    cfg64->fmt = cfg->fmt;
+}
+
 inline const char *decode_status_str(PLUGIN_STATUS x)
 {
     if(x==STATUS_OK) return "STATUS_OK";
@@ -165,11 +214,34 @@ typedef PLUGIN_STATUS (*STDCALL CB_decode_pixel)(void *context,
     const struct tilepos_t *pos, const struct tilefmt_t *fmt,
     struct pixel_t *pixel, bool remain_index);
 
+/**
+ *  decode 1 pixel, 64-bit tile index version
+ */
+typedef PLUGIN_STATUS (*STDCALL CB_decode_pixel64)(void *context,
+    const uint8_t* data, size_t datasize,
+    const struct tilepos64_t *pos, const struct tilefmt_t *fmt,
+    struct pixel_t *pixel, bool remain_index);
+
+/**
+ *  decode continuous tiles into the buffer owned by host
+ * @param data, corrent decoding data
+ * @param first the first tile index to decode
+ * @param count how many tiles to decode
+ * @param out rgba pixels, the row y of the k-th tile is at out + (k * fmt->h + y) * stride
+ * @param stride pixels between two rows in out, at least fmt->w
+ * @param remain_index keep the origin index
+ */
+typedef PLUGIN_STATUS (*STDCALL CB_decode_tiles)(void *context,
+    const uint8_t* data, size_t datasize,
+    uint64_t first, size_t count, const struct tilefmt_t *fmt,
+    struct pixel_t *out, size_t stride, bool remain_index);
+
 /**
  *  decode all pixels
  * @param data, corrent decoding data
- * @param pixels out all pixel buffer, this should be alloced by the plugin
- * @param npixel how many pixels for all tiles
+ * @param pixels in the host buffer of all tiles in order (NULL for older host) to fill in place,
+ *   out the filled buffer, the host buffer or one alloced by the plugin and valid until post
+ * @param npixel in the pixels of host buffer, out how many pixels for all tiles
  * @param remain_index keep the origin index
  */
 typedef PLUGIN_STATUS (*STDCALL CB_decode_pixels)(void *context,
@@ -184,6 +256,12 @@ typedef PLUGIN_STATUS (*STDCALL CB_decode_pixels)(void *context,
 typedef PLUGIN_STATUS (*STDCALL CB_decode_parse)(void *context,
     const uint8_t* rawdata, size_t rawsize, struct tilecfg_t *cfg);
 
+/**
+ * decode pre, post processing, 64-bit tilecfg version
+ */
+typedef PLUGIN_STATUS (*STDCALL CB_decode_parse64)(void *context,
+    const uint8_t* rawdata, size_t rawsize, struct tilecfg64_t *cfg);
+
 /**
  * send to the main ui
  */
@@ -196,11 +274,17 @@ typedef PLUGIN_STATUS (*STDCALL CB_decode_recv)(void *context, const char *buf,
 
 /**
  * interface for C plugin
+ *   the new fields are appended at the end, check them by the size
+ *   if the 64-bit callback is not set, the 32-bit one will be used
  */
 
 #define TILE_DECODER_VERSION(major, minor, patch, build) \
     (uint32_t)((major<<24) + (minor<<16) + (patch<<8) + build)
 
+// capability flags of the decoder
+#define TILE_DECODER_FLAG_REENTRANT 0x1 // decodeone or decodetiles can be called from multi threads with the same context
+#define TILE_DECODER_FLAG_TILE_LOCAL 0x2 // a tile only depends on its own bytes, so the tiles are kept when start moves by whole tiles
+
 struct tile_decoder_t
 {
     uint32_t version; // required tileviewer version
@@ -215,8 +299,19 @@ struct tile_decoder_t
     OPTIONAL CB_decode_parse post; // after decoding whole tiles(usually clean some tmp values here)
     OPTIONAL CB_decode_send sendui; // for setting ui widget (it will search xxx.json at first, if not found, use this)
     OPTIONAL CB_decode_recv recvui; // for getting ui widget
+    // extensions, check with TILE_DECODER_HAS before use
+    OPTIONAL CB_decode_pixel64 decodeone64; // 64-bit version of decodeone, prior to decodeone
+    OPTIONAL CB_decode_parse64 pre64; // 64-bit version of pre, prior to pre
+    OPTIONAL CB_decode_parse64 post64; // 64-bit version of post, prior to post
+    OPTIONAL uint32_t flags; // TILE_DECODER_FLAG_XXX
+    OPTIONAL CB_decode_tiles decodetiles; // decode a range of tiles, prior to decodeall and decodeone
 };
 
+// check if the decoder struct (might be compiled by older header) has the field
+#define TILE_DECODER_HAS(decoder, field) \
+    ((decoder)->size >= offsetof(struct tile_decoder_t, field) + sizeof((decoder)->field) \
+        && (decoder)->field)
+
 /**
  * if not export decoder struct, use get_decoder function instead
  */
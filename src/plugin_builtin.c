@@ -4,9 +4,11 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <cJSON.h>
 #include "plugin.h"
+#include "plugin_builtin_simd.h"
 
 static char s_msg[4096] = {0};
 static const char* s_ui =
@@ -19,20 +21,31 @@ static const char* s_ui =
     {\"name\" : \"flipy\",\"type\" : \"bool\", \"help\" : \"vertical flip tile\", \"value\": 0} \
 ]}";
 
-static struct
+// the context of each opened instance, so that instances can decode with different config
+struct plugincfg_default_t
 {
     bool endian_big;
     bool channel_argb;
     bool channel_abgr;
     bool flipx;
     bool flipy;
-}s_plugincfg = {.endian_big=false, .channel_argb=false,
+};
+
+static const struct plugincfg_default_t s_plugincfg = {.endian_big=false, .channel_argb=false,
     .channel_abgr=false, .flipx=false, .flipy=false};
 
+// the context is NULL if calling without open
+#define PLUGINCFG_DEFAULT(context) \
+    ((context) ? (const struct plugincfg_default_t*)(context) : &s_plugincfg)
+
 PLUGIN_STATUS STDCALL decode_open_default(const char *name, void **context)
 {
     s_msg[0] = '\0';
-    sprintf(s_msg, "[plugin_builtin::open]");
+    struct plugincfg_default_t *cfg = malloc(sizeof(struct plugincfg_default_t));
+    if(!cfg) return STATUS_FAIL;
+    *cfg = s_plugincfg;
+    *context = cfg;
+    sprintf(s_msg, "[plugin_builtin::open] %s kernel", unpack_kernel_get()->name);
     if(s_msg[strlen(s_msg) - 1] =='\n') s_msg[strlen(s_msg) - 1] = '\0';
     return STATUS_OK;
 }
@@ -40,6 +53,7 @@ PLUGIN_STATUS STDCALL decode_open_default(const char *name, void **context)
 PLUGIN_STATUS STDCALL decode_close_default(void *context)
 {
     s_msg[0] = '\0';
+    free(context);
     sprintf(s_msg, "[plugin_builtin::close]");
     if(s_msg[strlen(s_msg) - 1] =='\n') s_msg[strlen(s_msg) - 1] = '\0';
     return STATUS_OK;
@@ -61,6 +75,8 @@ PLUGIN_STATUS STDCALL decode_recvui_default(void *context, const char *buf, size
 {
     s_msg[0] = '\0';
     sprintf(s_msg, "[plugin_builtin::recvui] recv %zu bytes", bufsize);
+    struct plugincfg_default_t *cfg = (struct plugincfg_default_t*)context;
+    if(!cfg) return STATUS_FAIL;
 
     cJSON *root = cJSON_Parse(buf);
     if(!root) goto decode_recvui_default_fail;
@@ -73,26 +89,26 @@ PLUGIN_STATUS STDCALL decode_recvui_default(void *context, const char *buf, size
         const cJSON *value = cJSON_GetObjectItem(prop, "value");
         if(!name) continue;
         if(!value) continue;
-        sprintf(s_msg, "%s, %s=%d", s_msg, name->valuestring, s_plugincfg.endian_big);
+        sprintf(s_msg, "%s, %s=%d", s_msg, name->valuestring, cfg->endian_big);
         if(!strcmp(name->valuestring, "endian"))
         {
-            s_plugincfg.endian_big = value->valueint > 0;
+            cfg->endian_big = value->valueint > 0;
         }
         else if (!strcmp(name->valuestring, "argb"))
         {
-            s_plugincfg.channel_argb = value->valueint > 0;
+            cfg->channel_argb = value->valueint > 0;
         }
         else if (!strcmp(name->valuestring, "bgr"))
         {
-            s_plugincfg.channel_abgr = value->valueint > 0;
+            cfg->channel_abgr = value->valueint > 0;
         }
         else if (!strcmp(name->valuestring, "flipx"))
         {
-            s_plugincfg.flipx = value->valueint > 0;
+            cfg->flipx = value->valueint > 0;
         }
         else if (!strcmp(name->valuestring, "flipy"))
         {
-            s_plugincfg.flipy = value->valueint > 0;
+            cfg->flipy = value->valueint > 0;
         }
     }
 
@@ -106,10 +122,11 @@ decode_recvui_default_fail:
 }
 
 bool decode_offset_default(void *context,
-    const struct tilepos_t *pos, const struct tilefmt_t *fmt, size_t *offset)
+    const struct tilepos64_t *pos, const struct tilefmt_t *fmt, size_t *offset)
 {
     // no safety check for pointer here
-    int i = pos->i, x = pos->x, y = pos->y;
+    size_t i = (size_t)pos->i;
+    int x = pos->x, y = pos->y;
     size_t w = fmt->w, h = fmt->h;
     size_t nbytes = calc_tile_nbytes(fmt);
     uint8_t bpp = fmt->bpp;
@@ -123,63 +140,48 @@ bool decode_offset_default(void *context,
 
 PLUGIN_STATUS STDCALL decode_pixel_default(void *context,
     const uint8_t* data, size_t datasize,
-    const struct tilepos_t *pos, const struct tilefmt_t *fmt,
+    const struct tilepos64_t *pos, const struct tilefmt_t *fmt,
     struct pixel_t *pixel, bool remain_index)
 {
-    if(s_plugincfg.flipx)
-    {
-        int x = pos->x;
-        x = fmt->w -1 - x;
-        ((struct tilepos_t *)pos)->x = x;
-    }
-    if(s_plugincfg.flipy)
-    {
-        int y = pos->y;
-        y = fmt->h -1 - y;
-        ((struct tilepos_t *)pos)->y = y;
-    }
+    // flip on a local copy, so it is reentrant for multi threads
+    const struct plugincfg_default_t *cfg = PLUGINCFG_DEFAULT(context);
+    struct tilepos64_t flippos = *pos;
+    if(cfg->flipx) flippos.x = fmt->w - 1 - pos->x;
+    if(cfg->flipy) flippos.y = fmt->h - 1 - pos->y;
+    pos = &flippos;
 
     // find decode offset
     uint8_t bpp = fmt->bpp;
     size_t offset = 0;
     if(!decode_offset_default(context, pos, fmt, &offset)) return STATUS_RANGERROR;
-    if(offset + bpp/8 >= datasize) return STATUS_RANGERROR;
+    if(offset + (bpp + 7) / 8 > datasize) return STATUS_RANGERROR;
 
     // try decode in different bpp
     if(bpp > 8)
     {
+        bool bgr = cfg->channel_abgr;
         if(bpp==32) // rgba8888
         {
-            memcpy(pixel, data + offset, 4);
+            if(remain_index) memcpy(pixel, data + offset, 4);
+            else unpack_rgba8888_one(data + offset, pixel, bgr, cfg->channel_argb);
         }
         else if(bpp==24) // rgb888
         {
-            memcpy(pixel, data + offset, 3);
-            if(!remain_index) pixel->a = 255;
+            if(remain_index) memcpy(pixel, data + offset, 3);
+            else unpack_rgb888_one(data + offset, pixel, bgr);
         }
         else if(bpp==16) // rgb565, index16
         {
             if(remain_index)
             {
-                pixel->d = data[offset] | data[offset+1] << 8;
+                if(cfg->endian_big) pixel->d = data[offset] << 8 | data[offset+1];
+                else pixel->d = data[offset] | data[offset+1] << 8;
             }
             else
             {
-                pixel->r = (data[offset] & 0b11111000) > 0x3;
-                pixel->g = (data[offset] & 0b00000111) | ((data[offset+1] & 0b11100000) >> 5) << 3;
-                pixel->b = data[offset+1] & 0b00011111;
-                pixel->a = 255;
+                unpack_rgb565_one(data + offset, pixel, cfg->endian_big, bgr);
             }
         }
-        if(s_plugincfg.channel_abgr)
-        {
-            uint8_t tmp;
-            tmp = pixel->r; pixel->r = pixel->b; pixel->b = tmp;
-        }
-        if(s_plugincfg.channel_argb)
-        {
-            pixel->d = ((pixel->d)<<8) + pixel->a;
-        }
     }
     else
     {
@@ -192,15 +194,16 @@ PLUGIN_STATUS STDCALL decode_pixel_default(void *context,
         {
             size_t nbytes = calc_tile_nbytes(fmt);
             int pixel_idx = pos->x + pos->y * fmt->w;
-            offset =  pos->i * nbytes + pixel_idx / 8 * 3; // offset is incresed by 3
+            offset =  (size_t)pos->i * nbytes + pixel_idx / 8 * 3; // offset is incresed by 3
+            if(offset + 3 > datasize) return STATUS_RANGERROR;
             uint8_t bitshift = (pixel_idx % 8) * bpp;
-            if(s_plugincfg.endian_big)
+            if(cfg->endian_big)
             {
                 bitshift = 21 - bitshift; // bit big endian, 00011122 23334445 55666777
             }
             uint32_t mask = ((1<<bpp) - 1) << bitshift;
-            uint32_t d3 = *(uint32_t*)(data + offset) & 0x00ffffff;
-            if(s_plugincfg.endian_big)
+            uint32_t d3 = data[offset] | data[offset+1] << 8 | data[offset+2] << 16;
+            if(cfg->endian_big)
             {
                 d3 = ((d3 & 0xFF) << 16) | ((d3 & 0xFF00)) | ((d3 & 0xFF0000) >> 16); // reverse byte sequence
             }
@@ -210,7 +213,7 @@ PLUGIN_STATUS STDCALL decode_pixel_default(void *context,
         {
             int pixel_idx = pos->x + pos->y * fmt->w;
             uint8_t bitshift = (pixel_idx % (8 / bpp)) * bpp;
-            if(s_plugincfg.endian_big)
+            if(cfg->endian_big)
             {
                 bitshift = 8 - bpp  - bitshift;
             }
@@ -233,12 +236,94 @@ PLUGIN_STATUS STDCALL decode_pixel_default(void *context,
     return STATUS_OK;
 }
 
+// decode a row of tile by the kernels, false for not supported format
+static bool decode_row_default(const struct plugincfg_default_t *cfg, const uint8_t* data, size_t datasize,
+    size_t i, int y, const struct tilefmt_t *fmt, struct pixel_t *row)
+{
+    const struct unpack_kernel_t *kernel = unpack_kernel_get();
+    size_t w = fmt->w;
+    uint8_t bpp = fmt->bpp;
+    size_t rowbits = w * bpp;
+    if(bpp != 1 && bpp != 2 && bpp != 4 && bpp % 8) return false; // index3 crosses the bytes
+    if(y * rowbits % 8) return false; // row not start at byte
+    size_t offset = i * calc_tile_nbytes(fmt) + y * rowbits / 8;
+    if(offset + (rowbits + 7) / 8 > datasize) return false; // let decodeone report range error
+    const uint8_t *src = data + offset;
+    bool bgr = cfg->channel_abgr;
+    switch(bpp)
+    {
+    case 8:
+        kernel->index8(src, row, w, 1);
+        break;
+    case 16:
+        kernel->rgb565(src, row, w, cfg->endian_big, bgr);
+        break;
+    case 24:
+        kernel->rgb888(src, row, w, bgr);
+        break;
+    case 32:
+        kernel->rgba8888(src, row, w, bgr, cfg->channel_argb);
+        break;
+    default: // index4, index2, index1
+    {
+        uint8_t idx[256];
+        uint8_t scale = 255 / ((1 << bpp) - 1);
+        for(size_t x=0; x < w; x += sizeof(idx))
+        {
+            size_t n = w - x < sizeof(idx) ? w - x : sizeof(idx);
+            kernel->index_split(src + x * bpp / 8, idx, n, bpp, cfg->endian_big);
+            kernel->index8(idx, row + x, n, scale);
+        }
+        break;
+    }
+    }
+    if(cfg->flipx)
+    {
+        for(size_t x=0; x < w / 2; x++)
+        {
+            struct pixel_t tmp = row[x];
+            row[x] = row[w - 1 - x];
+            row[w - 1 - x] = tmp;
+        }
+    }
+    return true;
+}
+
+PLUGIN_STATUS STDCALL decode_tiles_default(void *context,
+    const uint8_t* data, size_t datasize,
+    uint64_t first, size_t count, const struct tilefmt_t *fmt,
+    struct pixel_t *out, size_t stride, bool remain_index)
+{
+    const struct plugincfg_default_t *cfg = PLUGINCFG_DEFAULT(context);
+    for(size_t k=0; k < count; k++)
+    {
+        for(int y=0; y < fmt->h; y++)
+        {
+            struct pixel_t *row = out + (k * fmt->h + y) * stride;
+            int srcy = cfg->flipy ? fmt->h - 1 - y : y;
+            if(!remain_index && decode_row_default(cfg, data, datasize, first + k, srcy, fmt, row)) continue;
+            for(int x=0; x < fmt->w; x++) // fallback to decode pixel by pixel
+            {
+                struct tilepos64_t pos = {(int64_t)(first + k), x, y};
+                PLUGIN_STATUS status = decode_pixel_default(context,
+                    data, datasize, &pos, fmt, &row[x], remain_index);
+                if(!PLUGIN_SUCCESS(status)) return status;
+            }
+        }
+    }
+    return STATUS_OK;
+}
+
 struct tile_decoder_t g_decoder_default = {
-    .version = TILE_DECODER_VERSION(0, 3, 6, 0),
+    .version = TILE_DECODER_VERSION(0, 3, 7, 0),
     .size = sizeof(struct tile_decoder_t),
     .msg = s_msg, .context = NULL,
     .open = decode_open_default, .close = decode_close_default,
-    .decodeone = decode_pixel_default, .decodeall = NULL,
+    .decodeone = NULL, .decodeall = NULL,
     .pre = NULL, .post=NULL,
     .sendui=decode_sendui_default, .recvui=decode_recvui_default,
+    .decodeone64 = decode_pixel_default,
+    .pre64 = NULL, .post64 = NULL,
+    .flags = TILE_DECODER_FLAG_REENTRANT | TILE_DECODER_FLAG_TILE_LOCAL,
+    .decodetiles = decode_tiles_default,
 };
\ No newline at end of file
@@ -0,0 +1,340 @@
+/**
+ * implement the row kernels for builtin decoder
+ *   developed by devseed
+ *
+ *  the simd kernels assume little endian x86, the tail of row uses scalar
+ */
+
+#include <string.h>
+#include "plugin_builtin_simd.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define UNPACK_X86
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// scalar kernel
+
+static void index8_scalar(const uint8_t *src, struct pixel_t *dst, size_t n, uint8_t scale)
+{
+    for(size_t i=0; i < n; i++)
+    {
+        uint8_t d = src[i] * scale;
+        dst[i].r = dst[i].g = dst[i].b = d;
+        dst[i].a = 255;
+    }
+}
+
+static void index_split_scalar(const uint8_t *src, uint8_t *dst, size_t n, int bpp, bool bigendian)
+{
+    int perbyte = 8 / bpp;
+    uint8_t mask = (1 << bpp) - 1;
+    for(size_t i=0; i < n; i++)
+    {
+        int shift = (i % perbyte) * bpp;
+        if(bigendian) shift = 8 - bpp - shift;
+        dst[i] = (src[i / perbyte] >> shift) & mask;
+    }
+}
+
+static void rgb565_scalar(const uint8_t *src, struct pixel_t *dst, size_t n, bool bigendian, bool bgr)
+{
+    for(size_t i=0; i < n; i++) unpack_rgb565_one(src + i * 2, dst + i, bigendian, bgr);
+}
+
+static void rgb888_scalar(const uint8_t *src, struct pixel_t *dst, size_t n, bool bgr)
+{
+    for(size_t i=0; i < n; i++) unpack_rgb888_one(src + i * 3, dst + i, bgr);
+}
+
+static void rgba8888_scalar(const uint8_t *src, struct pixel_t *dst, size_t n, bool bgr, bool argb)
+{
+    if(!bgr && !argb)
+    {
+        memcpy(dst, src, n * 4);
+        return;
+    }
+    for(size_t i=0; i < n; i++) unpack_rgba8888_one(src + i * 4, dst + i, bgr, argb);
+}
+
+static const struct unpack_kernel_t s_kernel_scalar = {
+    .name = "scalar",
+    .index8 = index8_scalar, .index_split = index_split_scalar,
+    .rgb565 = rgb565_scalar, .rgb888 = rgb888_scalar, .rgba8888 = rgba8888_scalar
+};
+
+#ifdef UNPACK_X86
+
+// sse2 kernel
+
+TARGET_SSE2 static inline __m128i swap_rb_sse2(__m128i x)
+{
+    __m128i ga = _mm_and_si128(x, _mm_set1_epi32((int)0xff00ff00));
+    __m128i r = _mm_and_si128(x, _mm_set1_epi32(0xff));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(x, 16), _mm_set1_epi32(0xff));
+    return _mm_or_si128(ga, _mm_or_si128(_mm_slli_epi32(r, 16), b));
+}
+
+TARGET_SSE2 static void index8_sse2(const uint8_t *src, struct pixel_t *dst, size_t n, uint8_t scale)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ff = _mm_set1_epi8((char)0xff);
+    const __m128i s16 = _mm_set1_epi16(scale);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        if(scale != 1)
+        {
+            __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(x, zero), s16);
+            __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(x, zero), s16);
+            x = _mm_packus_epi16(lo, hi);
+        }
+        __m128i xx = _mm_unpacklo_epi8(x, x), xa = _mm_unpacklo_epi8(x, ff); // (d, d), (d, 255)
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(xx, xa));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(xx, xa));
+        xx = _mm_unpackhi_epi8(x, x), xa = _mm_unpackhi_epi8(x, ff);
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpacklo_epi16(xx, xa));
+        _mm_storeu_si128((__m128i*)(dst + i + 12), _mm_unpackhi_epi16(xx, xa));
+    }
+    index8_scalar(src + i, dst + i, n - i, scale);
+}
+
+TARGET_SSE2 static void index_split_sse2(const uint8_t *src, uint8_t *dst, size_t n, int bpp, bool bigendian)
+{
+    // split 16 bytes into 32 of half bits each time, until one pixel in a byte
+    int perbyte = 8 / bpp;
+    size_t i = 0;
+    for(; i + 16 * perbyte <= n; i += 16 * perbyte)
+    {
+        __m128i v[8];
+        int count = 1;
+        v[0] = _mm_loadu_si128((const __m128i*)(src + i / perbyte));
+        for(int bits=4; bits >= bpp; bits /= 2)
+        {
+            __m128i mask = _mm_set1_epi8((char)((1 << bits) - 1));
+            for(int k=count-1; k >= 0; k--)
+            {
+                __m128i lo = _mm_and_si128(v[k], mask);
+                __m128i hi = _mm_and_si128(_mm_srli_epi16(v[k], bits), mask);
+                __m128i first = bigendian ? hi : lo, second = bigendian ? lo : hi;
+                v[2*k] = _mm_unpacklo_epi8(first, second);
+                v[2*k + 1] = _mm_unpackhi_epi8(first, second);
+            }
+            count *= 2;
+        }
+        for(int k=0; k < count; k++) _mm_storeu_si128((__m128i*)(dst + i + k * 16), v[k]);
+    }
+    index_split_scalar(src + i / perbyte, dst + i, n - i, bpp, bigendian);
+}
+
+TARGET_SSE2 static void rgb565_sse2(const uint8_t *src, struct pixel_t *dst, size_t n, bool bigendian, bool bgr)
+{
+    const __m128i m5 = _mm_set1_epi16(0x1f), m6 = _mm_set1_epi16(0x3f);
+    const __m128i alpha = _mm_set1_epi16((short)0xff00);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 2));
+        if(bigendian) v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        __m128i r = _mm_srli_epi16(v, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), m6);
+        __m128i b = _mm_and_si128(v, m5);
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+        if(bgr) { __m128i t = r; r = b; b = t; }
+        __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        __m128i ba = _mm_or_si128(b, alpha);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(rg, ba));
+    }
+    rgb565_scalar(src + i * 2, dst + i, n - i, bigendian, bgr);
+}
+
+TARGET_SSE2 static void rgb888_sse2(const uint8_t *src, struct pixel_t *dst, size_t n, bool bgr)
+{
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+    size_t i = 0;
+    for(; i + 6 <= n; i += 4) // load 16 bytes for 4 pixels
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i * 3));
+        __m128i ab = _mm_unpacklo_epi32(x, _mm_srli_si128(x, 3));
+        __m128i cd = _mm_unpacklo_epi32(_mm_srli_si128(x, 6), _mm_srli_si128(x, 9));
+        __m128i p = _mm_or_si128(_mm_unpacklo_epi64(ab, cd), alpha);
+        if(bgr) p = swap_rb_sse2(p);
+        _mm_storeu_si128((__m128i*)(dst + i), p);
+    }
+    rgb888_scalar(src + i * 3, dst + i, n - i, bgr);
+}
+
+TARGET_SSE2 static void rgba8888_sse2(const uint8_t *src, struct pixel_t *dst, size_t n, bool bgr, bool argb)
+{
+    size_t i = 0;
+    if(!bgr && !argb)
+    {
+        memcpy(dst, src, n * 4);
+        return;
+    }
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        if(argb) p = _mm_or_si128(_mm_srli_epi32(p, 8), _mm_slli_epi32(p, 24));
+        if(bgr) p = swap_rb_sse2(p);
+        _mm_storeu_si128((__m128i*)(dst + i), p);
+    }
+    rgba8888_scalar(src + i * 4, dst + i, n - i, bgr, argb);
+}
+
+static const struct unpack_kernel_t s_kernel_sse2 = {
+    .name = "sse2",
+    .index8 = index8_sse2, .index_split = index_split_sse2,
+    .rgb565 = rgb565_sse2, .rgb888 = rgb888_sse2, .rgba8888 = rgba8888_sse2
+};
+
+// avx2 kernel, the unpack works in 128-bit lanes, so permute the lanes at last
+
+TARGET_AVX2 static void index8_avx2(const uint8_t *src, struct pixel_t *dst, size_t n, uint8_t scale)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ff = _mm256_set1_epi8((char)0xff);
+    const __m256i s16 = _mm256_set1_epi16(scale);
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        if(scale != 1)
+        {
+            __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(x, zero), s16);
+            __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(x, zero), s16);
+            x = _mm256_packus_epi16(lo, hi);
+        }
+        __m256i xx = _mm256_unpacklo_epi8(x, x), xa = _mm256_unpacklo_epi8(x, ff);
+        __m256i p0 = _mm256_unpacklo_epi16(xx, xa); // 0-3, 16-19
+        __m256i p1 = _mm256_unpackhi_epi16(xx, xa); // 4-7, 20-23
+        xx = _mm256_unpackhi_epi8(x, x), xa = _mm256_unpackhi_epi8(x, ff);
+        __m256i p2 = _mm256_unpacklo_epi16(xx, xa); // 8-11, 24-27
+        __m256i p3 = _mm256_unpackhi_epi16(xx, xa); // 12-15, 28-31
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + i + 8), _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + i + 16), _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256((__m256i*)(dst + i + 24), _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+    index8_sse2(src + i, dst + i, n - i, scale);
+}
+
+TARGET_AVX2 static void rgb565_avx2(const uint8_t *src, struct pixel_t *dst, size_t n, bool bigendian, bool bgr)
+{
+    const __m256i m5 = _mm256_set1_epi16(0x1f), m6 = _mm256_set1_epi16(0x3f);
+    const __m256i alpha = _mm256_set1_epi16((short)0xff00);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i * 2));
+        if(bigendian) v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+        __m256i r = _mm256_srli_epi16(v, 11);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi16(v, 5), m6);
+        __m256i b = _mm256_and_si256(v, m5);
+        r = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+        g = _mm256_or_si256(_mm256_slli_epi16(g, 2), _mm256_srli_epi16(g, 4));
+        b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+        if(bgr) { __m256i t = r; r = b; b = t; }
+        __m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+        __m256i ba = _mm256_or_si256(b, alpha);
+        __m256i lo = _mm256_unpacklo_epi16(rg, ba); // 0-3, 8-11
+        __m256i hi = _mm256_unpackhi_epi16(rg, ba); // 4-7, 12-15
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    rgb565_sse2(src + i * 2, dst + i, n - i, bigendian, bgr);
+}
+
+TARGET_AVX2 static void rgb888_avx2(const uint8_t *src, struct pixel_t *dst, size_t n, bool bgr)
+{
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+    const __m256i perm = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6); // 12 bytes in each lane
+    const __m256i shuf = bgr ?
+        _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+            2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1) :
+        _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    size_t i = 0;
+    for(; i + 11 <= n; i += 8) // load 32 bytes for 8 pixels
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i * 3));
+        x = _mm256_permutevar8x32_epi32(x, perm);
+        x = _mm256_or_si256(_mm256_shuffle_epi8(x, shuf), alpha);
+        _mm256_storeu_si256((__m256i*)(dst + i), x);
+    }
+    rgb888_sse2(src + i * 3, dst + i, n - i, bgr);
+}
+
+TARGET_AVX2 static void rgba8888_avx2(const uint8_t *src, struct pixel_t *dst, size_t n, bool bgr, bool argb)
+{
+    if(!bgr && !argb)
+    {
+        memcpy(dst, src, n * 4);
+        return;
+    }
+    uint8_t m[4]; // source byte for r, g, b, a
+    int c = argb ? 1 : 0;
+    m[0] = bgr ? c + 2 : c;
+    m[1] = c + 1;
+    m[2] = bgr ? c : c + 2;
+    m[3] = argb ? 0 : 3;
+    char shufb[32];
+    for(int k=0; k < 32; k++) shufb[k] = (char)((k & ~3 & 15) + m[k & 3]);
+    const __m256i shuf = _mm256_loadu_si256((const __m256i*)shufb);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(x, shuf));
+    }
+    rgba8888_sse2(src + i * 4, dst + i, n - i, bgr, argb);
+}
+
+static const struct unpack_kernel_t s_kernel_avx2 = {
+    .name = "avx2",
+    .index8 = index8_avx2, .index_split = index_split_sse2,
+    .rgb565 = rgb565_avx2, .rgb888 = rgb888_avx2, .rgba8888 = rgba8888_avx2
+};
+
+#endif
+
+static const struct unpack_kernel_t *s_kernel = NULL;
+
+const struct unpack_kernel_t* unpack_kernel_find(const char *name)
+{
+    if(!name) return NULL;
+    if(!strcmp(name, "scalar")) return &s_kernel_scalar;
+#ifdef UNPACK_X86
+    __builtin_cpu_init();
+    if(!strcmp(name, "sse2") && __builtin_cpu_supports("sse2")) return &s_kernel_sse2;
+    if(!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) return &s_kernel_avx2;
+#endif
+    return NULL;
+}
+
+bool unpack_kernel_select(const char *name)
+{
+    const struct unpack_kernel_t *kernel = NULL;
+    if(name) kernel = unpack_kernel_find(name);
+    else
+    {
+        kernel = unpack_kernel_find("avx2");
+        if(!kernel) kernel = unpack_kernel_find("sse2");
+        if(!kernel) kernel = unpack_kernel_find("scalar");
+    }
+    if(!kernel) return false;
+    s_kernel = kernel;
+    return true;
+}
+
+const struct unpack_kernel_t* unpack_kernel_get()
+{
+    if(!s_kernel) unpack_kernel_select(NULL);
+    return s_kernel;
+}
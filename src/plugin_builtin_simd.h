@@ -0,0 +1,67 @@
+/**
+ * row kernels to unpack pixels for the builtin decoder
+ *   developed by devseed
+ *
+ *  the kernels are selected at runtime, avx2 -> sse2 -> scalar
+ */
+
+#ifndef _PLUGIN_BUILTIN_SIMD_H
+#define _PLUGIN_BUILTIN_SIMD_H
+#include "plugin.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct unpack_kernel_t
+{
+    const char *name;
+    // 8-bit index to gray (index * scale), a = 255
+    void (*index8)(const uint8_t *src, struct pixel_t *dst, size_t n, uint8_t scale);
+    // 1, 2, 4-bit index to 8-bit index, src starts at a byte
+    void (*index_split)(const uint8_t *src, uint8_t *dst, size_t n, int bpp, bool bigendian);
+    void (*rgb565)(const uint8_t *src, struct pixel_t *dst, size_t n, bool bigendian, bool bgr);
+    void (*rgb888)(const uint8_t *src, struct pixel_t *dst, size_t n, bool bgr);
+    void (*rgba8888)(const uint8_t *src, struct pixel_t *dst, size_t n, bool bgr, bool argb);
+};
+
+const struct unpack_kernel_t* unpack_kernel_get(); // current kernel, auto select at first
+const struct unpack_kernel_t* unpack_kernel_find(const char *name); // NULL if cpu not supported
+bool unpack_kernel_select(const char *name); // scalar, sse2, avx2, NULL for auto
+
+// scalar version for one pixel, also used by decodeone
+
+static inline void unpack_rgb565_one(const uint8_t *src, struct pixel_t *pixel, bool bigendian, bool bgr)
+{
+    uint16_t v = bigendian ? (src[0] << 8 | src[1]) : (src[0] | src[1] << 8);
+    uint8_t r = v >> 11, g = (v >> 5) & 0x3f, b = v & 0x1f;
+    r = r << 3 | r >> 2;
+    g = g << 2 | g >> 4;
+    b = b << 3 | b >> 2;
+    pixel->r = bgr ? b : r;
+    pixel->g = g;
+    pixel->b = bgr ? r : b;
+    pixel->a = 255;
+}
+
+static inline void unpack_rgb888_one(const uint8_t *src, struct pixel_t *pixel, bool bgr)
+{
+    pixel->r = bgr ? src[2] : src[0];
+    pixel->g = src[1];
+    pixel->b = bgr ? src[0] : src[2];
+    pixel->a = 255;
+}
+
+static inline void unpack_rgba8888_one(const uint8_t *src, struct pixel_t *pixel, bool bgr, bool argb)
+{
+    const uint8_t *c = argb ? src + 1 : src; // argb -> rgba
+    pixel->r = bgr ? c[2] : c[0];
+    pixel->g = c[1];
+    pixel->b = bgr ? c[0] : c[2];
+    pixel->a = argb ? src[0] : src[3];
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
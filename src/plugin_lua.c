@@ -5,17 +5,37 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
+#ifdef _WIN32
+#include <windows.h>
+#define lane_yield() SwitchToThread()
+#else
+#include <sched.h>
+#define lane_yield() sched_yield()
+#endif
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
 #include <cJSON.h>
 #include "plugin.h"
-
-static char s_msg[4096] = {'\0'};
-extern struct tilecfg_t g_tilecfg;
+#include "plugin_luacompat.h"
+
+#define LUA_MSG_SIZE 4096
+#define LUA_ROWS_PIXELS 0x4000 // pixels for each decode_rows call
+#define LUA_LANE_MAX 64 // lua states for the parallel plugin, created when the decoding threads need them
+#define LUA_CHUNK_MAGIC "TVLC"
+#define LUA_RAWVIEW "tileviewer.rawview" // metatable of rawview
+
+// the reader of rawview, size in bytes with the flags
+#define RAWVIEW_SIGNED 0x10
+#define RAWVIEW_BIGENDIAN 0x20
+extern struct tilecfg64_t g_tilecfg;
 extern struct tilenav_t g_tilenav;
 extern struct tilestyle_t g_tilestyle;
-extern int luaopen_ui(lua_State *L);
+lua_CFunction g_luaopen_ui = NULL; // extra module from the front end, such as gui dialogs
+const char *g_lua_backend = LUA_BACKEND;
+const char *g_lua_chunkfile = NULL; // cache file of the compiled script for the next open, NULL to compile every time
+uint64_t g_lua_chunkkey = 0; // script path, size and mtime from the host, the cache is valid if the same
 
 struct tile_decoder_t g_decoder_lua;
 
@@ -25,7 +45,23 @@ struct memblock_t
     size_t n;
 };
 
-static struct decode_context_t
+// read-only view of rawdata without copy, the same layout as memblock for memreadi and memreads,
+// it is empty if the rawdata of context is changed
+struct rawview_t
+{
+    struct memblock_t block;
+    const uint8_t *base; // rawdata when the view is made
+};
+
+struct chunk_header_t // the cache file of the compiled script, followed by the chunk from lua_dump
+{
+    char magic[4];
+    uint32_t size;
+    uint64_t key;
+    char backend[32];
+};
+
+struct decode_context_t
 {
     lua_State *L;
     union
@@ -37,24 +73,98 @@ static struct decode_context_t
         };
         struct memblock_t rawblock;
     };
-} s_decode_context = {NULL};
+    struct tilecfg64_t *cfg; // from pre and post, the decoding can be on a worker with its own tilecfg
+    struct tilenav_t nav; // for the context without ui, such as cli, batch workers and lanes
+    struct tilestyle_t style;
+    struct memblock_t *pixels; // host pixel buffer as full userdata for decode_pixels, valid until post
+    int pixelsref; // keep the pixels userdata in registry
+    int pinref; // the string returned by decode_pixels, kept until post
+    struct memblock_t *out; // host rows as full userdata for decode_tile and decode_rows, valid in the call
+    int outref;
+    struct memblock_t scratch; // for the host rows not continuous
+    int pixelfunc, tilefunc, rowsfunc; // callbacks in registry, LUA_NOREF if not defined
+    struct decode_context_t *next; // in the free list after close
+
+    // the plugin with parallel = true decodes on lanes, each lane is a context with its own lua state,
+    // loaded from the same script and running decode_pre on the same rawdata, lanes[0] is the context itself,
+    // which is never acquired by the decoding threads, so that its msg is only written under lock
+    bool parallel;
+    char *script; // kept for the lanes created later, if the chunk is not dumped
+    struct memblock_t chunk; // compiled script from the cache file or lua_dump, the lanes load it without parsing
+    char *uicfg; // the last recvui, passed to the lanes before decode_pre
+    struct decode_context_t *lanes[LUA_LANE_MAX];
+    atomic_int nlane;
+    atomic_flag busy; // the lane is used by a decoding thread
+    atomic_flag lock; // for creating lanes and writing msg of the main context
+    unsigned generation; // increased by each pre, the lane runs decode_pre again if older
+    struct tilecfg64_t precfg; // tilecfg before decode_pre of the main context, for the lanes
+    struct decode_context_t *main; // the context owns the lane, the lane is never in the free list
+    char msg[LUA_MSG_SIZE];
+    char log[LUA_MSG_SIZE]; // log of the lane, appended to msg of the main context by post_lanes
+};
 
+// each open has its own context, so that several solvers can decode in parallel,
+// the closed contexts are reused rather than freed to keep decoder->msg valid
+static struct decode_context_t *s_freecontext = NULL;
 
+// capi functions are registered as closures with the context as upvalue
+#define CAPI_CONTEXT(L) ((struct decode_context_t*)lua_touserdata(L, lua_upvalueindex(1)))
+
+static struct tilecfg64_t* context_tilecfg(lua_State *L)
+{
+    struct decode_context_t *context = CAPI_CONTEXT(L);
+    return context->cfg ? context->cfg : &g_tilecfg;
+}
+
+// only the main context in gui works with the ui, the others may run on several threads at once
+static bool context_hasui(struct decode_context_t *context)
+{
+    return g_luaopen_ui && !context->main;
+}
+
+static struct tilenav_t* context_tilenav(lua_State *L)
+{
+    struct decode_context_t *context = CAPI_CONTEXT(L);
+    return context_hasui(context) ? &g_tilenav : &context->nav;
+}
+
+static struct tilestyle_t* context_tilestyle(lua_State *L)
+{
+    struct decode_context_t *context = CAPI_CONTEXT(L);
+    return context_hasui(context) ? &g_tilestyle : &context->style;
+}
+
+static bool rawview_valid(struct decode_context_t *context, const struct rawview_t *view)
+{
+    return view->base == context->rawdata
+        && (const uint8_t*)view->block.p + view->block.n <= context->rawdata + context->rawsize;
+}
+
+// memblock of lightuserdata, userdata or rawview at idx, NULL if it is not writable for write or out of date
+static struct memblock_t *check_memblock(lua_State *L, int idx, bool write)
+{
+    if(!lua_isuserdata(L, idx)) return NULL;
+    struct rawview_t *view = (struct rawview_t *)luaL_testudata(L, idx, LUA_RAWVIEW);
+    if(!view) return (struct memblock_t *)lua_touserdata(L, idx);
+    if(write || !rawview_valid(CAPI_CONTEXT(L), view)) return NULL;
+    return &view->block;
+}
+
+
+// the host logs msg after each call, so nothing goes to stdout, which can be the decoded image
 static int capi_log(lua_State* L)
 {
+    struct decode_context_t *context = CAPI_CONTEXT(L);
+    char *msg = context->main ? context->log : context->msg; // the lanes are on the decoding threads
     int nargs = lua_gettop(L);
     for (int i=1; i <= nargs; i++)
     {
         const char *text = luaL_tolstring(L, i, NULL); // get the string on stack
-        strncat(s_msg, text, sizeof(s_msg) - strlen(s_msg) - 1);
-        strcat(s_msg, " ");
-        fputs(text, stdout);
-        fputc(' ', stdout);
+        strncat(msg, text, LUA_MSG_SIZE - strlen(msg) - 1);
+        if(strlen(msg) + 2 < LUA_MSG_SIZE) strcat(msg, " ");
         lua_pop(L, 1); // remove the string in stack
     }
-    strcat(s_msg, "\n");
-    fputc('\n', stdout);
-    fflush(stdout);
+    if(strlen(msg) + 2 < LUA_MSG_SIZE) strcat(msg, "\n");
     return 0;
 }
 
@@ -70,10 +180,10 @@ static int capi_memnew(lua_State *L)
     return 1;
 }
 
-// function memdel(p)
+// function memdel(p), the pixels from host can not be deleted
 static int capi_memdel(lua_State *L)
 {
-    if(lua_gettop(L) < 1 && !lua_islightuserdata(L, 1)) return 0;
+    if(lua_gettop(L) < 1 || !lua_islightuserdata(L, 1)) return 0;
     struct memblock_t *block = lua_touserdata(L, 1);
     free(block);
     lua_pushboolean(L, true);
@@ -83,8 +193,8 @@ static int capi_memdel(lua_State *L)
 // function memsize(p)
 static int capi_memsize(lua_State *L)
 {
-    if(lua_gettop(L) < 1 && !lua_islightuserdata(L, 1)) return 0;
-    struct memblock_t *block = (struct memblock_t *)lua_touserdata(L, 1);
+    struct memblock_t *block = check_memblock(L, 1, false);
+    if(!block) return 0;
     lua_pushinteger(L, block->n);
     return 1;
 }
@@ -92,9 +202,9 @@ static int capi_memsize(lua_State *L)
 // function memreadi(p, size, offset)
 static int capi_memreadi(lua_State *L)
 {
-    if(lua_gettop(L) < 2 && !lua_islightuserdata(L, 1)) return 0;
+    struct memblock_t *block = check_memblock(L, 1, false);
+    if(!block) return 0;
     int nargs = lua_gettop(L);
-    struct memblock_t *block = (struct memblock_t *)lua_touserdata(L, 1);
 
     size_t offset = 0;
     if(nargs > 2) offset = lua_tointeger(L, 3);
@@ -116,9 +226,9 @@ capi_memreadi_fail:
 // memreads(p, size, offset)
 static int capi_memreads(lua_State *L)
 {
-    if(lua_gettop(L) < 1 && !lua_islightuserdata(L, 1)) return 0;
+    struct memblock_t *block = check_memblock(L, 1, false);
+    if(!block) return 0;
     int nargs = lua_gettop(L);
-    struct memblock_t *block = (struct memblock_t *)lua_touserdata(L, 1);
 
     size_t offset = 0;
     if(nargs > 2) offset = lua_tointeger(L, 3);
@@ -135,12 +245,13 @@ capi_memreads_fail:
     return 1;
 }
 
-// memwrite(p, data, size, offset1, offset2)
+// memwrite(p, data, size, offset1, offset2), rawview can only be data
 static int capi_memwrite(lua_State *L)
 {
-    if(lua_gettop(L) < 2 && !lua_islightuserdata(L, 1)) return 0;
+    if(lua_gettop(L) < 2) return 0;
+    struct memblock_t *block = check_memblock(L, 1, true);
+    if(!block) return 0;
     int nargs = lua_gettop(L);
-    struct memblock_t *block = (struct memblock_t *)lua_touserdata(L, 1);
 
     size_t offset1 = 0;
     if(nargs > 3) offset1 = lua_tointeger(L, 4);
@@ -167,7 +278,8 @@ static int capi_memwrite(lua_State *L)
     }
     else if(lua_isuserdata(L, 2))
     {
-        struct memblock_t *block2 = (struct memblock_t *)lua_touserdata(L, 2);
+        struct memblock_t *block2 = check_memblock(L, 2, false);
+        if(!block2) goto capi_memwrite_fail;
         size_t offset2 = 0;
         if(nargs > 4) offset2 = lua_tointeger(L, 5);
         if(offset2 >= block2->n) goto capi_memwrite_fail;
@@ -185,22 +297,33 @@ capi_memwrite_fail:
     return 1;
 }
 
+// function memptr(p), the lightuserdata of the memory in block, for ffi.cast in luajit
+static int capi_memptr(lua_State *L)
+{
+    struct memblock_t *block = check_memblock(L, 1, false);
+    if(!block) return 0;
+    if(!block->p || !block->n) lua_pushnil(L);
+    else lua_pushlightuserdata(L, block->p);
+    return 1;
+}
+
 static int capi_get_tilecfg(lua_State* L)
 {
+    struct tilecfg64_t *cfg = context_tilecfg(L);
     lua_newtable(L);
-    lua_pushinteger(L, g_tilecfg.start);
+    lua_pushinteger(L, cfg->start);
     lua_setfield(L, -2, "start");
-    lua_pushinteger(L, g_tilecfg.size);
+    lua_pushinteger(L, cfg->size);
     lua_setfield(L, -2, "size");
-    lua_pushinteger(L, g_tilecfg.w);
+    lua_pushinteger(L, cfg->w);
     lua_setfield(L, -2, "w");
-    lua_pushinteger(L, g_tilecfg.h);
+    lua_pushinteger(L, cfg->h);
     lua_setfield(L, -2, "h");
-    lua_pushinteger(L, g_tilecfg.bpp);
+    lua_pushinteger(L, cfg->bpp);
     lua_setfield(L, -2, "bpp");
-    lua_pushinteger(L, g_tilecfg.nbytes);
+    lua_pushinteger(L, cfg->nbytes);
     lua_setfield(L, -2, "nbytes");
-    lua_pushinteger(L, g_tilecfg.nrow);
+    lua_pushinteger(L, cfg->nrow);
     lua_setfield(L, -2, "nrow");
     return 1;
 }
@@ -208,11 +331,12 @@ static int capi_get_tilecfg(lua_State* L)
 static int capi_set_tilecfg(lua_State* L)
 {
     if(lua_gettop(L) < 1 && !lua_istable(L, 1)) return 0;
+    struct tilecfg64_t *cfg = context_tilecfg(L);
 
     lua_getfield(L, 1, "start");
     if(lua_isinteger(L, -1))
     {
-        g_tilecfg.start = lua_tointeger(L, -1);
+        cfg->start = lua_tointeger(L, -1);
 
     }
     lua_pop(L, 1);
@@ -220,42 +344,42 @@ static int capi_set_tilecfg(lua_State* L)
     lua_getfield(L, 1, "size");
     if(lua_isinteger(L, -1))
     {
-        g_tilecfg.size = lua_tointeger(L, -1);
+        cfg->size = lua_tointeger(L, -1);
     }
     lua_pop(L, 1);
 
     lua_getfield(L, 1, "w");
     if(lua_isinteger(L, -1))
     {
-        g_tilecfg.w = lua_tointeger(L, -1);
+        cfg->w = lua_tointeger(L, -1);
     }
     lua_pop(L, 1);
 
     lua_getfield(L, 1, "h");
     if(lua_isinteger(L, -1))
     {
-        g_tilecfg.h = lua_tointeger(L, -1);
+        cfg->h = lua_tointeger(L, -1);
     }
     lua_pop(L, 1);
 
     lua_getfield(L, 1, "bpp");
     if(lua_isinteger(L, -1))
     {
-        g_tilecfg.bpp = lua_tointeger(L, -1);
+        cfg->bpp = lua_tointeger(L, -1);
     }
     lua_pop(L, 1);
 
     lua_getfield(L, 1, "nbytes");
     if(lua_isinteger(L, -1))
     {
-        g_tilecfg.nbytes = lua_tointeger(L, -1);
+        cfg->nbytes = lua_tointeger(L, -1);
     }
     lua_pop(L, 1);
 
     lua_getfield(L, 1, "nrow");
     if(lua_isinteger(L, -1))
     {
-        g_tilecfg.nrow = lua_tointeger(L, -1);
+        cfg->nrow = lua_tointeger(L, -1);
     }
     lua_pop(L, 1);
 
@@ -264,16 +388,17 @@ static int capi_set_tilecfg(lua_State* L)
 
 static int capi_get_tilenav(lua_State* L)
 {
+    struct tilenav_t *nav = context_tilenav(L);
     lua_newtable(L);
-    lua_pushinteger(L, g_tilenav.index);
+    lua_pushinteger(L, nav->index);
     lua_setfield(L, -2, "index");
-    lua_pushinteger(L, g_tilenav.offset);
+    lua_pushinteger(L, nav->offset);
     lua_setfield(L, -2, "offset");
-    lua_pushinteger(L, g_tilenav.x);
+    lua_pushinteger(L, nav->x);
     lua_setfield(L, -2, "x");
-    lua_pushinteger(L, g_tilenav.y);
+    lua_pushinteger(L, nav->y);
     lua_setfield(L, -2, "y");
-    lua_pushboolean(L, g_tilenav.scrollto);
+    lua_pushboolean(L, nav->scrollto);
     lua_setfield(L, -2, "scrollto");
     return 1;
 }
@@ -281,11 +406,12 @@ static int capi_get_tilenav(lua_State* L)
 static int capi_set_tilenav(lua_State* L)
 {
     if(lua_gettop(L) < 1 && !lua_istable(L, 1)) return 0;
+    struct tilenav_t *nav = context_tilenav(L);
 
     lua_getfield(L, 1, "index");
     if(lua_isinteger(L, -1))
     {
-        g_tilenav.index = lua_tointeger(L, -1);
+        nav->index = lua_tointeger(L, -1);
 
     }
     lua_pop(L, 1);
@@ -293,28 +419,28 @@ static int capi_set_tilenav(lua_State* L)
     lua_getfield(L, 1, "offset");
     if(lua_isinteger(L, -1))
     {
-        g_tilenav.offset = lua_tointeger(L, -1);
+        nav->offset = lua_tointeger(L, -1);
     }
     lua_pop(L, 1);
 
     lua_getfield(L, 1, "x");
     if(lua_isinteger(L, -1))
     {
-        g_tilenav.x = lua_tointeger(L, -1);
+        nav->x = lua_tointeger(L, -1);
     }
     lua_pop(L, 1);
 
     lua_getfield(L, 1, "y");
     if(lua_isinteger(L, -1))
     {
-        g_tilenav.y = lua_tointeger(L, -1);
+        nav->y = lua_tointeger(L, -1);
     }
     lua_pop(L, 1);
 
     lua_getfield(L, 1, "scrollto");
     if(lua_isboolean(L, -1))
     {
-        g_tilenav.scrollto = lua_toboolean(L, -1);
+        nav->scrollto = lua_toboolean(L, -1);
     }
     lua_pop(L, 1);
 
@@ -323,12 +449,13 @@ static int capi_set_tilenav(lua_State* L)
 
 static int capi_get_tilestyle(lua_State* L)
 {
+    struct tilestyle_t *style = context_tilestyle(L);
     lua_newtable(L);
-    lua_pushinteger(L, g_tilestyle.style);
+    lua_pushinteger(L, style->style);
     lua_setfield(L, -2, "style");
-    lua_pushnumber(L, g_tilestyle.scale);
+    lua_pushnumber(L, style->scale);
     lua_setfield(L, -2, "offset");
-    lua_pushboolean(L, g_tilestyle.reset_scale);
+    lua_pushboolean(L, style->reset_scale);
     lua_setfield(L, -2, "reset_scale");
     return 1;
 }
@@ -336,11 +463,12 @@ static int capi_get_tilestyle(lua_State* L)
 static int capi_set_tilestyle(lua_State* L)
 {
     if(lua_gettop(L) < 1 && !lua_istable(L, 1)) return 0;
+    struct tilestyle_t *style = context_tilestyle(L);
 
     lua_getfield(L, 1, "style");
     if(lua_isinteger(L, -1))
     {
-        g_tilestyle.style = lua_tointeger(L, -1);
+        style->style = lua_tointeger(L, -1);
 
     }
     lua_pop(L, 1);
@@ -348,14 +476,14 @@ static int capi_set_tilestyle(lua_State* L)
     lua_getfield(L, 1, "scale");
     if(lua_isnumber(L, -1))
     {
-        g_tilestyle.scale = lua_tonumber(L, -1);
+        style->scale = lua_tonumber(L, -1);
     }
     lua_pop(L, 1);
 
     lua_getfield(L, 1, "reset_scale");
     if(lua_isboolean(L, -1))
     {
-        g_tilestyle.reset_scale = lua_toboolean(L, -1);
+        style->reset_scale = lua_toboolean(L, -1);
     }
     lua_pop(L, 1);
 
@@ -365,13 +493,14 @@ static int capi_set_tilestyle(lua_State* L)
 // function get_rawsize()
 static int capi_get_rawsize(lua_State *L)
 {
-    lua_pushinteger(L, s_decode_context.rawsize);
+    lua_pushinteger(L, CAPI_CONTEXT(L)->rawsize);
     return 1;
 }
 
 // function get_rawdata(offset, size)
 static int capi_get_rawdata(lua_State *L)
 {
+    struct decode_context_t *context = CAPI_CONTEXT(L);
     int nargs = lua_gettop(L);
     size_t offset =0, size = 0;
     if(nargs > 1)
@@ -383,84 +512,528 @@ static int capi_get_rawdata(lua_State *L)
         offset = lua_tointeger(L, 1);
     }
 
-    if(offset > s_decode_context.rawsize)
+    if(offset > context->rawsize)
     {
         lua_pushnil(L);
     }
     else
     {
-        if(offset + size > s_decode_context.rawsize) size = s_decode_context.rawsize - offset;
-        if(!size) size = s_decode_context.rawsize;
-        lua_pushlstring(L, (const char *)s_decode_context.rawdata + offset, size);
+        if(offset + size > context->rawsize) size = context->rawsize - offset;
+        if(!size) size = context->rawsize;
+        lua_pushlstring(L, (const char *)context->rawdata + offset, size);
     }
     return 1;
 }
 
 static int capi_get_rawdatap(lua_State *L)
 {
-    lua_pushlightuserdata(L, (void*)&s_decode_context.rawblock);
+    lua_pushlightuserdata(L, (void*)&CAPI_CONTEXT(L)->rawblock);
+    return 1;
+}
+
+static void push_rawview(lua_State *L, const uint8_t *p, size_t n, const uint8_t *base)
+{
+    struct rawview_t *view = (struct rawview_t*)lua_newuserdata(L, sizeof(struct rawview_t));
+    view->block.p = (void*)p;
+    view->block.n = n;
+    view->base = base;
+    luaL_setmetatable(L, LUA_RAWVIEW);
+}
+
+// function get_rawview(offset, size), the rawdata without copy, to the end if no size
+static int capi_get_rawview(lua_State *L)
+{
+    struct decode_context_t *context = CAPI_CONTEXT(L);
+    lua_Integer offset = luaL_optinteger(L, 1, 0);
+    lua_Integer size = luaL_optinteger(L, 2, 0);
+    if(offset < 0 || (size_t)offset > context->rawsize || size < 0)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    size_t remain = context->rawsize - offset;
+    push_rawview(L, context->rawdata + offset, !size || (size_t)size > remain ? remain : (size_t)size, context->rawdata);
+    return 1;
+}
+
+// function view:u8(offset), u16, u32, i32, u16be, u32be, i32be, offset from 0, nil if out of range
+static int capi_rawview_read(lua_State *L)
+{
+    struct rawview_t *view = (struct rawview_t*)luaL_checkudata(L, 1, LUA_RAWVIEW);
+    int kind = (int)lua_tointeger(L, lua_upvalueindex(2));
+    size_t size = kind & 0xf;
+    lua_Integer offset = luaL_optinteger(L, 2, 0);
+    if(!rawview_valid(CAPI_CONTEXT(L), view) || offset < 0 || (size_t)offset + size > view->block.n)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    const uint8_t *p = (const uint8_t*)view->block.p + offset;
+    uint32_t v = 0;
+    for(size_t i=0; i < size; i++)
+    {
+        v |= (uint32_t)p[i] << (kind & RAWVIEW_BIGENDIAN ? (size - 1 - i) * 8 : i * 8);
+    }
+    if(kind & RAWVIEW_SIGNED) lua_pushinteger(L, (int32_t)v);
+    else lua_pushinteger(L, v);
+    return 1;
+}
+
+// the range [offset, offset + size) of view, to the end if no size, false if out of range
+static bool rawview_range(lua_State *L, struct rawview_t *view, size_t *offset, size_t *size)
+{
+    lua_Integer _offset = luaL_optinteger(L, 2, 0);
+    lua_Integer _size = luaL_optinteger(L, 3, 0);
+    if(!rawview_valid(CAPI_CONTEXT(L), view) || _offset < 0 || (size_t)_offset > view->block.n || _size < 0)
+    {
+        return false;
+    }
+    size_t remain = view->block.n - _offset;
+    *offset = _offset;
+    *size = !_size || (size_t)_size > remain ? remain : (size_t)_size;
+    return true;
+}
+
+// function view:sub(offset, size), the view of the range without copy, nil if out of range
+static int capi_rawview_sub(lua_State *L)
+{
+    struct rawview_t *view = (struct rawview_t*)luaL_checkudata(L, 1, LUA_RAWVIEW);
+    size_t offset, size;
+    if(!rawview_range(L, view, &offset, &size)) lua_pushnil(L);
+    else push_rawview(L, (const uint8_t*)view->block.p + offset, size, view->base);
     return 1;
 }
 
-static void register_extra(lua_State *L)
+// function view:str(offset, size), copy the range to string, for string.unpack and string.byte
+static int capi_rawview_str(lua_State *L)
 {
+    struct rawview_t *view = (struct rawview_t*)luaL_checkudata(L, 1, LUA_RAWVIEW);
+    size_t offset, size;
+    if(!rawview_range(L, view, &offset, &size)) lua_pushnil(L);
+    else lua_pushlstring(L, (const char*)view->block.p + offset, size);
+    return 1;
+}
+
+// function view:len() or #view, 0 if the view is out of date
+static int capi_rawview_len(lua_State *L)
+{
+    struct rawview_t *view = (struct rawview_t*)luaL_checkudata(L, 1, LUA_RAWVIEW);
+    lua_pushinteger(L, rawview_valid(CAPI_CONTEXT(L), view) ? view->block.n : 0);
+    return 1;
+}
+
+// function get_pixels(), the host pixel buffer from decode_pixels to decode_post, nil otherwise
+static int capi_get_pixels(lua_State *L)
+{
+    struct decode_context_t *context = CAPI_CONTEXT(L);
+    if(!context->pixels || !context->pixels->p) lua_pushnil(L);
+    else lua_rawgeti(L, LUA_REGISTRYINDEX, context->pixelsref);
+    return 1;
+}
+
+// ui module without gui, the dialogs are skipped
+static int capi_ui_none(lua_State *L)
+{
+    lua_pushnil(L);
+    return 1;
+}
+
+static int luaopen_ui_none(lua_State *L)
+{
+    static const luaL_Reg uilib[] =
+    {
+        {"msgbox", capi_ui_none},
+        {"progress_new", capi_ui_none},
+        {"progress_update", capi_ui_none},
+        {"progress_del", capi_ui_none},
+        {NULL, NULL}
+    };
+    luaL_newlib(L, uilib);
+    return 1;
+}
+
+// the lanes are on the decoding threads, the dialogs of the front end are only for the main context
+static void register_extra(lua_State *L, struct decode_context_t *context)
+{
+    lua_CFunction luaopen_ui = context_hasui(context) ? g_luaopen_ui : luaopen_ui_none;
     luaL_requiref(L, "ui", luaopen_ui, 0); // lua extra function module
     lua_pop(L, 1); // requiref will level on the top
 }
 
-static void register_basic(lua_State *L)
+static void register_capi(lua_State *L, const char *name, lua_CFunction f, struct decode_context_t *context)
 {
-    lua_register(L, "log", capi_log);
-    lua_register(L, "memnew", capi_memnew);
-    lua_register(L, "memdel", capi_memdel);
-    lua_register(L, "memsize", capi_memsize);
-    lua_register(L, "memreadi", capi_memreadi);
-    lua_register(L, "memreads", capi_memreads);
-    lua_register(L, "memwrite", capi_memwrite);
-    lua_register(L, "get_tilecfg", capi_get_tilecfg);
-    lua_register(L, "set_tilecfg", capi_set_tilecfg);
-    lua_register(L, "get_tilenav", capi_get_tilenav);
-    lua_register(L, "set_tilenav", capi_set_tilenav);
-    lua_register(L, "get_tilestyle", capi_get_tilestyle);
-    lua_register(L, "set_tilestyle", capi_set_tilestyle);
-    lua_register(L, "get_rawsize", capi_get_rawsize);
-    lua_register(L, "get_rawdata", capi_get_rawdata);
-    lua_register(L, "get_rawdatap", capi_get_rawdatap);
+    lua_pushlightuserdata(L, (void*)context);
+    lua_pushcclosure(L, f, 1);
+    lua_setglobal(L, name);
 }
 
-PLUGIN_STATUS STDCALL decode_open_lua(const char *luastr, void **context)
+// metatable of rawview, the methods are closures with the context as upvalue like capi
+static void register_rawview(lua_State *L, struct decode_context_t *context)
 {
-    s_msg[0] = '\0';
-    PLUGIN_STATUS status = STATUS_OK;
+    static const struct {const char *name; int kind;} readers[] =
+    {
+        {"u8", 1}, {"u16", 2}, {"u32", 4}, {"i32", 4 | RAWVIEW_SIGNED},
+        {"u16be", 2 | RAWVIEW_BIGENDIAN}, {"u32be", 4 | RAWVIEW_BIGENDIAN},
+        {"i32be", 4 | RAWVIEW_SIGNED | RAWVIEW_BIGENDIAN}
+    };
+    static const luaL_Reg methods[] =
+    {
+        {"sub", capi_rawview_sub},
+        {"str", capi_rawview_str},
+        {"len", capi_rawview_len},
+        {NULL, NULL}
+    };
+
+    luaL_newmetatable(L, LUA_RAWVIEW);
+    lua_newtable(L); // methods for __index
+    for(size_t i=0; i < sizeof(readers) / sizeof(readers[0]); i++)
+    {
+        lua_pushlightuserdata(L, (void*)context);
+        lua_pushinteger(L, readers[i].kind);
+        lua_pushcclosure(L, capi_rawview_read, 2);
+        lua_setfield(L, -2, readers[i].name);
+    }
+    for(const luaL_Reg *method=methods; method->name; method++)
+    {
+        lua_pushlightuserdata(L, (void*)context);
+        lua_pushcclosure(L, method->func, 1);
+        lua_setfield(L, -2, method->name);
+    }
+    lua_setfield(L, -2, "__index");
+    lua_pushlightuserdata(L, (void*)context);
+    lua_pushcclosure(L, capi_rawview_len, 1);
+    lua_setfield(L, -2, "__len");
+    lua_pop(L, 1);
+}
+
+static void register_basic(lua_State *L, struct decode_context_t *context)
+{
+    register_rawview(L, context);
+    register_capi(L, "log", capi_log, context);
+    register_capi(L, "print", capi_log, context); // print of lua writes to stdout
+    register_capi(L, "memnew", capi_memnew, context);
+    register_capi(L, "memdel", capi_memdel, context);
+    register_capi(L, "memsize", capi_memsize, context);
+    register_capi(L, "memreadi", capi_memreadi, context);
+    register_capi(L, "memreads", capi_memreads, context);
+    register_capi(L, "memwrite", capi_memwrite, context);
+    register_capi(L, "memptr", capi_memptr, context);
+    register_capi(L, "get_tilecfg", capi_get_tilecfg, context);
+    register_capi(L, "set_tilecfg", capi_set_tilecfg, context);
+    register_capi(L, "get_tilenav", capi_get_tilenav, context);
+    register_capi(L, "set_tilenav", capi_set_tilenav, context);
+    register_capi(L, "get_tilestyle", capi_get_tilestyle, context);
+    register_capi(L, "set_tilestyle", capi_set_tilestyle, context);
+    register_capi(L, "get_rawsize", capi_get_rawsize, context);
+    register_capi(L, "get_rawdata", capi_get_rawdata, context);
+    register_capi(L, "get_rawdatap", capi_get_rawdatap, context);
+    register_capi(L, "get_rawview", capi_get_rawview, context);
+    register_capi(L, "get_pixels", capi_get_pixels, context);
+}
+
+// the pixels lent to lua are not accessible after post, memread and memwrite fail by size 0
+static void release_pixels(struct decode_context_t *context)
+{
+    if(context->pixels)
+    {
+        context->pixels->p = NULL;
+        context->pixels->n = 0;
+    }
+    if(context->pinref != LUA_NOREF) luaL_unref(context->L, LUA_REGISTRYINDEX, context->pinref);
+    context->pinref = LUA_NOREF;
+}
+
+static int ref_function(lua_State *L, const char *name)
+{
+    lua_getglobal(L, name);
+    if(lua_isfunction(L, -1)) return luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_pop(L, 1);
+    return LUA_NOREF;
+}
+
+static bool read_chunk(const char *path, uint64_t key, struct memblock_t *chunk)
+{
+    struct chunk_header_t header;
+    FILE *fp = fopen(path, "rb");
+    if(!fp) return false;
+    bool res = fread(&header, sizeof(header), 1, fp) == 1
+        && !memcmp(header.magic, LUA_CHUNK_MAGIC, sizeof(header.magic)) && header.key == key
+        && !strncmp(header.backend, LUA_BACKEND, sizeof(header.backend) - 1) && header.size;
+    if(res)
+    {
+        chunk->p = malloc(header.size);
+        chunk->n = header.size;
+        res = chunk->p && fread(chunk->p, 1, header.size, fp) == header.size;
+        if(!res)
+        {
+            free(chunk->p);
+            chunk->p = NULL;
+            chunk->n = 0;
+        }
+    }
+    fclose(fp);
+    return res;
+}
+
+static bool write_chunk(const char *path, uint64_t key, const struct memblock_t *chunk)
+{
+    struct chunk_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LUA_CHUNK_MAGIC, sizeof(header.magic));
+    header.size = (uint32_t)chunk->n;
+    header.key = key;
+    strncpy(header.backend, LUA_BACKEND, sizeof(header.backend) - 1);
+    FILE *fp = fopen(path, "wb");
+    if(!fp) return false;
+    bool res = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(chunk->p, 1, chunk->n, fp) == chunk->n;
+    fclose(fp);
+    if(!res) remove(path); // the broken cache would be compiled again, but not left there
+    return res;
+}
+
+static int dump_writer(lua_State *L, const void *p, size_t size, void *ud)
+{
+    struct memblock_t *chunk = (struct memblock_t*)ud;
+    void *buf = realloc(chunk->p, chunk->n + size);
+    if(!buf) return 1;
+    memcpy((uint8_t*)buf + chunk->n, p, size);
+    chunk->p = buf;
+    chunk->n += size;
+    return 0;
+}
+
+// load the binary chunk if any, otherwise parse luastr, and dump it into the chunk if parsed is not NULL
+static int load_chunk(lua_State *L, const char *luastr, struct memblock_t *chunk, bool *parsed)
+{
+    if(chunk->n)
+    {
+        if(luaL_loadbufferx(L, (const char*)chunk->p, chunk->n, "chunk", "b") == LUA_OK) return LUA_OK;
+        lua_pop(L, 1); // the chunk is from another build, parse the script again
+    }
+    if(!luastr)
+    {
+        lua_pushstring(L, "no script to load");
+        return LUA_ERRSYNTAX;
+    }
+    int res = luacompat_loadstring(L, luastr);
+    if(res != LUA_OK || !parsed) return res;
+    *parsed = true;
+    free(chunk->p);
+    chunk->p = NULL;
+    chunk->n = 0;
+    if(luacompat_dump(L, dump_writer, chunk) != 0)
+    {
+        free(chunk->p);
+        chunk->p = NULL;
+        chunk->n = 0;
+    }
+    return LUA_OK;
+}
+
+// create the lua state of context and run the script from chunk or luastr, msg is set on error
+static PLUGIN_STATUS load_context(struct decode_context_t *context,
+    const char *luastr, struct memblock_t *chunk, bool *parsed)
+{
+    char *msg = context->msg;
     lua_State* L = luaL_newstate();
     if(!L) return STATUS_FAIL;
     luaL_openlibs(L);
 
+    // the userdata is the same layout as memblock, so that mem functions can use it
+    context->L = L;
+    context->pinref = LUA_NOREF;
+    if(!context->main) // decode_pixels is only on the main context
+    {
+        context->pixels = (struct memblock_t*)lua_newuserdata(L, sizeof(struct memblock_t));
+        context->pixels->p = NULL;
+        context->pixels->n = 0;
+        context->pixelsref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    context->out = (struct memblock_t*)lua_newuserdata(L, sizeof(struct memblock_t));
+    context->out->p = NULL;
+    context->out->n = 0;
+    context->outref = luaL_ref(L, LUA_REGISTRYINDEX);
+
     // load the script
-    sprintf(s_msg, "[plugin_lua::open]\n");
-    register_basic(L);
-    register_extra(L);
-    int luares = luaL_dostring(L, luastr);
+    register_basic(L, context);
+    register_extra(L, context);
+    luacompat_open(L);
+    int luares = load_chunk(L, luastr, chunk, parsed);
+    if(luares == LUA_OK) luares = lua_pcall(L, 0, LUA_MULTRET, 0);
     if( luares != LUA_OK)
     {
-        status = STATUS_SCRIPTERROR;
-        sprintf(s_msg, " %s", lua_tostring(L, -1));
+        snprintf(msg, LUA_MSG_SIZE, " %s", lua_tostring(L, -1));
         lua_close(L);
-        goto decode_open_lua_end;
+        context->L = NULL;
+        return STATUS_SCRIPTERROR;
+    }
+
+    // the callbacks for each pixel or tile are kept in registry, rather than searched every call
+    context->pixelfunc = ref_function(L, "decode_pixel");
+    context->tilefunc = ref_function(L, "decode_tile");
+    context->rowsfunc = ref_function(L, "decode_rows");
+    return STATUS_OK;
+}
+
+static void unload_context(struct decode_context_t *context)
+{
+    if(context->L) lua_close(context->L);
+    context->L = NULL;
+    context->rawdata = NULL;
+    context->rawsize = 0;
+    context->cfg = NULL;
+    context->pixels = NULL; // freed with L
+    context->out = NULL;
+    free(context->scratch.p);
+    context->scratch.p = NULL;
+    context->scratch.n = 0;
+}
+
+static PLUGIN_STATUS recvui_context(struct decode_context_t *context, const char *buf, size_t bufsize);
+
+// run decode_pre of the lane with the tilecfg before the main pre, if the lane is older than the main context
+static PLUGIN_STATUS prepare_lane(struct decode_context_t *lane)
+{
+    struct decode_context_t *context = lane->main;
+    if(lane->generation == context->generation) return STATUS_OK;
+    lane->rawblock = context->rawblock;
+    lane->precfg = context->precfg;
+    lane->cfg = &lane->precfg; // set_tilecfg in lanes does not change the host tilecfg
+    if(context->uicfg) recvui_context(lane, context->uicfg, strlen(context->uicfg));
+    lane->msg[0] = '\0';
+
+    lua_State *L = lane->L;
+    lua_getglobal(L, "decode_pre");
+    if(!lua_isfunction(L, -1))
+    {
+        lua_pop(L, 1);
+        lane->generation = context->generation;
+        return STATUS_OK;
+    }
+    if(lua_pcall(L, 0, 1, 0) != LUA_OK)
+    {
+        snprintf(lane->msg, LUA_MSG_SIZE, "[plugin_lua::lane] decode_pre %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return STATUS_FAIL;
+    }
+    bool res = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    if(!res) return STATUS_FAIL;
+    lane->generation = context->generation;
+    return STATUS_OK;
+}
+
+// get a free lane for the calling thread, a new lane is created if all are busy, NULL if failed
+static struct decode_context_t *acquire_lane(struct decode_context_t *context)
+{
+    if(!context->parallel) return context;
+    while(true)
+    {
+        int n = atomic_load(&context->nlane);
+        for(int i=1; i < n; i++)
+        {
+            struct decode_context_t *lane = context->lanes[i];
+            if(!atomic_flag_test_and_set(&lane->busy)) return lane;
+        }
+        if(n >= LUA_LANE_MAX || atomic_flag_test_and_set(&context->lock))
+        {
+            lane_yield(); // more threads than lanes, or another thread is creating one
+            continue;
+        }
+        if(atomic_load(&context->nlane) != n)
+        {
+            atomic_flag_clear(&context->lock);
+            continue;
+        }
+
+        struct decode_context_t *lane = (struct decode_context_t*)calloc(1, sizeof(struct decode_context_t));
+        if(lane)
+        {
+            lane->main = context;
+            lane->generation = context->generation - 1;
+            lane->nav = context->nav;
+            lane->style = context->style;
+            atomic_flag_clear(&lane->lock);
+            atomic_flag_test_and_set(&lane->busy);
+            if(load_context(lane, context->script, &context->chunk, NULL) == STATUS_OK)
+            {
+                context->lanes[n] = lane;
+                atomic_store(&context->nlane, n + 1);
+            }
+            else
+            {
+                snprintf(context->msg, LUA_MSG_SIZE, "[plugin_lua::lane]%s", lane->msg);
+                free(lane);
+                lane = NULL;
+            }
+        }
+        atomic_flag_clear(&context->lock);
+        return lane;
+    }
+}
+
+// the error of lane is passed to the main context for the host, then the lane is free for other threads,
+// the log of lane is kept until post_lanes
+static void release_lane(struct decode_context_t *lane, PLUGIN_STATUS status)
+{
+    struct decode_context_t *context = lane->main;
+    if(!context)
+    {
+        atomic_flag_clear(&lane->busy);
+        return;
+    }
+    if(!PLUGIN_SUCCESS(status) && lane->msg[0])
+    {
+        while(atomic_flag_test_and_set(&context->lock)) lane_yield();
+        strncpy(context->msg, lane->msg, LUA_MSG_SIZE - 1);
+        atomic_flag_clear(&context->lock);
+    }
+    atomic_flag_clear(&lane->busy);
+}
+
+PLUGIN_STATUS STDCALL decode_open_lua(const char *luastr, void **context)
+{
+    struct decode_context_t* _context = s_freecontext;
+    if(_context) s_freecontext = _context->next;
+    else _context = (struct decode_context_t*)malloc(sizeof(struct decode_context_t));
+    if(!_context) return STATUS_FAIL;
+    memset(_context, 0, sizeof(struct decode_context_t));
+    atomic_init(&_context->nlane, 1);
+    atomic_flag_clear(&_context->busy);
+    atomic_flag_clear(&_context->lock);
+    _context->lanes[0] = _context;
+    _context->nav = g_tilenav; // only read here, the batch workers do not change them
+    _context->style = g_tilestyle;
+    g_decoder_lua.msg = _context->msg;
+    char *msg = _context->msg;
+
+    // the compiled chunk in cache is used if the script is not changed, the cache is updated if parsed
+    sprintf(msg, "[plugin_lua::open]\n");
+    bool parsed = false;
+    if(g_lua_chunkfile) read_chunk(g_lua_chunkfile, g_lua_chunkkey, &_context->chunk);
+    PLUGIN_STATUS status = load_context(_context, luastr, &_context->chunk, &parsed);
+    if(status != STATUS_OK) goto decode_open_lua_fail;
+    lua_State* L = _context->L;
+    if(g_lua_chunkfile)
+    {
+        const char *how = !parsed ? "load chunk from cache" :
+            _context->chunk.n && write_chunk(g_lua_chunkfile, g_lua_chunkkey, &_context->chunk) ?
+            "parse script, chunk cached" : "parse script";
+        snprintf(msg + strlen(msg), LUA_MSG_SIZE - strlen(msg), "[plugin_lua::open] %s\n", how);
     }
 
     // bind function
     lua_getglobal(L, "decode_pre");
-    if(!lua_isfunction(L, -1)) g_decoder_lua.pre = NULL;
+    if(!lua_isfunction(L, -1)) g_decoder_lua.pre64 = NULL;
     lua_pop(L, 1);
 
     lua_getglobal(L, "decode_post");
-    if(!lua_isfunction(L, -1)) g_decoder_lua.post = NULL;
+    if(!lua_isfunction(L, -1)) g_decoder_lua.post64 = NULL;
     lua_pop(L, 1);
 
-    lua_getglobal(L, "decode_pixel");
-    if(!lua_isfunction(L, -1)) g_decoder_lua.decodeone = NULL;
-    lua_pop(L, 1);
+    if(_context->pixelfunc == LUA_NOREF) g_decoder_lua.decodeone64 = NULL;
+    if(_context->tilefunc == LUA_NOREF && _context->rowsfunc == LUA_NOREF) g_decoder_lua.decodetiles = NULL;
 
     lua_getglobal(L, "decode_pixels");
     if(!lua_isfunction(L, -1)) g_decoder_lua.decodeall = NULL;
@@ -474,45 +1047,75 @@ PLUGIN_STATUS STDCALL decode_open_lua(const char *luastr, void **context)
     if(!lua_isfunction(L, -1)) g_decoder_lua.recvui = NULL;
     lua_pop(L, 1);
 
-    s_decode_context.L = L;
-    *context = &s_decode_context;
+    // the plugin declares its decode functions only depend on the state from decode_pre
+    lua_getglobal(L, "parallel");
+    _context->parallel = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    if(_context->parallel && !_context->chunk.n) _context->script = strdup(luastr);
+    if(_context->parallel && (_context->chunk.n || _context->script)) g_decoder_lua.flags |= TILE_DECODER_FLAG_REENTRANT;
+    else _context->parallel = false;
+
+    *context = _context;
+    goto decode_open_lua_end;
+
+decode_open_lua_fail:
+    free(_context->chunk.p);
+    _context->chunk.p = NULL;
+    _context->chunk.n = 0;
+    _context->next = s_freecontext;
+    s_freecontext = _context;
 
 decode_open_lua_end:
-    if(s_msg[strlen(s_msg) - 1] =='\n') s_msg[strlen(s_msg) - 1] = '\0';
+    if(strlen(msg) && msg[strlen(msg) - 1] =='\n') msg[strlen(msg) - 1] = '\0';
     return status;
 }
 
 PLUGIN_STATUS STDCALL decode_close_lua(void *context)
 {
-    s_msg[0] = '\0';
-    sprintf(s_msg, "[plugin_lua::close]");
     struct decode_context_t* _context = (struct decode_context_t*)context;
-    lua_close(_context->L);
-    _context->rawdata = NULL;
-    _context->rawsize = 0;
-
-    if(s_msg[strlen(s_msg) - 1] =='\n') s_msg[strlen(s_msg) - 1] = '\0';
+    char *msg = _context->msg;
+    sprintf(msg, "[plugin_lua::close]");
+    int nlane = atomic_load(&_context->nlane);
+    for(int i=1; i < nlane; i++)
+    {
+        unload_context(_context->lanes[i]);
+        free(_context->lanes[i]);
+    }
+    unload_context(_context);
+    free(_context->script);
+    _context->script = NULL;
+    free(_context->chunk.p);
+    _context->chunk.p = NULL;
+    _context->chunk.n = 0;
+    free(_context->uicfg);
+    _context->uicfg = NULL;
+    _context->next = s_freecontext;
+    s_freecontext = _context;
     return STATUS_OK;
 }
 
 // function decode_pixel(i, x, y)
 PLUGIN_STATUS STDCALL decode_pixel_lua(void *context,
     const uint8_t* data, size_t datasize,
-    const struct tilepos_t *pos, const struct tilefmt_t *fmt,
+    const struct tilepos64_t *pos, const struct tilefmt_t *fmt,
     struct pixel_t *pixel, bool remain_index)
 {
-    s_msg[0] = '\0';
-    PLUGIN_STATUS status = STATUS_OK;
-    lua_State *L = ((struct decode_context_t*) context)->L;
+    struct decode_context_t* _context = acquire_lane((struct decode_context_t*) context);
+    if(!_context) return STATUS_FAIL;
+    char *msg = _context->msg;
+    msg[0] = '\0';
+    PLUGIN_STATUS status = _context->main ? prepare_lane(_context) : STATUS_OK;
+    lua_State *L = _context->L;
+    if(!PLUGIN_SUCCESS(status)) goto decode_pixel_lua_end;
 
-    lua_getglobal(L, "decode_pixel");
+    lua_rawgeti(L, LUA_REGISTRYINDEX, _context->pixelfunc);
     lua_pushinteger(L, pos->i);
     lua_pushinteger(L, pos->x);
     lua_pushinteger(L, pos->y);
     if(lua_pcall(L, 3, 1, 0) != LUA_OK)
     {
         status = STATUS_FAIL;
-        sprintf(s_msg, "%s\n", lua_tostring(L, -1));
+        snprintf(msg, LUA_MSG_SIZE, "%s\n", lua_tostring(L, -1));
         lua_pop(L, 1);
         goto decode_pixel_lua_end;
     }
@@ -520,64 +1123,210 @@ PLUGIN_STATUS STDCALL decode_pixel_lua(void *context,
     lua_pop(L, 1); // should pop after lua_tointeger
 
 decode_pixel_lua_end:
-    if(s_msg[strlen(s_msg) - 1] =='\n') s_msg[strlen(s_msg) - 1] = '\0';
+    if(strlen(msg) && msg[strlen(msg) - 1] =='\n') msg[strlen(msg) - 1] = '\0';
+    release_lane(_context, status);
+    return status;
+}
+
+// function decode_tile(i, out) or decode_rows(i, y0, y1, out), fill the rows of tile i by memwrite, return true
+// out is the rgba pixels of rows [y0, y1) in order, decode_tile is for all rows and prior to decode_rows
+PLUGIN_STATUS STDCALL decode_tiles_lua(void *context,
+    const uint8_t* data, size_t datasize,
+    uint64_t first, size_t count, const struct tilefmt_t *fmt,
+    struct pixel_t *out, size_t stride, bool remain_index)
+{
+    struct decode_context_t* _context = acquire_lane((struct decode_context_t*) context);
+    if(!_context) return STATUS_FAIL;
+    char *msg = _context->msg;
+    msg[0] = '\0';
+    PLUGIN_STATUS status = _context->main ? prepare_lane(_context) : STATUS_OK;
+    lua_State *L = _context->L;
+    bool usetile = _context->tilefunc != LUA_NOREF;
+    uint32_t w = fmt->w, h = fmt->h;
+    uint32_t band = usetile ? h : LUA_ROWS_PIXELS / (w ? w : 1);
+    if(band < 1) band = 1;
+    if(band > h) band = h;
+
+    // lua writes to the host directly if the rows are continuous
+    bool direct = stride == w;
+    size_t bandsize = (size_t)w * band * sizeof(struct pixel_t);
+    if(!PLUGIN_SUCCESS(status)) goto decode_tiles_lua_end;
+    if(!direct && _context->scratch.n < bandsize)
+    {
+        void *p = realloc(_context->scratch.p, bandsize);
+        if(!p)
+        {
+            status = STATUS_FAIL;
+            goto decode_tiles_lua_end;
+        }
+        _context->scratch.p = p;
+        _context->scratch.n = bandsize;
+    }
+
+    for(size_t k=0; k < count; k++)
+    {
+        for(uint32_t y0=0; y0 < h; y0 += band)
+        {
+            uint32_t y1 = h - y0 > band ? y0 + band : h;
+            struct pixel_t *rows = out + (k * h + y0) * stride;
+            _context->out->p = direct ? (void*)rows : _context->scratch.p;
+            _context->out->n = (size_t)w * (y1 - y0) * sizeof(struct pixel_t);
+            lua_rawgeti(L, LUA_REGISTRYINDEX, usetile ? _context->tilefunc : _context->rowsfunc);
+            lua_pushinteger(L, first + k);
+            if(!usetile)
+            {
+                lua_pushinteger(L, y0);
+                lua_pushinteger(L, y1);
+            }
+            lua_rawgeti(L, LUA_REGISTRYINDEX, _context->outref);
+            if(lua_pcall(L, usetile ? 2 : 4, 1, 0) != LUA_OK)
+            {
+                status = STATUS_FAIL;
+                snprintf(msg, LUA_MSG_SIZE, "%s\n", lua_tostring(L, -1));
+                lua_pop(L, 1);
+                goto decode_tiles_lua_end;
+            }
+            bool res = lua_toboolean(L, -1);
+            lua_pop(L, 1);
+            if(!res)
+            {
+                status = STATUS_FAIL;
+                snprintf(msg, LUA_MSG_SIZE, "[plugin_lua::decodetiles] %s tile %llu failed\n",
+                    usetile ? "decode_tile" : "decode_rows", (unsigned long long)(first + k));
+                goto decode_tiles_lua_end;
+            }
+            if(direct) continue;
+            for(uint32_t y=y0; y < y1; y++)
+            {
+                memcpy(out + (k * h + y) * stride,
+                    (struct pixel_t*)_context->scratch.p + (size_t)(y - y0) * w, w * sizeof(struct pixel_t));
+            }
+        }
+    }
+
+decode_tiles_lua_end:
+    _context->out->p = NULL; // memread and memwrite fail by size 0 after the call
+    _context->out->n = 0;
+    if(strlen(msg) && msg[strlen(msg) - 1] =='\n') msg[strlen(msg) - 1] = '\0';
+    release_lane(_context, status);
     return status;
 }
 
+// function decode_pixels(pixels, npixel), fill the host pixels in place by memwrite, return npixel filled
+// the legacy decode_pixels() returns memblock or string, npixel, offset, and they are copied to the host
 PLUGIN_STATUS decode_pixels_lua(void *context,
     const uint8_t* data, size_t datasize,
     const struct tilefmt_t *fmt, struct pixel_t *pixels[],
     size_t *npixel, bool remain_index)
 {
-    s_msg[0] = '\0';
+    struct decode_context_t* _context = (struct decode_context_t*) context;
+    char *msg = _context->msg;
+    msg[0] = '\0';
     PLUGIN_STATUS status = STATUS_OK;
-    lua_State *L = ((struct decode_context_t*) context)->L;
-
+    lua_State *L = _context->L;
+    struct pixel_t *hostpixels = *pixels; // NULL if the host has no buffer
+    size_t hostnpixel = hostpixels ? *npixel : 0;
+    size_t n = 0, offset = 0, nbytes = 0;
+    const uint8_t *src = NULL;
+    int top = 0;
+    bool inplace = false;
+
+    release_pixels(_context);
+    _context->pixels->p = hostpixels;
+    _context->pixels->n = hostnpixel * sizeof(struct pixel_t);
     lua_getglobal(L, "decode_pixels");
-    if(lua_pcall(L, 0, 3, 0) != LUA_OK)
+    lua_rawgeti(L, LUA_REGISTRYINDEX, _context->pixelsref);
+    lua_pushinteger(L, hostnpixel);
+    if(lua_pcall(L, 2, 3, 0) != LUA_OK)
     {
         status = STATUS_FAIL;
-        sprintf(s_msg, "%s\n", lua_tostring(L, -1));
+        snprintf(msg, LUA_MSG_SIZE, "%s\n", lua_tostring(L, -1));
         lua_pop(L, 1);
+        goto decode_pixels_lua_fail;
+    }
+
+    // filled in place, returns npixel, true, or pixels with npixel
+    top = lua_gettop(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, _context->pixelsref);
+    inplace = lua_rawequal(L, top - 2, -1);
+    lua_pop(L, 1);
+    if(inplace || lua_isinteger(L, top - 2) || lua_isboolean(L, top - 2))
+    {
+        if(lua_isboolean(L, top - 2) && !lua_toboolean(L, top - 2)) status = STATUS_FAIL;
+        n = hostnpixel;
+        if(lua_isinteger(L, top - 2)) n = lua_tointeger(L, top - 2);
+        else if(inplace && lua_isinteger(L, top - 1)) n = lua_tointeger(L, top - 1);
+        if(n > hostnpixel) n = hostnpixel;
+        lua_pop(L, 3);
+        if(!hostpixels) status = STATUS_FAIL; // nothing is filled
+        if(status != STATUS_OK) goto decode_pixels_lua_fail;
+        *pixels = hostpixels;
+        *npixel = n;
         goto decode_pixels_lua_end;
     }
-    *npixel = lua_tointeger(L, 2);
-    size_t offset = lua_tointeger(L, 3);
-    if(lua_isuserdata(L, 1))
+
+    // legacy memblock or string, owned by lua
+    n = lua_tointeger(L, top - 1);
+    offset = lua_tointeger(L, top);
+    if(lua_islightuserdata(L, top - 2))
     {
-        struct memblock_t* block = lua_touserdata(L, 1);
-        *pixels = (struct pixel_t *)((uint8_t*)block->p + offset);
+        struct memblock_t* block = lua_touserdata(L, top - 2);
+        src = (const uint8_t*)block->p;
+        nbytes = block->n;
     }
-    else if(lua_isstring(L, 1))
+    else if(lua_type(L, top - 2) == LUA_TSTRING)
     {
-        const char *data = lua_tostring(L, 1);
-        *pixels = (struct pixel_t *) data;
+        src = (const uint8_t*)lua_tolstring(L, top - 2, &nbytes);
     }
-    else
+    if(!src || offset > nbytes)
     {
         lua_pop(L, 3);
         status = STATUS_FAIL;
-        goto decode_pixels_lua_end;
+        goto decode_pixels_lua_fail;
     }
+    if(n > (nbytes - offset) / sizeof(struct pixel_t)) n = (nbytes - offset) / sizeof(struct pixel_t);
+    if(hostpixels) // copy while the block or string is still alive
+    {
+        if(n > hostnpixel) n = hostnpixel;
+        memcpy(hostpixels, src + offset, n * sizeof(struct pixel_t));
+        *pixels = hostpixels;
+    }
+    else // the memblock is freed by the script in post, and the string is kept until post
+    {
+        if(lua_type(L, top - 2) == LUA_TSTRING)
+        {
+            lua_pushvalue(L, top - 2);
+            _context->pinref = luaL_ref(L, LUA_REGISTRYINDEX);
+        }
+        *pixels = (struct pixel_t *)(src + offset);
+    }
+    *npixel = n;
     lua_pop(L, 3);
-    status = STATUS_OK;
+    goto decode_pixels_lua_end;
 
-decode_pixels_lua_end:
+decode_pixels_lua_fail:
     *npixel = 0;
     *pixels = NULL;
-    if(s_msg[strlen(s_msg) - 1] =='\n') s_msg[strlen(s_msg) - 1] = '\0';
+
+decode_pixels_lua_end:
+    if(strlen(msg) && msg[strlen(msg) - 1] =='\n') msg[strlen(msg) - 1] = '\0';
     return status;
 }
 
 PLUGIN_STATUS STDCALL decode_pre_lua(void *context,
-    const uint8_t* rawdata, size_t rawsize, struct tilecfg_t *cfg)
+    const uint8_t* rawdata, size_t rawsize, struct tilecfg64_t *cfg)
 {
-    s_msg[0] = '\0';
-    PLUGIN_STATUS status = STATUS_OK;
     struct decode_context_t* _context = (struct decode_context_t*) context;
+    char *msg = _context->msg;
+    msg[0] = '\0';
+    PLUGIN_STATUS status = STATUS_OK;
     _context->rawdata = rawdata;
     _context->rawsize = rawsize;
+    _context->cfg = cfg;
+    _context->precfg = *cfg;
+    _context->generation++; // the lanes run decode_pre again before decoding
     lua_State *L = _context->L;
+    release_pixels(_context); // from the last decoding without post
 
     if(cfg->start > rawsize)
     {
@@ -589,7 +1338,7 @@ PLUGIN_STATUS STDCALL decode_pre_lua(void *context,
     if(lua_pcall(L, 0, 1, 0) != LUA_OK)
     {
         status = STATUS_FAIL;
-        sprintf(s_msg, "%s\n", lua_tostring(L, -1));
+        snprintf(msg, LUA_MSG_SIZE, "%s\n", lua_tostring(L, -1));
         lua_pop(L, 1);
         goto decode_pre_lua_end;
     }
@@ -598,67 +1347,104 @@ PLUGIN_STATUS STDCALL decode_pre_lua(void *context,
     status = res ? STATUS_OK : STATUS_FAIL;
 
 decode_pre_lua_end:
-    if(s_msg[strlen(s_msg) - 1] =='\n') s_msg[strlen(s_msg) - 1] = '\0';
+    if(status != STATUS_OK) _context->cfg = NULL; // no post after the failed pre
+    if(strlen(msg) && msg[strlen(msg) - 1] =='\n') msg[strlen(msg) - 1] = '\0';
     return status;
 }
 
+// decode_post in the lanes prepared for this decoding, so the memblocks from their decode_pre are freed,
+// then the logs of the lanes are appended to msg of the main context
+static void post_lanes(struct decode_context_t *context)
+{
+    char *msg = context->msg;
+    int nlane = atomic_load(&context->nlane);
+    for(int i=1; i < nlane; i++)
+    {
+        struct decode_context_t *lane = context->lanes[i];
+        if(lane->generation == context->generation)
+        {
+            lane->generation = context->generation - 1;
+            lua_State *L = lane->L;
+            lua_getglobal(L, "decode_post");
+            if(!lua_isfunction(L, -1) || lua_pcall(L, 0, 0, 0) != LUA_OK) lua_pop(L, 1);
+        }
+        if(!lane->log[0]) continue;
+        while(atomic_flag_test_and_set(&context->lock)) lane_yield();
+        size_t n = strlen(msg);
+        snprintf(msg + n, LUA_MSG_SIZE - n, "[plugin_lua::lane %d]\n%s", i, lane->log);
+        atomic_flag_clear(&context->lock);
+        lane->log[0] = '\0';
+    }
+}
+
 PLUGIN_STATUS STDCALL decode_post_lua(void *context,
-    const uint8_t* rawdata, size_t rawsize, struct tilecfg_t *cfg)
+    const uint8_t* rawdata, size_t rawsize, struct tilecfg64_t *cfg)
 {
-    s_msg[0] = '\0';
+    struct decode_context_t* _context = (struct decode_context_t*) context;
+    char *msg = _context->msg;
+    msg[0] = '\0';
     PLUGIN_STATUS status = STATUS_OK;
-    lua_State *L = ((struct decode_context_t*) context)->L;
+    bool res = false;
+    _context->cfg = cfg;
+    lua_State *L = _context->L;
+    post_lanes(_context); // before the main one, so that the logs of lanes are in order
 
     lua_getglobal(L, "decode_post");
     if(lua_pcall(L, 0, 1, 0) != LUA_OK)
     {
         status = STATUS_FAIL;
-        sprintf(s_msg, "%s\n", lua_tostring(L, -1));
+        snprintf(msg, LUA_MSG_SIZE, "%s\n", lua_tostring(L, -1));
         lua_pop(L, 1);
         goto decode_post_lua_end;
     }
-    bool res = lua_toboolean(L, -1);
+    res = lua_toboolean(L, -1);
     lua_pop(L, 1);
 
 decode_post_lua_end:
-    if(s_msg[strlen(s_msg) - 1] =='\n') s_msg[strlen(s_msg) - 1] = '\0';
+    release_pixels(_context); // the host may move or free the pixels after post
+    _context->cfg = NULL; // the host cfg can be on stack, get_tilecfg in recvui uses g_tilecfg then
+    if(strlen(msg) && msg[strlen(msg) - 1] =='\n') msg[strlen(msg) - 1] = '\0';
     return res ? STATUS_OK : STATUS_FAIL;
 }
 
 PLUGIN_STATUS STDCALL decode_sendui_lua(void *context, const char **buf, size_t *bufsize)
 {
-    s_msg[0] = '\0';
+    struct decode_context_t* _context = (struct decode_context_t*) context;
+    char *msg = _context->msg;
+    msg[0] = '\0';
     PLUGIN_STATUS status = STATUS_OK;
-    lua_State *L = ((struct decode_context_t*) context)->L;
+    lua_State *L = _context->L;
 
     lua_getglobal(L, "decode_sendui");
     if(lua_pcall(L, 0, 1, 0) != LUA_OK)
     {
         status = STATUS_FAIL;
-        sprintf(s_msg, "%s\n", lua_tostring(L, -1));
+        snprintf(msg, LUA_MSG_SIZE, "%s\n", lua_tostring(L, -1));
         lua_pop(L, 1);
         goto decode_sendui_lua_end;
     }
     *buf = lua_tolstring(L, -1, bufsize);
     lua_pop(L, 1);
-    sprintf(s_msg, "[plugin_lua::sendui] send %zu bytes\n", *bufsize);
+    sprintf(msg, "[plugin_lua::sendui] send %zu bytes\n", *bufsize);
 
 decode_sendui_lua_end:
-    if(s_msg[strlen(s_msg) - 1] =='\n') s_msg[strlen(s_msg) - 1] = '\0';
+    if(strlen(msg) && msg[strlen(msg) - 1] =='\n') msg[strlen(msg) - 1] = '\0';
     return status;
 }
 
-PLUGIN_STATUS STDCALL decode_recvui_lua(void *context, const char *buf, size_t bufsize)
+// function decode_recvui(cfg), cfg.plugincfg is the array of {name, value}
+static PLUGIN_STATUS recvui_context(struct decode_context_t *_context, const char *buf, size_t bufsize)
 {
-    s_msg[0] = '\0';
+    char *msg = _context->msg;
+    msg[0] = '\0';
     PLUGIN_STATUS status = STATUS_OK;
-    lua_State *L = ((struct decode_context_t*) context)->L;
+    lua_State *L = _context->L;
     cJSON *root = cJSON_Parse(buf);
-    if(!root) goto decode_recvui_lua_end;
+    if(!root) goto recvui_context_end;
     const cJSON* props = cJSON_GetObjectItem(root, "plugincfg");
     const cJSON* prop = NULL;
-    if(!props) goto decode_recvui_lua_end;
-    sprintf(s_msg, "[plugin_lua::recvui] recv %zu bytes\n", bufsize);
+    if(!props) goto recvui_context_end;
+    sprintf(msg, "[plugin_lua::recvui] recv %zu bytes\n", bufsize);
 
     int i=1;
     lua_getglobal(L, "decode_recvui");
@@ -683,33 +1469,46 @@ PLUGIN_STATUS STDCALL decode_recvui_lua(void *context, const char *buf, size_t b
     if (lua_pcall(L, 1, 1, 0) != LUA_OK)
     {
         status = STATUS_FAIL;
-        sprintf(s_msg, "%s\n", lua_tostring(L, -1));
+        snprintf(msg, LUA_MSG_SIZE, "%s\n", lua_tostring(L, -1));
         lua_pop(L, 1);
     }
     bool res = lua_toboolean(L, -1);
     lua_pop(L, 1);
     status = res ? STATUS_OK : STATUS_FAIL;
 
-decode_recvui_lua_end:
-    if(s_msg[strlen(s_msg) - 1] =='\n') s_msg[strlen(s_msg) - 1] = '\0';
+recvui_context_end:
+    if(strlen(msg) && msg[strlen(msg) - 1] =='\n') msg[strlen(msg) - 1] = '\0';
     cJSON_Delete(root);
     return status;
 }
 
+PLUGIN_STATUS STDCALL decode_recvui_lua(void *context, const char *buf, size_t bufsize)
+{
+    struct decode_context_t* _context = (struct decode_context_t*) context;
+    if(_context->parallel)
+    {
+        free(_context->uicfg);
+        _context->uicfg = buf ? strdup(buf) : NULL;
+    }
+    return recvui_context(_context, buf, bufsize);
+}
+
 struct tile_decoder_t g_decoder_lua = {
-    .version = TILE_DECODER_VERSION(0, 3, 6, 0),
+    .version = TILE_DECODER_VERSION(0, 3, 7, 0),
     .size = sizeof(struct tile_decoder_t),
-    .msg = s_msg, .context = NULL,
+    .msg = NULL, .context = NULL,
     .open = decode_open_lua, .close = decode_close_lua
 };
 
 struct tile_decoder_t* STDCALL get_decoder_lua()
 {
-    g_decoder_lua.decodeone = decode_pixel_lua;
+    g_decoder_lua.decodeone64 = decode_pixel_lua;
     g_decoder_lua.decodeall = decode_pixels_lua;
-    g_decoder_lua.pre = decode_pre_lua;
-    g_decoder_lua.post = decode_post_lua;
+    g_decoder_lua.decodetiles = decode_tiles_lua;
+    g_decoder_lua.pre64 = decode_pre_lua;
+    g_decoder_lua.post64 = decode_post_lua;
     g_decoder_lua.sendui = decode_sendui_lua;
     g_decoder_lua.recvui = decode_recvui_lua;
+    g_decoder_lua.flags = 0; // reentrant if the plugin is parallel
     return &g_decoder_lua;
 }
\ No newline at end of file
@@ -0,0 +1,366 @@
+/**
+ * implement the compatible layer to host the lua plugins on luajit
+ *   developed by devseed
+ *
+ *  the script is loaded as it is at first, if luajit can not parse it, 
+ *  the 5.4 integer operators are rewritten into __idiv, __shl, __shr, __band, __bor, __bxor, __bnot calls
+ */
+
+#ifdef USE_LUAJIT
+#include <stdint.h>
+#include <stdbool.h>
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+#include "plugin_luacompat.h"
+
+// the functions for the rewritten operators, the numbers are double in luajit
+static const char *s_compat_runtime =
+    "-- the integer operators of lua 5.4 in 64-bit, exact for the values in 53-bit\n"
+    "local bit = require(\"bit\")\n"
+    "local floor = math.floor\n"
+    "local function split(a)\n"
+    "    local lo = a % 4294967296\n"
+    "    return (a - lo) / 4294967296, lo\n"
+    "end\n"
+    "local function join(hi, lo) return hi * 4294967296 + lo % 4294967296 end\n"
+    "function __idiv(a, b) return floor(a / b) end\n"
+    "function __band(a, b)\n"
+    "    local ah, al = split(a)\n"
+    "    local bh, bl = split(b)\n"
+    "    return join(bit.band(ah, bh), bit.band(al, bl))\n"
+    "end\n"
+    "function __bor(a, b)\n"
+    "    local ah, al = split(a)\n"
+    "    local bh, bl = split(b)\n"
+    "    return join(bit.bor(ah, bh), bit.bor(al, bl))\n"
+    "end\n"
+    "function __bxor(a, b)\n"
+    "    local ah, al = split(a)\n"
+    "    local bh, bl = split(b)\n"
+    "    return join(bit.bxor(ah, bh), bit.bxor(al, bl))\n"
+    "end\n"
+    "function __bnot(a) return -1 - a end\n"
+    "function __shl(a, n)\n"
+    "    if n < 0 then return __shr(a, -n) end\n"
+    "    if n >= 64 then return 0 end\n"
+    "    return a * 2 ^ n\n"
+    "end\n"
+    "function __shr(a, n)\n"
+    "    if n < 0 then return __shl(a, -n) end\n"
+    "    if n >= 64 then return 0 end\n"
+    "    if a >= 0 then return floor(a / 2 ^ n) end\n"
+    "    local hi, lo = split(a) -- logical shift of the 64-bit negative, by the unsigned halves\n"
+    "    hi = hi % 4294967296\n"
+    "    if n >= 32 then return floor(hi / 2 ^ (n - 32)) end\n"
+    "    return floor(hi / 2 ^ n) * 4294967296 + floor(lo / 2 ^ n) + hi % 2 ^ n * 2 ^ (32 - n)\n"
+    "end\n"
+    "\n"
+    "-- memview(p) for uint8_t* of the memblock by ffi, such as out of decode_tile and get_rawdatap()\n"
+    "local ffi = require(\"ffi\")\n"
+    "function memview(p)\n"
+    "    local ptr = memptr(p)\n"
+    "    if ptr then return ffi.cast(\"uint8_t*\", ptr) end\n"
+    "end\n";
+
+// return function(src), the tokens are kept with the spaces and comments, so are the line numbers
+static const char *s_compat_rewrite =
+    "-- rewrite the lua 5.4 integer operators into the calls, the other code and line numbers are kept\n"
+    "local keywords = {}\n"
+    "for w in (\"and break do else elseif end false for function goto if in local nil not or repeat return then true until while\"):gmatch(\"%a+\") do\n"
+    "    keywords[w] = true\n"
+    "end\n"
+    "local binary = { -- left and right priority as lparser.c\n"
+    "    [\"or\"]={1,1}, [\"and\"]={2,2},\n"
+    "    [\"<\"]={3,3}, [\">\"]={3,3}, [\"<=\"]={3,3}, [\">=\"]={3,3}, [\"~=\"]={3,3}, [\"==\"]={3,3},\n"
+    "    [\"|\"]={4,4}, [\"~\"]={5,5}, [\"&\"]={6,6}, [\"<<\"]={7,7}, [\">>\"]={7,7},\n"
+    "    [\"..\"]={9,8}, [\"+\"]={10,10}, [\"-\"]={10,10},\n"
+    "    [\"*\"]={11,11}, [\"/\"]={11,11}, [\"//\"]={11,11}, [\"%\"]={11,11}, [\"^\"]={14,13}\n"
+    "}\n"
+    "local rewrite = {[\"//\"]=\"__idiv\", [\"<<\"]=\"__shl\", [\">>\"]=\"__shr\", [\"&\"]=\"__band\", [\"|\"]=\"__bor\", [\"~\"]=\"__bxor\"}\n"
+    "local opener = {[\"function\"]=\"end\", [\"do\"]=\"end\", [\"if\"]=\"end\", [\"repeat\"]=\"until\", [\"(\"]=\")\", [\"[\"]=\"]\", [\"{\"]=\"}\"}\n"
+    "\n"
+    "local function tokenize(src)\n"
+    "    local toks, i, n = {}, 1, #src\n"
+    "    while true do\n"
+    "        local s = i\n"
+    "        while i <= n do -- spaces and comments before the token\n"
+    "            if src:find(\"^%s\", i) then i = i + 1\n"
+    "            elseif src:sub(i, i + 1) == \"--\" then\n"
+    "                local eq = src:match(\"^%[(=*)%[\", i + 2)\n"
+    "                local e\n"
+    "                if eq then _, e = src:find(\"]\" .. eq .. \"]\", i + 2, true)\n"
+    "                else e = (src:find(\"\\n\", i, true) or n + 1) - 1 end\n"
+    "                i = (e or n) + 1\n"
+    "            else break end\n"
+    "        end\n"
+    "        local pre = src:sub(s, i - 1)\n"
+    "        if i > n then\n"
+    "            toks[#toks + 1] = {t=\"eof\", v=\"\", pre=pre}\n"
+    "            return toks\n"
+    "        end\n"
+    "        local c, v, t = src:sub(i, i)\n"
+    "        if c:find(\"[%a_]\") then\n"
+    "            v = src:match(\"^[%w_]+\", i)\n"
+    "            t = keywords[v] and \"kw\" or \"name\"\n"
+    "        elseif c:find(\"%d\") or (c == \".\" and src:find(\"^%.%d\", i)) then\n"
+    "            v = src:match(\"^0[xX][%x%.]*[pP][%+%-]?%d+\", i) or src:match(\"^0[xX][%x%.]*\", i)\n"
+    "                or src:match(\"^[%d%.]+[eE][%+%-]?%d+\", i) or src:match(\"^[%d%.]+\", i)\n"
+    "            t = \"num\"\n"
+    "        elseif c == '\"' or c == \"'\" then\n"
+    "            local j = i + 1\n"
+    "            while j <= n and src:sub(j, j) ~= c do\n"
+    "                j = j + (src:sub(j, j) == \"\\\\\" and 2 or 1)\n"
+    "            end\n"
+    "            v, t = src:sub(i, j), \"str\"\n"
+    "        elseif src:find(\"^%[=*%[\", i) then\n"
+    "            local eq = src:match(\"^%[(=*)%[\", i)\n"
+    "            local _, e = src:find(\"]\" .. eq .. \"]\", i, true)\n"
+    "            v, t = src:sub(i, e or n), \"str\"\n"
+    "        else\n"
+    "            v = src:match(\"^%.%.%.\", i) or src:match(\"^[=~<>]=\", i) or src:match(\"^<<\", i) or src:match(\"^>>\", i)\n"
+    "                or src:match(\"^//\", i) or src:match(\"^::\", i) or src:match(\"^%.%.\", i) or c\n"
+    "            t = \"op\"\n"
+    "        end\n"
+    "        toks[#toks + 1] = {t=t, v=v, pre=pre}\n"
+    "        i = i + #v\n"
+    "    end\n"
+    "end\n"
+    "\n"
+    "return function(src)\n"
+    "    local toks, pos = tokenize(src), 1\n"
+    "    local block, subexpr\n"
+    "\n"
+    "    local function peek() return toks[pos] end\n"
+    "    local function take()\n"
+    "        local tok = toks[pos]\n"
+    "        if tok.t ~= \"eof\" then pos = pos + 1 end\n"
+    "        return tok\n"
+    "    end\n"
+    "    local function isexpr(tok)\n"
+    "        if tok.t == \"name\" or tok.t == \"num\" or tok.t == \"str\" then return true end\n"
+    "        if tok.t == \"kw\" then\n"
+    "            return tok.v == \"nil\" or tok.v == \"true\" or tok.v == \"false\" or tok.v == \"not\" or tok.v == \"function\"\n"
+    "        end\n"
+    "        return tok.v == \"(\" or tok.v == \"{\" or tok.v == \"...\" or tok.v == \"-\" or tok.v == \"#\" or tok.v == \"~\"\n"
+    "    end\n"
+    "\n"
+    "    -- the token and the tokens inside it until the closer\n"
+    "    local function group()\n"
+    "        local tok = take()\n"
+    "        local out = tok.v\n"
+    "        if opener[tok.v] and tok.t ~= \"str\" then out = out .. block(opener[tok.v]) end\n"
+    "        return tok.pre, out\n"
+    "    end\n"
+    "\n"
+    "    -- primary expression with suffixes, the leading spaces are returned alone\n"
+    "    local function simpleexp()\n"
+    "        local pre, out = group()\n"
+    "        while true do\n"
+    "            local tok = peek()\n"
+    "            if tok.v == \".\" or tok.v == \":\" then\n"
+    "                take()\n"
+    "                local name = take()\n"
+    "                out = out .. tok.pre .. tok.v .. name.pre .. name.v\n"
+    "            elseif (tok.v == \"(\" or tok.v == \"[\" or tok.v == \"{\") and tok.t == \"op\" or tok.t == \"str\" then\n"
+    "                local p, s = group()\n"
+    "                out = out .. p .. s\n"
+    "            else break end\n"
+    "        end\n"
+    "        return pre, out\n"
+    "    end\n"
+    "\n"
+    "    subexpr = function(limit)\n"
+    "        local pre, out\n"
+    "        local tok = peek()\n"
+    "        if tok.v == \"not\" or (tok.t == \"op\" and (tok.v == \"-\" or tok.v == \"#\" or tok.v == \"~\")) then\n"
+    "            take()\n"
+    "            local p, s = subexpr(12)\n"
+    "            pre = tok.pre\n"
+    "            if tok.v == \"~\" then out = \"__bnot(\" .. p .. s .. \")\"\n"
+    "            else out = tok.v .. p .. s end\n"
+    "        else\n"
+    "            pre, out = simpleexp()\n"
+    "        end\n"
+    "        while true do\n"
+    "            local op = peek()\n"
+    "            local pri = (op.t == \"op\" or op.t == \"kw\") and binary[op.v]\n"
+    "            if not pri or pri[1] <= limit then break end\n"
+    "            take()\n"
+    "            local p, s = subexpr(pri[2])\n"
+    "            if rewrite[op.v] then out = rewrite[op.v] .. \"(\" .. out .. op.pre .. \",\" .. p .. s .. \")\"\n"
+    "            else out = out .. op.pre .. op.v .. p .. s end\n"
+    "        end\n"
+    "        return pre, out\n"
+    "    end\n"
+    "\n"
+    "    block = function(closer)\n"
+    "        local out = {}\n"
+    "        while true do\n"
+    "            local tok = peek()\n"
+    "            if tok.t == \"eof\" or (tok.v == closer and tok.t ~= \"str\") then\n"
+    "                take()\n"
+    "                out[#out + 1] = tok.pre .. tok.v\n"
+    "                return table.concat(out)\n"
+    "            end\n"
+    "            if isexpr(tok) then\n"
+    "                local p, s = subexpr(0)\n"
+    "                out[#out + 1] = p .. s\n"
+    "            else\n"
+    "                local p, s = group()\n"
+    "                out[#out + 1] = p .. s\n"
+    "            end\n"
+    "        end\n"
+    "    end\n"
+    "\n"
+    "    return block(nil)\n"
+    "end\n";
+
+static bool compat_islittle()
+{
+    const uint16_t v = 1;
+    return *(const uint8_t*)&v == 1;
+}
+
+// read one option of the integer formats, b B h H i[n] I[n] l L j J x with < > = !
+// return the size, 0 for the end, -1 for the options not supported
+static int compat_packitem(const char **pfmt, bool *little, bool *issigned, bool *ispadding)
+{
+    const char *fmt = *pfmt;
+    int size = 0;
+    *issigned = *ispadding = false;
+    while(*fmt)
+    {
+        char c = *fmt++;
+        switch(c)
+        {
+        case '<': *little = true; continue;
+        case '>': *little = false; continue;
+        case '=': *little = compat_islittle(); continue;
+        case ' ': continue;
+        case '!': while(*fmt >= '0' && *fmt <= '9') fmt++; continue;
+        case 'x': *ispadding = true; size = 1; break;
+        case 'b': *issigned = true; size = 1; break;
+        case 'B': size = 1; break;
+        case 'h': *issigned = true; size = 2; break;
+        case 'H': size = 2; break;
+        case 'l': case 'j': *issigned = true; size = 8; break;
+        case 'L': case 'J': size = 8; break;
+        case 'i': case 'I':
+            *issigned = c == 'i';
+            size = 4;
+            if(*fmt >= '0' && *fmt <= '9')
+            {
+                size = 0;
+                while(*fmt >= '0' && *fmt <= '9') size = size * 10 + (*fmt++ - '0');
+            }
+            break;
+        default: size = -1; break;
+        }
+        *pfmt = fmt;
+        return size < 1 || size > 8 ? -1 : size;
+    }
+    *pfmt = fmt;
+    return 0;
+}
+
+// function string.pack(fmt, v1, v2, ...), only for integers
+static int compat_pack(lua_State *L)
+{
+    const char *fmt = luaL_checkstring(L, 1);
+    bool little = compat_islittle(), issigned, ispadding;
+    int arg = 2, size = 0;
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    while((size = compat_packitem(&fmt, &little, &issigned, &ispadding)) > 0)
+    {
+        uint8_t bytes[8] = {0};
+        if(!ispadding)
+        {
+            lua_Number x = luaL_checknumber(L, arg++);
+            uint64_t v = x < 0 ? (uint64_t)(int64_t)x : (uint64_t)x;
+            for(int k=0; k < size; k++) bytes[little ? k : size - 1 - k] = (uint8_t)(v >> (8 * k));
+        }
+        luaL_addlstring(&b, (const char*)bytes, size);
+    }
+    if(size < 0) return luaL_error(L, "string.pack, only integer formats in luajit");
+    luaL_pushresult(&b);
+    return 1;
+}
+
+// function string.unpack(fmt, s, pos), only for integers
+static int compat_unpack(lua_State *L)
+{
+    const char *fmt = luaL_checkstring(L, 1);
+    size_t n = 0;
+    const uint8_t *s = (const uint8_t*)luaL_checklstring(L, 2, &n);
+    size_t pos = (size_t)luaL_optinteger(L, 3, 1) - 1;
+    bool little = compat_islittle(), issigned, ispadding;
+    int nresult = 0, size = 0;
+    while((size = compat_packitem(&fmt, &little, &issigned, &ispadding)) > 0)
+    {
+        if(pos > n || n - pos < (size_t)size) return luaL_error(L, "string.unpack, data string too short");
+        if(!ispadding)
+        {
+            uint64_t v = 0;
+            for(int k=0; k < size; k++) v |= (uint64_t)s[pos + (little ? k : size - 1 - k)] << (8 * k);
+            if(issigned && size < 8 && (v >> (8 * size - 1) & 1)) v |= ~(uint64_t)0 << (8 * size);
+            luaL_checkstack(L, 2, "string.unpack, too many results");
+            lua_pushnumber(L, issigned ? (lua_Number)(int64_t)v : (lua_Number)v);
+            nresult++;
+        }
+        pos += size;
+    }
+    if(size < 0) return luaL_error(L, "string.unpack, only integer formats in luajit");
+    lua_pushinteger(L, pos + 1);
+    return nresult + 1;
+}
+
+// function math.tointeger(x)
+static int compat_tointeger_lua(lua_State *L)
+{
+    if(lua_isinteger(L, 1)) lua_pushvalue(L, 1);
+    else lua_pushnil(L);
+    return 1;
+}
+
+void luacompat_open(lua_State *L)
+{
+    lua_getglobal(L, "string");
+    lua_pushcfunction(L, compat_pack);
+    lua_setfield(L, -2, "pack");
+    lua_pushcfunction(L, compat_unpack);
+    lua_setfield(L, -2, "unpack");
+    lua_pop(L, 1);
+    lua_getglobal(L, "table");
+    lua_getglobal(L, "unpack");
+    lua_setfield(L, -2, "unpack");
+    lua_pop(L, 1);
+    lua_getglobal(L, "math");
+    lua_pushcfunction(L, compat_tointeger_lua);
+    lua_setfield(L, -2, "tointeger");
+    lua_pop(L, 1);
+    if(luaL_dostring(L, s_compat_runtime) != LUA_OK) lua_pop(L, 1);
+}
+
+int luacompat_loadstring(lua_State *L, const char *s)
+{
+    int res = luaL_loadstring(L, s);
+    if(res == LUA_ERRSYNTAX) // the error of the script is kept if rewriting fails
+    {
+        int top = lua_gettop(L);
+        if(luaL_loadstring(L, s_compat_rewrite) == LUA_OK && lua_pcall(L, 0, 1, 0) == LUA_OK)
+        {
+            lua_pushstring(L, s);
+            if(lua_pcall(L, 1, 1, 0) == LUA_OK && luaL_loadstring(L, lua_tostring(L, -1)) == LUA_OK)
+            {
+                lua_replace(L, top); // the loaded chunk in place of the error
+                res = LUA_OK;
+            }
+        }
+        lua_settop(L, top);
+    }
+    return res;
+}
+
+#endif
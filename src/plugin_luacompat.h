@@ -0,0 +1,92 @@
+/**
+ * compatible layer to host the lua plugins on luajit
+ *   developed by devseed
+ *
+ *  luajit has the lua 5.1 api with numbers in double, the 5.3/5.4 api used by the host are shimmed here,
+ *  string.pack, string.unpack (only integers), table.unpack, math.tointeger and the integer operators
+ *  for plugins are in plugin_luacompat.c
+ */
+
+#ifndef _PLUGIN_LUACOMPAT_H
+#define _PLUGIN_LUACOMPAT_H
+#ifdef USE_LUAJIT
+#include <stdint.h>
+#include <luajit.h>
+
+#define LUA_BACKEND LUAJIT_VERSION
+
+#ifndef LUA_OK
+#define LUA_OK 0
+#endif
+
+#ifndef luaL_newlib
+#define luaL_newlib(L, l) (lua_newtable(L), luaL_setfuncs(L, l, 0))
+#endif
+
+// the number with integer value, as string is not an integer in 5.4
+static inline int compat_isinteger(lua_State *L, int idx)
+{
+    if(lua_type(L, idx) != LUA_TNUMBER) return 0;
+    lua_Number n = lua_tonumber(L, idx);
+    return n >= -9.2e18 && n <= 9.2e18 && n == (lua_Number)(int64_t)n;
+}
+#define lua_isinteger compat_isinteger
+
+// lua_Integer is ptrdiff_t, through int64_t to keep the low bits of pixel on 32-bit
+static inline lua_Integer compat_tointeger(lua_State *L, int idx)
+{
+    return (lua_Integer)(int64_t)lua_tonumber(L, idx);
+}
+#define lua_tointeger compat_tointeger
+
+// lua_Integer is 32-bit on 32-bit luajit, so the unsigned 32-bit values are pushed as double
+static inline void compat_pushinteger(lua_State *L, int64_t n)
+{
+    lua_pushnumber(L, (lua_Number)n);
+}
+#define lua_pushinteger compat_pushinteger
+
+static inline void compat_seti(lua_State *L, int idx, lua_Integer n)
+{
+    lua_rawseti(L, idx, (int)n);
+}
+#define lua_seti compat_seti
+
+static inline const char *compat_tolstring(lua_State *L, int idx, size_t *len)
+{
+    if(idx < 0 && idx > LUA_REGISTRYINDEX) idx = lua_gettop(L) + idx + 1;
+    lua_getglobal(L, "tostring");
+    lua_pushvalue(L, idx);
+    lua_call(L, 1, 1);
+    return lua_tolstring(L, -1, len);
+}
+#define luaL_tolstring compat_tolstring
+
+static inline void compat_requiref(lua_State *L, const char *modname, lua_CFunction openf, int glb)
+{
+    lua_pushcfunction(L, openf);
+    lua_pushstring(L, modname);
+    lua_call(L, 1, 1);
+    lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+    lua_pushvalue(L, -2);
+    lua_setfield(L, -2, modname);
+    lua_pop(L, 1);
+    if(glb)
+    {
+        lua_pushvalue(L, -1);
+        lua_setglobal(L, modname);
+    }
+}
+#define luaL_requiref compat_requiref
+
+void luacompat_open(lua_State *L); // the 5.4 functions and memview(p) by ffi, after luaL_openlibs
+int luacompat_loadstring(lua_State *L, const char *s); // luaL_loadstring, rewrite the 5.4 operators if needed
+#define luacompat_dump(L, writer, data) lua_dump(L, writer, data) // the chunk is kept with debug info
+
+#else
+#define LUA_BACKEND LUA_RELEASE
+#define luacompat_open(L)
+#define luacompat_loadstring luaL_loadstring
+#define luacompat_dump(L, writer, data) lua_dump(L, writer, data, 0)
+#endif
+#endif
@@ -5,15 +5,22 @@
 
 #include <wx/wx.h>
 #include <wx/progdlg.h>
+#include <wx/thread.h>
 extern  "C" {
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
+#include "plugin_luacompat.h"
 }
 
 // function ui.msgbox(msg, caption, style)
 static int capi_ui_msgbox(lua_State *L)
 {
+    if(!wxThread::IsMain()) // the plugin decodes on the worker, no dialogs
+    {
+        lua_pushnil(L);
+        return 1;
+    }
     wxString msg;
     wxString caption;
     long style = 5;
@@ -32,6 +39,11 @@ static int capi_ui_msgbox(lua_State *L)
 // function  ui.progress_new(title, message, maximum, style)
 static int capi_ui_progress_new(lua_State *L)
 {
+    if(!wxThread::IsMain()) // the plugin decodes on the worker, no dialogs
+    {
+        lua_pushnil(L);
+        return 1;
+    }
     wxString title;
     wxString message;
     long maximum = 100;
@@ -51,6 +63,11 @@ static int capi_ui_progress_new(lua_State *L)
 // function ui.progress_update(p, value, message)
 static int capi_ui_progress_update(lua_State *L)
 {
+    if(!wxThread::IsMain()) // the plugin decodes on the worker, no dialogs
+    {
+        lua_pushnil(L);
+        return 1;
+    }
     if(lua_gettop(L) < 1 && lua_islightuserdata(L, 1)) return 0;
     auto *dlg = static_cast<wxProgressDialog*>(lua_touserdata(L, 1));
     int value = 0;
@@ -68,6 +85,11 @@ static int capi_ui_progress_update(lua_State *L)
 // function ui.progress_del(p)
 static int capi_ui_progress_del(lua_State *L)
 {
+    if(!wxThread::IsMain()) // the plugin decodes on the worker, no dialogs
+    {
+        lua_pushnil(L);
+        return 1;
+    }
     if(lua_gettop(L) < 1 && lua_islightuserdata(L, 1))
     {
         lua_pushboolean(L, false);
@@ -4,9 +4,18 @@
 #include <wx/wx.h>
 #include <wx/propgrid/propgrid.h>
 #include <wx/fswatcher.h>
+#include <wx/timer.h>
+#include <wx/stopwatch.h>
+#include <list>
+#include <unordered_map>
 #include "core.hpp"
 
 #define MAX_PLUGIN  20
+#define TILE_PAGE_SIZE 512 // page width and height on logical image
+#define TILE_PAGE_MAX 64 // 64MB for 32-bit pages
+#define TILE_UPDATE_JOB 1 // EVENT_UPDATE_TILES from the decode worker
+#define UPDATE_FRAME_MS 16 // at most one update in a frame
+#define UPDATE_DEBOUNCE_MS 200 // editors write the file several times in a save
 
 enum UI_ID
 {
@@ -24,6 +33,20 @@ enum UI_ID
     Menu_About = wxID_ABOUT
 };
 
+// dirty stages for UpdateScheduler, done in this order
+enum UPDATE_FLAG
+{
+    UPDATE_INPUT = 1 << 0, // new infile or plugin, reset the selection and decode
+    UPDATE_DECODER = 1 << 1, // reload the plugin and decode
+    UPDATE_DECODE = 1 << 2, // tilecfg or plugincfg changed
+    UPDATE_LAYOUT = 1 << 3, // tiles or nrow changed, the logical image size
+    UPDATE_STYLE = 1 << 4, // scale, boarder, autorow
+    UPDATE_NAV = 1 << 5, // the selected tile
+    UPDATE_PAINT = 1 << 6, // repaint the view only
+    UPDATE_TILECFG = 1 << 7, // tilecfg in the config window
+    UPDATE_STATUS = 1 << 8, // status bar
+};
+
 extern struct tilenav_t g_tilenav;
 extern struct tilestyle_t g_tilestyle;
 
@@ -31,15 +54,40 @@ wxDECLARE_EVENT(EVENT_UPDATE_TILES, wxCommandEvent); // tilefmt, tilenav, tilest
 wxDECLARE_EVENT(EVENT_UPDATE_STATUS, wxCommandEvent); // infile, pluginfile, ntile, (imgw, imgh)
 wxDECLARE_EVENT(EVENT_UPDATE_TILECFG, wxCommandEvent); // tilecfg
 wxDECLARE_EVENT(EVENT_UPDATE_TILENAV, wxCommandEvent); // tilenav
-#define NOTIFY_UPDATE_TILES() wxPostEvent(wxGetApp().m_tilewindow, wxCommandEvent(EVENT_UPDATE_TILES))
-#define NOTIFY_UPDATE_STATUS() wxPostEvent(wxGetApp().GetTopWindow(), wxCommandEvent(EVENT_UPDATE_STATUS))
-#define NOTIFY_UPDATE_TILECFG() wxPostEvent(wxGetApp().m_configwindow, wxCommandEvent(EVENT_UPDATE_TILECFG))
-#define NOTIFY_UPDATE_TILENAV() wxPostEvent(wxGetApp().m_configwindow, wxCommandEvent(EVENT_UPDATE_TILENAV))
+#define SCHEDULE_UPDATE(flags) do { if(wxGetApp().m_scheduler) wxGetApp().m_scheduler->Schedule(flags); } while(0)
+#define NOTIFY_UPDATE_TILES() SCHEDULE_UPDATE(UPDATE_LAYOUT)
+#define NOTIFY_UPDATE_JOB() do { wxCommandEvent event(EVENT_UPDATE_TILES); \
+    event.SetInt(TILE_UPDATE_JOB); wxPostEvent(wxGetApp().m_tilewindow, event); } while(0)
+#define NOTIFY_UPDATE_STATUS() SCHEDULE_UPDATE(UPDATE_STATUS)
+#define NOTIFY_UPDATE_TILECFG() SCHEDULE_UPDATE(UPDATE_TILECFG)
+#define NOTIFY_UPDATE_TILENAV() SCHEDULE_UPDATE(UPDATE_NAV)
+
+// coalesce the updates from events into one pass in a frame, only the dirty stages are done
+class UpdateScheduler : public wxEvtHandler
+{
+public:
+    UpdateScheduler();
+    void Schedule(int flags); // any thread, run at the next frame
+    void ScheduleLater(int flags, int ms = UPDATE_DEBOUNCE_MS); // restart the delay for each call
+
+private:
+    void Run();
+    void OnTimer(wxTimerEvent& event);
+
+    int m_flags, m_delayed;
+    bool m_pending;
+    wxTimer m_frametimer, m_delaytimer;
+    wxStopWatch m_lastrun;
+    wxDECLARE_EVENT_TABLE();
+};
 
 class TopFrame : public wxFrame
 {
 public:
     TopFrame();
+    ~TopFrame();
+    void UpdateStatus();
+    UpdateScheduler m_scheduler;
 
 private:
     void OnFileSystemEvent(wxFileSystemWatcherEvent &event);
@@ -69,8 +117,9 @@ private:
 class ConfigWindow : public wxPanel
 {
 public:
-    void LoadTilecfg(struct tilecfg_t &cfg);
-    void SaveTilecfg(struct tilecfg_t &cfg);
+    void LoadTilecfg(struct tilecfg64_t &cfg);
+    void SaveTilecfg(struct tilecfg64_t &cfg);
+    void LoadTilenav(struct tilenav_t &nav);
     void SetPlugincfg(wxString &text);
     wxString GetPlugincfg();
     wxString GetPluginparam();
@@ -86,6 +135,24 @@ private:
     wxDECLARE_EVENT_TABLE();
 };
 
+// composed pages of the logical image, evict the least recently used
+class TilePageCache
+{
+public:
+    TilePageCache(size_t maxpage = TILE_PAGE_MAX);
+    wxBitmap Get(size_t col, size_t row, const wxSize& imgsize, size_t nrow, bool *composed = nullptr); // compose if not cached
+    void Clear();
+    void Invalidate(size_t y0, size_t y1); // drop the pages overlapping logical rows [y0, y1)
+    void Reserve(size_t npage) { m_reserve = npage; } // keep at least the visible pages
+    size_t GetCount() const { return m_pages.size(); }
+
+private:
+    typedef std::list<std::pair<uint64_t, wxBitmap>> PageList;
+    PageList m_pages; // front is the most recent
+    std::unordered_map<uint64_t, PageList::iterator> m_index;
+    size_t m_maxpage, m_reserve;
+};
+
 class TileWindow;
 class TileView: public wxScrolledWindow
 {
@@ -97,19 +164,23 @@ public:
     int DeScaleV(int val);
     wxSize DeScaleV(const wxSize &val);
     bool ScrollPos(int x, int y, enum wxOrientation orient=wxBOTH); // the pos in logical bitmap
+    void InvalidateTiles(size_t first, size_t count); // tiles are decoded after their pages composed
+    static bool BenchmarkRender(TileSolver& solver); // blit for each tile as the old render, against the composed pages
 
     TileView(wxWindow *parent);
-    wxBitmap m_bitmap; // logical bitmap, as double frame buffer, dynamicly blit when OnDraw
-    float m_scale = 1.f; // bitmap scale to window
+    wxSize m_imgsize; // logical image size, tiles are placed by (index -> row, col) when OnDraw
+    float m_scale = 1.f; // logical image scale to window
+    TilePageCache m_pages; // cleared when tiles or layout change
+    int m_lastlogicy = 0; // for the scroll direction to prefetch
 
 private:
     friend class TileWindow;
-    bool PreRender(); // try to get logical bitmap pre render
-    int PreRow(); // auto set nrow to fit the window on logical bitmap
-    bool PreBoarder(); // draw boarders for every tiles on logical bitmap
-    bool PreStyle();  // draw all the tile styles
+    bool PreRender(); // get the logical image size from the tile layout
+    int PreRow(); // auto set nrow to fit the window on logical image
+    bool PreStyle();  // apply all the tile styles
+    void DrawBoarder(wxDC& dc, const wxRect& rect); // draw boarders for the tiles in logical rect
 
-    virtual void OnDraw(wxDC& dc) wxOVERRIDE; // blit logical bitmap to window
+    virtual void OnDraw(wxDC& dc) wxOVERRIDE; // draw the visible pages to window
     void OnMouseLeftDown(wxMouseEvent& event);
     void OnMouseWheel(wxMouseEvent& event);
     void OnKeyDown(wxKeyEvent& event);
@@ -122,6 +193,8 @@ class TileWindow: public wxPanel
 {
 public:
     TileWindow(wxWindow *parent);
+    ~TileWindow();
+    void UpdateView(int flags); // UPDATE_FLAG stages of the view
     TileView* m_view;
 
 private:
@@ -130,6 +203,50 @@ private:
     wxDECLARE_EVENT_TABLE();
 };
 
+// the solver events to the windows, the solver itself has no gui
+class SolverListener : public TileListener
+{
+public:
+    virtual void OnError(const wxString& msg, const wxString& title) wxOVERRIDE;
+    virtual void OnPluginLoad(const wxString& plugincfg) wxOVERRIDE;
+    virtual wxString OnPluginConfig(const wxString& plugincfg) wxOVERRIDE;
+    virtual void OnTilecfg(const struct tilecfg64_t& cfg) wxOVERRIDE;
+    virtual void OnJob() wxOVERRIDE;
+};
+
+class MainApp : public wxApp
+{
+public:
+    MainApp() : m_cli(m_tilesolver) {}
+    int SearchPlugins(wxString dirpath);
+    bool Gui(wxString cmdstr = *wxEmptyString);
+
+    // window
+    TileWindow *m_tilewindow = nullptr;
+    ConfigWindow *m_configwindow = nullptr;
+    wxLogWindow *m_logwindow = nullptr;
+
+    // for solve tile
+    int m_pluginindex;
+    wxVector<wxFileName> m_pluginfiles;
+    TileSolver m_tilesolver;
+    SolverListener m_listener;
+    TileCli m_cli; // options, and the decoding for --nogui
+    bool m_usegui;
+
+    // others
+    void* m_filewatcher = nullptr;
+    UpdateScheduler *m_scheduler = nullptr; // owned by the top frame
+
+private:
+    virtual bool OnInit() wxOVERRIDE;
+    virtual void OnInitCmdLine(wxCmdLineParser& parser) wxOVERRIDE;
+    virtual bool OnCmdLineParsed(wxCmdLineParser& parser) wxOVERRIDE;
+    virtual void OnEventLoopEnter(wxEventLoopBase *loop) wxOVERRIDE;
+};
+
+wxDECLARE_APP(MainApp);
+
 inline bool reset_tilenav(struct tilenav_t *nav)
 {
     if(!nav) return false;
@@ -137,11 +254,13 @@ inline bool reset_tilenav(struct tilenav_t *nav)
     return true;
 }
 
-inline bool sync_tilenav(struct tilenav_t *nav, struct tilecfg_t *cfg)
+inline bool sync_tilenav(struct tilenav_t *nav, struct tilecfg64_t *cfg)
 {
     if(!nav || !cfg) return false;
-    size_t nrow = cfg->nrow;
-    size_t nbytes = calc_tile_nbytes(&cfg->fmt);
+    int64_t nrow = cfg->nrow;
+    int64_t nbytes = calc_tile_nbytes(&cfg->fmt);
+    int64_t start = (int64_t)cfg->start;
+    int64_t size = (int64_t)cfg->size;
 
     if(!nrow || !cfg->w || !cfg->h || !cfg->bpp)
     {
@@ -152,32 +271,32 @@ inline bool sync_tilenav(struct tilenav_t *nav, struct tilecfg_t *cfg)
 sync_tile_disp_start: 
     if(nav->index < 0 && nav->offset < 0)
     {
-        nav->index = nav->y / cfg->h * nrow  + nav->x / cfg->w;
-        int offset = nav->index * nbytes;
-        nav->offset = offset + cfg->start;
+        nav->index = (int64_t)(nav->y / cfg->h) * nrow  + nav->x / cfg->w;
+        int64_t offset = nav->index * nbytes;
+        nav->offset = offset + start;
     }
     else
     {
         if(nav->index < 0) // offset -> idx
         {
-            int offset = nav->offset - cfg->start;
+            int64_t offset = nav->offset - start;
             nav->index = offset / nbytes;
         }
         else if(nav->offset < 0) // idx -> offset
         {
-            int offset = nav->index * nbytes;
-            nav->offset = offset + cfg->start;
+            int64_t offset = nav->index * nbytes;
+            nav->offset = offset + start;
         }
-        nav->x = (nav->index % nrow) * cfg->w;
-        nav->y = (nav->index / nrow) * cfg->h;
+        nav->x = (int)((nav->index % nrow) * cfg->w);
+        nav->y = (int)((nav->index / nrow) * cfg->h);
     }
 
-    if(cfg->size > 0 && nbytes <= cfg->size && nav->offset + nbytes > cfg->size + cfg->start)
+    if(size > 0 && nbytes <= size && nav->offset + nbytes > size + start)
     {
-        int n = cfg->size / nbytes;
+        int64_t n = size / nbytes;
         if(n <= 0) n = 1;
         nav->index = -1;
-        nav->offset = cfg->start + (n -1) * nbytes;
+        nav->offset = start + (n -1) * nbytes;
         goto sync_tile_disp_start;
     }
     return true;
@@ -11,7 +11,7 @@
 #include "ui.hpp"
 #include "core.hpp"
 
-extern struct tilecfg_t g_tilecfg;
+extern struct tilecfg64_t g_tilecfg;
 extern struct tilenav_t g_tilenav;
 
 wxDEFINE_EVENT(EVENT_UPDATE_TILECFG, wxCommandEvent);
@@ -22,73 +22,23 @@ wxBEGIN_EVENT_TABLE(ConfigWindow, wxWindow)
     EVT_COMMAND(wxID_ANY, EVENT_UPDATE_TILENAV, ConfigWindow::OnUpdateTilenav)
 wxEND_EVENT_TABLE()
 
-void SetTilecfg(wxString& text, struct tilecfg_t &cfg)
+// the 64-bit values are stored as wxULongLong in property
+static void SetPropertyU64(wxPropertyGrid *pg, const wxString& name, uint64_t value)
 {
-    cJSON *root = cJSON_Parse(text.mb_str());
-    if(root)
-    {
-        const cJSON* prop = cJSON_GetObjectItem(root, "tilecfg");
-        const cJSON* v = nullptr;
-        v = cJSON_GetObjectItem(prop, "start"); if(v) cfg.start = v->valueint;
-        v = cJSON_GetObjectItem(prop, "size"); if(v) cfg.size = v->valueint;
-        v = cJSON_GetObjectItem(prop, "nrow"); if(v) cfg.nrow = v->valueint;
-        v = cJSON_GetObjectItem(prop, "w"); if(v) cfg.w = v->valueint;
-        v = cJSON_GetObjectItem(prop, "h"); if(v) cfg.h = v->valueint;
-        v = cJSON_GetObjectItem(prop, "bpp"); if(v) cfg.bpp = v->valueint;
-        v = cJSON_GetObjectItem(prop, "nbytes"); if(v) cfg.nbytes = v->valueint;
-        cJSON_Delete(root);
-    }
+    pg->SetPropertyValue(name, wxVariant(wxULongLong(value)));
 }
 
-/**
- * override json value by text2
- * @param jtext1 json text
- * @param jtext2 {"name1": value1, "name2": value2}
- */
-void OverridePluginCfg(wxString& jtext1, wxString& jtext2)
+static uint64_t GetPropertyU64(const wxVariant& variant)
 {
-    if(!jtext1.Length() || !jtext2.Length()) return;
-
-    jtext2.Replace('\'', '"');
-    cJSON *root1 = cJSON_Parse(jtext1.mb_str());
-    if(!root1) return;
-    cJSON *root2 = cJSON_Parse(jtext2.mb_str());
-    if(!root2) {cJSON_Delete(root1); return;}
-
-    const cJSON* prop;
-    const cJSON* props = cJSON_GetObjectItem(root1, "plugincfg");
-    cJSON_ArrayForEach(prop, props)
-    {
-        const cJSON* name = cJSON_GetObjectItem(prop, "name");
-        const cJSON* type = cJSON_GetObjectItem(prop, "type");
-        cJSON* value = cJSON_GetObjectItem(prop, "value");
-        if(!name) continue;
-        if(!type) continue;
-
-        const cJSON* value2 = cJSON_GetObjectItem(root2, name->valuestring);
-        if(!value2) continue;
-        if(!strcmp(type->valuestring, "string"))
-        {
-            cJSON_SetValuestring(value, value2->valuestring);
-        }
-        else
-        {
-            value->type = value2->type;
-            value->valuedouble = value2->valuedouble;
-            value->valueint = value2->valueint;
-        }
-    }
-    jtext1.Clear();
-    jtext1.Append(cJSON_PrintUnformatted(root1));
-
-    cJSON_Delete(root1);
-    cJSON_Delete(root2);
+    wxULongLong value;
+    if(!variant.Convert(&value)) return 0;
+    return value.GetValue();
 }
 
-void ConfigWindow::LoadTilecfg(struct tilecfg_t &cfg)
+void ConfigWindow::LoadTilecfg(struct tilecfg64_t &cfg)
 {
-    m_pg->SetPropertyValue("tilecfg.start", (long)cfg.start);
-    m_pg->SetPropertyValue("tilecfg.size", (long)cfg.size);
+    SetPropertyU64(m_pg, "tilecfg.start", cfg.start);
+    SetPropertyU64(m_pg, "tilecfg.size", cfg.size);
     m_pg->SetPropertyValue("tilecfg.nrow", (long)cfg.nrow);
     m_pg->SetPropertyValue("tilecfg.w", (long)cfg.w);
     m_pg->SetPropertyValue("tilecfg.h", (long)cfg.h);
@@ -96,10 +46,10 @@ void ConfigWindow::LoadTilecfg(struct tilecfg_t &cfg)
     m_pg->SetPropertyValue("tilecfg.nbytes", (long)cfg.nbytes);
 }
 
-void ConfigWindow::SaveTilecfg(struct tilecfg_t &cfg)
+void ConfigWindow::SaveTilecfg(struct tilecfg64_t &cfg)
 {
-    cfg.start = m_pg->GetPropertyValue("tilecfg.start").GetLong();
-    cfg.size = m_pg->GetPropertyValue("tilecfg.size").GetLong();
+    cfg.start = GetPropertyU64(m_pg->GetPropertyValue("tilecfg.start"));
+    cfg.size = GetPropertyU64(m_pg->GetPropertyValue("tilecfg.size"));
     cfg.nrow = m_pg->GetPropertyValue("tilecfg.nrow").GetLong();
     cfg.w = m_pg->GetPropertyValue("tilecfg.w").GetLong();
     cfg.h = m_pg->GetPropertyValue("tilecfg.h").GetLong();
@@ -264,6 +214,19 @@ ConfigWindow::ConfigWindow(wxWindow* parent)
     pg->SetPropertyHelpString("tilenav.offset", "current selected tile offset in file");
     pg->SetPropertyHelpString("tilenav.index", "current selected tile index");
 
+    // solvercfg
+    auto solvercfg = new wxPropertyCategory("solvercfg");
+    pg->Append(solvercfg);
+    pg->AppendIn(solvercfg, new wxUIntProperty("nthread", wxPG_LABEL, wxGetApp().m_tilesolver.m_nthread));
+    pg->SetPropertyHelpString("solvercfg.nthread", wxString::Format(
+        "threads for reentrant decoders (0 for all %zu hardware threads)", TilePool::GetHardwareThreads()));
+    pg->AppendIn(solvercfg, new wxBoolProperty("lazy", wxPG_LABEL, wxGetApp().m_tilesolver.m_lazy));
+    pg->SetPropertyHelpString("solvercfg.lazy", "decode tiles only when they are shown or saved");
+    pg->AppendIn(solvercfg, new wxUIntProperty("prefetch", wxPG_LABEL, wxGetApp().m_tilesolver.m_prefetch));
+    pg->SetPropertyHelpString("solvercfg.prefetch", "tile rows to decode ahead of the scroll direction in lazy mode");
+    pg->AppendIn(solvercfg, new wxUIntProperty("cachesize", wxPG_LABEL, wxGetApp().m_tilesolver.m_cachesize >> 20));
+    pg->SetPropertyHelpString("solvercfg.cachesize", "MB of decoded tiles kept for recent configs (0 to disable)");
+
     // plugincfg
     auto plugincfg = new wxPropertyCategory("plugincfg");
     pg->Append(plugincfg);
@@ -275,11 +238,10 @@ void ConfigWindow::OnPropertyGridChanged(wxPropertyGridEvent& event)
     if(prop->GetParent()->GetName() == "tilecfg")
     {
         SaveTilecfg(g_tilecfg);
-        
-        if(prop->GetName()=="nrow") // only render when change nrow
+        int flags = UPDATE_LAYOUT;
+        if(prop->GetName()=="nrow") // only the layout changes, repaint the view
         {
-            wxGetApp().m_tilesolver.m_tilecfg.nrow =  g_tilecfg.nrow;
-            wxGetApp().m_tilesolver.Render();
+            if(!wxGetApp().m_tilesolver.IsBusy()) wxGetApp().m_tilesolver.m_tilecfg.nrow =  g_tilecfg.nrow;
         }
         else // decode all tiles when setting tilecfg
         {
@@ -317,42 +279,59 @@ void ConfigWindow::OnPropertyGridChanged(wxPropertyGridEvent& event)
                     LoadTilecfg(g_tilecfg);
                 }
             }            
-            wxGetApp().m_tilesolver.Decode(&g_tilecfg);
+            flags = UPDATE_DECODE; // cancel the previous decoding
         }
         g_tilenav.offset = -1; // prevent nrow chnages
         sync_tilenav(&g_tilenav, &g_tilecfg); 
-        NOTIFY_UPDATE_TILES(); // notify tilecfg
+        SCHEDULE_UPDATE(flags); // notify tilecfg
     }
     else if(prop->GetParent()->GetName() == "tilenav") 
     {
         if(prop->GetName()=="offset")
         {
             g_tilenav.index = -1;
-            g_tilenav.offset = prop->GetValue().GetLong();
+            g_tilenav.offset = (int64_t)GetPropertyU64(prop->GetValue());
         }
         else if(prop->GetName()=="index")
         {
             g_tilenav.offset = -1;
-            g_tilenav.index = prop->GetValue().GetLong();
+            g_tilenav.index = (int64_t)GetPropertyU64(prop->GetValue());
         }
         sync_tilenav(&g_tilenav, &g_tilecfg);
         if(wxGetApp().m_tilesolver.DecodeOk())
         {
-            auto ntiles =wxGetApp().m_tilesolver.m_tiles.size(); // make sure not larger than file
-            g_tilenav.index = wxMin<size_t>(g_tilenav.index, ntiles - 1);
+            auto ntiles =wxGetApp().m_tilesolver.GetTileCount(); // make sure not larger than file
+            g_tilenav.index = wxMin<int64_t>(g_tilenav.index, (int64_t)ntiles - 1);
             sync_tilenav(&g_tilenav, &g_tilecfg);
         }
 
-        NOTIFY_UPDATE_TILENAV();
         g_tilenav.scrollto = true; 
-        NOTIFY_UPDATE_TILES(); // notify tilenav
+        SCHEDULE_UPDATE(UPDATE_NAV); // notify tilenav, no need to layout
+    }
+    else if(prop->GetParent()->GetName() == "solvercfg")
+    {
+        if(prop->GetName()=="nthread") // applied at next decode
+        {
+            wxGetApp().m_tilesolver.m_nthread = (size_t)prop->GetValue().GetLong();
+        }
+        else if(prop->GetName()=="lazy") // applied at next decode
+        {
+            wxGetApp().m_tilesolver.m_lazy = prop->GetValue().GetBool();
+        }
+        else if(prop->GetName()=="prefetch")
+        {
+            wxGetApp().m_tilesolver.m_prefetch = (size_t)prop->GetValue().GetLong();
+        }
+        else if(prop->GetName()=="cachesize") // applied at next decode
+        {
+            wxGetApp().m_tilesolver.m_cachesize = ((size_t)prop->GetValue().GetLong() << 20);
+        }
     }
     else if(prop->GetParent()->GetName() == "plugincfg")
     {
-        wxGetApp().m_tilesolver.Decode(&g_tilecfg);
         g_tilenav.offset = -1; // prevent nrow chnages
         sync_tilenav(&g_tilenav, &g_tilecfg); 
-        NOTIFY_UPDATE_TILES(); // notify tilecfg
+        SCHEDULE_UPDATE(UPDATE_DECODE); // cancel the previous decoding
     }  
     wxLogMessage(wxString::Format("[ConfigWindow::OnPropertyGridChanged] %s.%s=%s", 
         prop->GetParent()->GetName(), prop->GetName(), prop->GetValue().MakeString()));
@@ -365,6 +344,11 @@ void ConfigWindow::OnUpdateTilecfg(wxCommandEvent &event)
 
 void ConfigWindow::OnUpdateTilenav(wxCommandEvent &event)
 {
-    m_pg->SetPropertyValue("tilenav.index", (long)g_tilenav.index);
-    m_pg->SetPropertyValue("tilenav.offset", (long)g_tilenav.offset);
+    LoadTilenav(g_tilenav);
+}
+
+void ConfigWindow::LoadTilenav(struct tilenav_t &nav)
+{
+    SetPropertyU64(m_pg, "tilenav.index", (uint64_t)wxMax<int64_t>(nav.index, 0));
+    SetPropertyU64(m_pg, "tilenav.offset", (uint64_t)wxMax<int64_t>(nav.offset, 0));
 }
\ No newline at end of file
@@ -6,9 +6,43 @@
 #include <wx/wx.h>
 #include <wx/filefn.h>
 #include <wx/filename.h>
+#include <wx/filedlgcustomize.h>
 #include "ui.hpp"
 #include "core.hpp"
 
+// the png options under the save dialog
+class SaveDialogHook : public wxFileDialogCustomizeHook
+{
+public:
+    SaveDialogHook(enum IMAGE_PROFILE profile, bool palette)
+        : m_profile(profile), m_palette(palette) {}
+
+    void AddCustomControls(wxFileDialogCustomize& customizer) override
+    {
+        wxString names[IMAGE_PROFILE_COUNT];
+        for(int i=0; i < IMAGE_PROFILE_COUNT; i++) names[i] = g_image_profile_names[i];
+        customizer.AddStaticText("png compression");
+        m_choice = customizer.AddChoice(IMAGE_PROFILE_COUNT, names);
+        m_choice->SetSelection(m_profile);
+        m_checkbox = customizer.AddCheckBox("indexed png for no more than 256 colors");
+        m_checkbox->SetValue(m_palette);
+    }
+
+    void TransferDataFromCustomControls() override
+    {
+        int i = m_choice->GetSelection();
+        if(i >= 0) m_profile = (enum IMAGE_PROFILE)i;
+        m_palette = m_checkbox->GetValue();
+    }
+
+    enum IMAGE_PROFILE m_profile;
+    bool m_palette;
+
+private:
+    wxFileDialogCustomChoice *m_choice = nullptr;
+    wxFileDialogCustomCheckBox *m_checkbox = nullptr;
+};
+
 wxBEGIN_EVENT_TABLE(MainMenuBar, wxWindow)
     EVT_MENU(Menu_Open, MainMenuBar::OnOpen)
     EVT_MENU(Menu_Close,  MainMenuBar::OnClose)
@@ -97,19 +131,8 @@ void MainMenuBar::OnOpen(wxCommandEvent& WXUNUSED(event))
     wxLogMessage("[MainMenuBar::OnOpen] open %s", inpath);
     
     wxGetApp().m_tilesolver.Close();
-    if(!wxGetApp().m_tilesolver.Open(inpath)) goto menu_open_failed;
-    if(!wxGetApp().m_tilesolver.Decode(&g_tilecfg)) goto menu_open_failed;
-    
-    reset_tilenav(&g_tilenav);
-    NOTIFY_UPDATE_TILENAV();
-    NOTIFY_UPDATE_TILES(); // notify all
-    return;
-
-menu_open_failed:
-    // wxMessageBox(wxString::Format("open %s failed !", inpath), "error", wxICON_ERROR);
-    reset_tilenav(&g_tilenav);
-    NOTIFY_UPDATE_TILENAV();
-    NOTIFY_UPDATE_TILES(); // notify all
+    wxGetApp().m_tilesolver.Open(inpath); // nothing to decode if failed
+    SCHEDULE_UPDATE(UPDATE_INPUT); // notify all
 }
 
 void MainMenuBar::OnClose(wxCommandEvent& WXUNUSED(event))
@@ -125,14 +148,20 @@ void MainMenuBar::OnSave(wxCommandEvent& WXUNUSED(event))
     wxString defaultName = wxString::Format("%s_%d_%d_%d", 
         wxGetApp().m_tilesolver.m_infile.GetName(), g_tilecfg.w, g_tilecfg.h, g_tilecfg.nrow);
     wxFileDialog filedialog(this, "Save tile decode image", "", defaultName,
-        "png files (*.png)|*.png|bmp files (*.bmp)|*.bmp",  
+        "png files (*.png)|*.png|bmp files (*.bmp)|*.bmp|pam files (*.pam)|*.pam|ppm files (*.ppm)|*.ppm|"
+        "raw rgba files (*.raw)|*.raw|idx files with json palette (*.idx)|*.idx",  
         wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+    auto& solver = wxGetApp().m_tilesolver;
+    SaveDialogHook hook(solver.m_saveprofile, solver.m_savepalette);
+    filedialog.SetCustomizeHook(hook);
     if(filedialog.ShowModal()==wxID_CANCEL) return;
     
     wxString outpath = filedialog.GetPath();
-    wxLogMessage("[MainMenuBar::OnSave] open %s", outpath);
+    solver.m_saveprofile = hook.m_profile;
+    solver.m_savepalette = hook.m_palette;
+    wxLogMessage("[MainMenuBar::OnSave] open %s, %s", outpath, g_image_profile_names[hook.m_profile]);
 
-    bool res = wxGetApp().m_tilesolver.Save(outpath);
+    bool res = solver.Save(outpath);
     if (!res)
     {
         wxMessageBox(wxString::Format("save %s failed !", outpath), "error", wxICON_ERROR);
@@ -148,17 +177,8 @@ void MainMenuBar::OnPlugin(wxCommandEvent& event)
     wxLogMessage("[MainMenuBar::OnPlugin] change plugin index to %i (%s)", 
         pluginidx, pluginfile.GetFullName());
     wxGetApp().m_tilesolver.UnloadDecoder();
-    if(wxGetApp().m_tilesolver.Decode(&g_tilecfg, pluginfile) < 0)  goto menu_plugin_failed;
-    reset_tilenav(&g_tilenav);
-    NOTIFY_UPDATE_TILENAV();
-    NOTIFY_UPDATE_TILES(); // notify all
-    return;
-
-menu_plugin_failed:
-    // wxMessageBox(wxString::Format("plugin %s decode failed !", pluginfile.GetFullName()), "error", wxICON_ERROR);
-    reset_tilenav(&g_tilenav);
-    NOTIFY_UPDATE_TILENAV();
-    NOTIFY_UPDATE_TILES(); // notify all
+    wxGetApp().m_tilesolver.m_pluginfile = pluginfile; // reloaded when decoding
+    SCHEDULE_UPDATE(UPDATE_INPUT | UPDATE_DECODER); // notify all
 }
 
 void MainMenuBar::OnStyle(wxCommandEvent& event)
@@ -171,7 +191,7 @@ void MainMenuBar::OnStyle(wxCommandEvent& event)
     if(this->FindItem(Menu_ShowBoader)->IsChecked()) g_tilestyle.style |= TILE_STYLE_BOARDER;
     if(this->FindItem(Menu_AutoRow)->IsChecked()) g_tilestyle.style |= TILE_STYLE_AUTOROW;
 
-    NOTIFY_UPDATE_TILES(); // notify tilestyle
+    SCHEDULE_UPDATE(UPDATE_STYLE); // notify tilestyle
 }
 
 void MainMenuBar::OnScale(wxCommandEvent& event)
@@ -198,7 +218,7 @@ void MainMenuBar::OnScale(wxCommandEvent& event)
         g_tilestyle.reset_scale = true;
     }
     g_tilenav.scrollto = true;
-    NOTIFY_UPDATE_TILES(); // notify tile style
+    SCHEDULE_UPDATE(UPDATE_STYLE); // notify tile style
 }
 
 void MainMenuBar::OnAbout(wxCommandEvent& WXUNUSED(event))
@@ -227,8 +247,8 @@ void MainMenuBar::OnParam(wxCommandEvent& WXUNUSED(event))
     // tilecfg
     param += wxString::Format("--width %d --height %d --bpp %d ", g_tilecfg.w, g_tilecfg.h, g_tilecfg.bpp);
     if(g_tilecfg.nbytes > 0) param += wxString::Format("--nbytes %d ", g_tilecfg.nbytes);
-    if(g_tilecfg.start > 0) param += wxString::Format("--start %d ", g_tilecfg.start);
-    if(g_tilecfg.size > 0) param += wxString::Format("--size %d ", g_tilecfg.size);
+    if(g_tilecfg.start > 0) param += wxString::Format("--start %llu ", (unsigned long long)g_tilecfg.start);
+    if(g_tilecfg.size > 0) param += wxString::Format("--size %llu ", (unsigned long long)g_tilecfg.size);
 
     // plugincfg
     wxString plugin = wxGetApp().m_tilesolver.m_pluginfile.GetFullPath();
@@ -5,13 +5,15 @@
  */
 
 #include <cmath>
+#include <vector>
 #include <wx/wx.h>
 #include <wx/dcbuffer.h>
 #include <wx/dcmemory.h>
+#include <wx/rawbmp.h>
 #include "core.hpp"
 #include "ui.hpp"
 
-extern struct tilecfg_t g_tilecfg;
+extern struct tilecfg64_t g_tilecfg;
 extern struct tilenav_t g_tilenav;
 
 wxDEFINE_EVENT(EVENT_UPDATE_TILES, wxCommandEvent);
@@ -28,6 +30,229 @@ EVT_DROP_FILES(TileWindow::OnDropFile)
 EVT_COMMAND(wxID_ANY, EVENT_UPDATE_TILES, TileWindow::OnUpdate)
 wxEND_EVENT_TABLE()
 
+// region of the logical image -> bitmap, the solver only composes rgba pixels
+static wxBitmap compose_bitmap(TileSolver& solver, size_t x, size_t y, size_t w, size_t h, size_t nrow)
+{
+    bool opaque = solver.m_tiles.IsOpaque();
+    wxBitmap bitmap(w, h, opaque ? 24 : 32);
+    if(!bitmap.IsOk()) return wxBitmap();
+
+    // compose into a buffer, if the bitmap data has a different layout
+    std::vector<struct pixel_t> pixels;
+    auto compose = [&]() -> bool
+    {
+        pixels.resize(w * h);
+        return solver.ComposeRegion(x, y, w, h, nrow, pixels.data(), w);
+    };
+    if(opaque)
+    {
+        if(!compose()) return wxBitmap();
+        wxNativePixelData data(bitmap);
+        if(!data)
+        {
+            wxLogError("[compose_bitmap] can not access bitmap data");
+            return wxBitmap();
+        }
+        wxNativePixelData::Iterator p(data);
+        for(size_t k=0; k < h; k++)
+        {
+            const struct pixel_t *row = pixels.data() + k * w;
+            p.MoveTo(data, 0, k);
+            for(size_t i=0; i < w; i++, ++p)
+            {
+                p.Red() = row[i].r;
+                p.Green() = row[i].g;
+                p.Blue() = row[i].b;
+            }
+        }
+    }
+    else
+    {
+        typedef wxAlphaPixelData::PixelFormat AlphaFormat;
+#if defined(__WXMSW__) || defined(__WXOSX__)
+        const bool premultiplied = true;
+#else
+        const bool premultiplied = false;
+#endif
+        wxAlphaPixelData data(bitmap);
+        if(!data)
+        {
+            wxLogError("[compose_bitmap] can not access bitmap data");
+            return wxBitmap();
+        }
+        wxAlphaPixelData::Iterator origin(data);
+        uint8_t *base = (uint8_t*)origin.m_ptr;
+        int stride = data.GetRowStride();
+        bool direct = !premultiplied && AlphaFormat::BitsPerPixel == 32
+            && AlphaFormat::RED == 0 && AlphaFormat::GREEN == 1
+            && AlphaFormat::BLUE == 2 && AlphaFormat::ALPHA == 3
+            && stride > 0 && stride % sizeof(struct pixel_t) == 0;
+        if(direct) // the same layout as pixel_t, compose into bitmap
+        {
+            size_t pitch = stride / sizeof(struct pixel_t);
+            if(!solver.ComposeRegion(x, y, w, h, nrow, (struct pixel_t*)base, pitch)) return wxBitmap();
+            return bitmap;
+        }
+        if(!compose()) return wxBitmap();
+        wxAlphaPixelData::Iterator p(data);
+        for(size_t k=0; k < h; k++)
+        {
+            const struct pixel_t *row = pixels.data() + k * w;
+            p.MoveTo(data, 0, k);
+            for(size_t i=0; i < w; i++, ++p)
+            {
+                uint8_t a = row[i].a;
+                if(premultiplied && a != 255)
+                {
+                    p.Red() = row[i].r * a / 255;
+                    p.Green() = row[i].g * a / 255;
+                    p.Blue() = row[i].b * a / 255;
+                }
+                else
+                {
+                    p.Red() = row[i].r;
+                    p.Green() = row[i].g;
+                    p.Blue() = row[i].b;
+                }
+                p.Alpha() = a;
+            }
+        }
+    }
+    return bitmap;
+}
+
+bool TileView::BenchmarkRender(TileSolver& solver)
+{
+    // 1024 tiles of 64x64 in 32 columns, a 2048x2048 image as 16 pages
+    const size_t tilew = 64, tileh = 64, ntile = 1024, nrow = 32;
+    const size_t imgw = nrow * tilew, imgh = (ntile + nrow - 1) / nrow * tileh;
+    solver.m_pool.Resize(solver.m_nthread);
+    for(int opaque=0; opaque < 2; opaque++)
+    {
+        if(!solver.m_tiles.Reset(ntile, tilew, tileh, opaque))
+        {
+            wxLogError("[TileView::BenchmarkRender] can not alloc %zu tiles", ntile);
+            return false;
+        }
+        struct pixel_t *pixels = solver.m_tiles.GetData();
+        for(size_t i=0; i < ntile * tilew * tileh; i++)
+        {
+            pixels[i].d = (uint32_t)(i * 2654435761u >> 7) | (opaque ? 0xff000000 : 0);
+        }
+
+        double blitms = 0, composems = 0;
+        for(int k=0; k < 3; k++) // the best one
+        {
+            // the old render, a wxImage, a wxBitmap, a wxMemoryDC and a Blit for each tile
+            wxStopWatch sw;
+            wxBitmap bitmap(imgw, imgh);
+            if(!opaque) bitmap.UseAlpha();
+            {
+                wxMemoryDC dstdc(bitmap);
+                wxImage tileimg(tilew, tileh);
+                if(!opaque) tileimg.InitAlpha();
+                for(size_t i=0; i < ntile; i++)
+                {
+                    uint8_t *rgbdata = tileimg.GetData();
+                    uint8_t *adata = tileimg.GetAlpha();
+                    const struct pixel_t *tile = solver.m_tiles.GetTile(i);
+                    for(size_t j=0; j < tilew * tileh; j++)
+                    {
+                        memcpy(rgbdata + j * 3, &tile[j], 3);
+                        if(adata) adata[j] = tile[j].a;
+                    }
+                    auto tilebitmap = wxBitmap(tileimg);
+                    if(!opaque) tilebitmap.UseAlpha();
+                    wxMemoryDC srcdc(tilebitmap);
+                    dstdc.Blit(wxPoint((i % nrow) * tilew, (i / nrow) * tileh), wxSize(tilew, tileh), &srcdc, wxPoint(0, 0));
+                }
+            }
+            double t = sw.TimeInMicro().ToDouble() / 1000.0;
+            if(!k || t < blitms) blitms = t;
+
+            // the same image by the pages of OnDraw
+            sw.Start();
+            for(size_t y=0; y < imgh; y += TILE_PAGE_SIZE)
+            {
+                for(size_t x=0; x < imgw; x += TILE_PAGE_SIZE)
+                {
+                    auto page = compose_bitmap(solver, x, y,
+                        wxMin<size_t>(TILE_PAGE_SIZE, imgw - x), wxMin<size_t>(TILE_PAGE_SIZE, imgh - y), nrow);
+                    if(!page.IsOk()) return false;
+                }
+            }
+            t = sw.TimeInMicro().ToDouble() / 1000.0;
+            if(!k || t < composems) composems = t;
+        }
+        wxLogMessage("[TileView::BenchmarkRender] %s tile (%zux%zu), image (%zux%zu), blit each tile in %.1f ms, compose pages in %.1f ms",
+            opaque ? "opaque" : "alpha", tilew, tileh, imgw, imgh, blitms, composems);
+    }
+    solver.m_tiles.Clear();
+    return true;
+}
+
+TilePageCache::TilePageCache(size_t maxpage)
+{
+    m_maxpage = maxpage ? maxpage : 1;
+    m_reserve = 0;
+}
+
+wxBitmap TilePageCache::Get(size_t col, size_t row, const wxSize& imgsize, size_t nrow, bool *composed)
+{
+    if(composed) *composed = false;
+    uint64_t key = (uint64_t)row << 32 | (uint32_t)col;
+    auto it = m_index.find(key);
+    if(it != m_index.end())
+    {
+        m_pages.splice(m_pages.begin(), m_pages, it->second); // move to the front
+        return it->second->second;
+    }
+
+    // compose the page, the last pages in row and column can be smaller
+    size_t x = col * TILE_PAGE_SIZE;
+    size_t y = row * TILE_PAGE_SIZE;
+    if(x >= (size_t)imgsize.GetWidth() || y >= (size_t)imgsize.GetHeight()) return wxBitmap();
+    size_t w = wxMin<size_t>(TILE_PAGE_SIZE, imgsize.GetWidth() - x);
+    size_t h = wxMin<size_t>(TILE_PAGE_SIZE, imgsize.GetHeight() - y);
+    auto bitmap = compose_bitmap(wxGetApp().m_tilesolver, x, y, w, h, nrow);
+    if(!bitmap.IsOk())
+    {
+        wxLogError("[TilePageCache::Get] compose page (%zu, %zu) failed", col, row);
+        return bitmap;
+    }
+    if(composed) *composed = true;
+
+    // evict the least recently used
+    while(m_pages.size() >= wxMax<size_t>(m_maxpage, m_reserve))
+    {
+        m_index.erase(m_pages.back().first);
+        m_pages.pop_back();
+    }
+    m_pages.push_front(std::make_pair(key, bitmap));
+    m_index[key] = m_pages.begin();
+    return bitmap;
+}
+
+void TilePageCache::Clear()
+{
+    m_index.clear();
+    m_pages.clear();
+}
+
+void TilePageCache::Invalidate(size_t y0, size_t y1)
+{
+    for(auto it=m_pages.begin(); it != m_pages.end();)
+    {
+        size_t y = (it->first >> 32) * TILE_PAGE_SIZE;
+        if(y < y1 && y + TILE_PAGE_SIZE > y0)
+        {
+            m_index.erase(it->first);
+            it = m_pages.erase(it);
+        }
+        else it++;
+    }
+}
+
 int TileView::ScaleV(int val)
 {
     return (int)round((float)val * m_scale);
@@ -81,29 +306,28 @@ bool TileView::ScrollPos(int x, int y, enum wxOrientation orient)
     }
 }
 
+void TileView::InvalidateTiles(size_t first, size_t count)
+{
+    size_t nrow = g_tilecfg.nrow;
+    size_t tileh = wxGetApp().m_tilesolver.GetTileSize().h;
+    if(!nrow || !tileh || !count) return;
+    m_pages.Invalidate(first / nrow * tileh, ((first + count - 1) / nrow + 1) * tileh);
+}
+
 bool TileView::PreRender()
 {
-    // try decode and render at first
-    if(!wxGetApp().m_tilesolver.RenderOk())
+    // only the layout is needed, tiles are composed to pages when drawing
+    m_pages.Clear();
+    if(!wxGetApp().m_tilesolver.DecodeOk())
     {
-        if(wxGetApp().m_tilesolver.DecodeOk())
-        {
-            wxGetApp().m_tilesolver.Render();
-        }
-        else
-        {
-            goto prerender_failed;
-        }
+        m_imgsize = wxSize(0, 0);
+        SetVirtualSize(0, 0);
+        return false;
     }
 
-    if(!wxGetApp().m_tilesolver.RenderOk()) goto prerender_failed;
-    m_bitmap = wxGetApp().m_tilesolver.m_bitmap;
+    auto imgsize = wxGetApp().m_tilesolver.GetImageSize(g_tilecfg.nrow);
+    m_imgsize = wxSize(imgsize.w, imgsize.h);
     return true;
-
-prerender_failed:
-    m_bitmap = wxBitmap();
-    SetVirtualSize(0, 0);
-    return false;
 }
 
 int TileView::PreRow()
@@ -115,16 +339,17 @@ int TileView::PreRow()
     auto tilew = g_tilecfg.w;
     auto nrow = DeScaleV(windoww) / tilew;
     if(!nrow) nrow++;
+    if(nrow == g_tilecfg.nrow) return nrow;
     
-    // resize nrow and prepare image
-    wxGetApp().m_tilesolver.m_tilecfg.nrow = nrow;
-    if(!wxGetApp().m_tilesolver.Render()) return -1;
-    
-    // update with new nrow
+    // update with new nrow, only the layout changes
+    m_pages.Clear();
+    auto& solver = wxGetApp().m_tilesolver;
+    if(!solver.IsBusy()) solver.m_tilecfg.nrow = nrow; // otherwise written back when the worker is done
     g_tilecfg.nrow = (uint16_t)nrow;
     wxGetApp().m_configwindow->m_pg->SetPropertyValue("tilecfg.nrow", (long)nrow);
-    m_bitmap = wxGetApp().m_tilesolver.m_bitmap;
-    SetVirtualSize(ScaleV(m_bitmap.GetSize()));
+    auto imgsize = solver.GetImageSize(nrow);
+    m_imgsize = wxSize(imgsize.w, imgsize.h);
+    SetVirtualSize(ScaleV(m_imgsize));
 
     // sync the nav values
     g_tilenav.offset = -1;
@@ -133,34 +358,30 @@ int TileView::PreRow()
     return nrow;
 }
 
-bool TileView::PreBoarder()
+void TileView::DrawBoarder(wxDC& dc, const wxRect& rect)
 {
-    if(!m_bitmap.IsOk()) return false;
-    wxMemoryDC memdc(m_bitmap);
-    memdc.SetPen(*wxGREY_PEN);
-    memdc.SetBrush(wxBrush(*wxGREEN, wxTRANSPARENT));
-    int imgw = m_bitmap.GetWidth();
-    int imgh = m_bitmap.GetHeight();
     int tilew = g_tilecfg.w;
     int tileh = g_tilecfg.h;
-    for(int x=0; x < imgw; x += tilew)
+    if(!tilew || !tileh) return;
+    dc.SetPen(*wxGREY_PEN);
+    dc.SetBrush(wxBrush(*wxGREEN, wxTRANSPARENT));
+    for(int x=rect.GetLeft() / tilew * tilew; x < rect.GetRight() + 1; x += tilew)
     {
-        for(int y=0; y < imgh; y += tileh)
+        for(int y=rect.GetTop() / tileh * tileh; y < rect.GetBottom() + 1; y += tileh)
         {
-            memdc.DrawRectangle(x, y, tilew, tileh);
+            dc.DrawRectangle(ScaleV(x), ScaleV(y), ScaleV(tilew), ScaleV(tileh));
         }
     }
-    return true;
 }
 
 bool TileView::PreStyle()
 {
-    if(!m_bitmap.IsOk()) return false;
+    if(!m_imgsize.GetWidth() || !m_imgsize.GetHeight()) return false;
     
     // check reset window
     if(g_tilestyle.reset_scale)
     {
-        auto tilewindow_w = m_bitmap.GetSize().GetWidth();
+        auto tilewindow_w = m_imgsize.GetWidth();
         auto configwindow_w =  wxGetApp().m_configwindow->GetSize().GetWidth();
         wxGetApp().GetTopWindow()->SetSize(tilewindow_w + configwindow_w + 40, 
             wxGetApp().GetTopWindow()->GetSize().GetHeight());
@@ -172,16 +393,12 @@ bool TileView::PreStyle()
         m_scale = g_tilestyle.scale;
     }
 
-    // check tile style and render them
-    SetVirtualSize(ScaleV(m_bitmap.GetSize()));
+    // check tile style, boarders are drawn in OnDraw
+    SetVirtualSize(ScaleV(m_imgsize));
     if(g_tilestyle.style & TILE_STYLE_AUTOROW)
     {
         PreRow();
     }
-    if(g_tilestyle.style & TILE_STYLE_BOARDER)
-    {
-        PreBoarder();
-    }
 
     return true;
 }
@@ -203,45 +420,86 @@ void TileView::OnDraw(wxDC& dc)
     int scrollx = GetScrollPos(wxHORIZONTAL);
     int scrolly = GetScrollPos(wxVERTICAL);
     GetScrollPixelsPerUnit(&scrollxu, &scrollyu);
-    if(!m_bitmap.IsOk())
+    auto& solver = wxGetApp().m_tilesolver;
+    if(!solver.DecodeOk() || !m_imgsize.GetWidth() || !m_imgsize.GetHeight())
     {
         SetVirtualSize(0, 0);
         return;
     }
 
-    // blit tiles, logic coord is for window
-    wxMemoryDC memdc(m_bitmap);
-    int logicw = memdc.GetSize().GetWidth();
-    int logich = memdc.GetSize().GetHeight();
-    int logicx = DeScaleV(scrollx*scrollxu);
-    int logicy = DeScaleV(scrolly*scrollyu);
-    int clientw = dc.GetSize().GetWidth();
-    int clienth = dc.GetSize().GetHeight();
-    if(fabs(m_scale - 1.f) < 0.001)
+    // find the visible area of logical image, logic coord is for window
+    int logicw = m_imgsize.GetWidth();
+    int logich = m_imgsize.GetHeight();
+    int logicx = wxMin<int>(DeScaleV(scrollx*scrollxu), logicw);
+    int logicy = wxMin<int>(DeScaleV(scrolly*scrollyu), logich);
+    int clientw = wxMin<int>(DeScaleV(dc.GetSize().GetWidth()) + 1, logicw - logicx);
+    int clienth = wxMin<int>(DeScaleV(dc.GetSize().GetHeight()) + 1, logich - logicy);
+    if(clientw <= 0 || clienth <= 0) return;
+
+    // draw the pages intersect with the visible area, compose the missing pages
+    auto time_start = wxDateTime::UNow();
+    size_t npage = 0; // composed in this draw, the cache size can shrink by eviction
+    size_t nrow = g_tilecfg.nrow;
+    int col0 = logicx / TILE_PAGE_SIZE, col1 = (logicx + clientw - 1) / TILE_PAGE_SIZE;
+    int row0 = logicy / TILE_PAGE_SIZE, row1 = (logicy + clienth - 1) / TILE_PAGE_SIZE;
+    m_pages.Reserve((col1 - col0 + 1) * (row1 - row0 + 1));
+    for(int row=row0; row <= row1; row++)
     {
-        clientw = wxMin<int>(clientw, ScaleV(logicw - logicx));
-        clienth = wxMin<int>(clienth, ScaleV(logich - logicy));
-        dc.Blit(logicx, logicy, clientw, clienth, &memdc, logicx, logicy);
+        for(int col=col0; col <= col1; col++)
+        {
+            bool composed = false;
+            auto bitmap = m_pages.Get(col, row, m_imgsize, nrow, &composed);
+            if(composed) npage++;
+            if(!bitmap.IsOk()) continue;
+            int pagex = col * TILE_PAGE_SIZE;
+            int pagey = row * TILE_PAGE_SIZE;
+            int pagew = bitmap.GetWidth();
+            int pageh = bitmap.GetHeight();
+            if(fabs(m_scale - 1.f) < 0.001)
+            {
+                dc.DrawBitmap(bitmap, pagex, pagey);
+            }
+            else
+            {
+                // scale by the page edges, so that there is no gap between pages
+                int destx = ScaleV(pagex), desty = ScaleV(pagey);
+                wxMemoryDC memdc(bitmap);
+                dc.StretchBlit(destx, desty, ScaleV(pagex + pagew) - destx, ScaleV(pagey + pageh) - desty, 
+                    &memdc, 0, 0, pagew, pageh);
+            }
+        }
     }
-    else
+    auto time_end = wxDateTime::UNow();
+
+    // decode the tile rows ahead of the scroll direction in background
+    size_t tileh = solver.GetTileSize().h;
+    size_t prefetch = solver.m_prefetch;
+    if(solver.IsLazy() && prefetch)
     {
-        // blit only the window area can reduce blinking, but may cause a lit bit shift
-        // slightly blit larger than the window, to prevent update remain problem
-        int radius = 200; 
-        logicx = wxMax<int>(logicx - radius, 0);
-        logicy = wxMax<int>(logicy - radius, 0);
-        clientw = wxMin<int>(clientw + ScaleV(2*radius), ScaleV(logicw - logicx));
-        clienth = wxMin<int>(clienth + ScaleV(2*radius), ScaleV(logich - logicy));
-        dc.StretchBlit(ScaleV(logicx), ScaleV(logicy), clientw, clienth, &memdc, 
-            logicx, logicy, DeScaleV(clientw), DeScaleV(clienth));
-        // dc.StretchBlit(0, 0, ScaleV(logicw), ScaleV(logich), &memdc, 0, 0, logicw, logich);
+        if(logicy >= m_lastlogicy)
+        {
+            size_t r = (size_t)(row1 + 1) * TILE_PAGE_SIZE / tileh;
+            solver.Prefetch(r * nrow, prefetch * nrow);
+        }
+        else
+        {
+            size_t r = (size_t)row0 * TILE_PAGE_SIZE / tileh;
+            size_t r0 = r > prefetch ? r - prefetch : 0;
+            solver.Prefetch(r0 * nrow, (r - r0) * nrow);
+        }
     }
+    m_lastlogicy = logicy;
     
     wxLogInfo(wxString::Format(
-        "[TileView::OnDraw] draw client_rect (%d, %d, %d, %d)", 
-            logicx, logicy, clientw, clienth));
+        "[TileView::OnDraw] draw client_rect (%d, %d, %d, %d), compose %zu pages in %llu ms", 
+            logicx, logicy, clientw, clienth, npage, 
+            (time_end - time_start).GetMilliseconds()));
 
-    // draw select box
+    // draw boarders and select box
+    if(g_tilestyle.style & TILE_STYLE_BOARDER)
+    {
+        DrawBoarder(dc, wxRect(logicx, logicy, clientw, clienth));
+    }
     dc.SetPen(*wxGREEN_PEN);
     dc.SetBrush(wxBrush(*wxGREEN, wxTRANSPARENT));
     dc.DrawRectangle(
@@ -256,14 +514,13 @@ void TileView::OnSize(wxSizeEvent& event)
     
     if(g_tilestyle.style & TILE_STYLE_AUTOROW)
     {
-        PreStyle();
-        Refresh();
+        SCHEDULE_UPDATE(UPDATE_STYLE); // once for the resizing in a frame
     }
 }
 
 void TileView::OnMouseLeftDown(wxMouseEvent& event)
 {
-    if(!m_bitmap.IsOk() || !wxGetApp().m_tilesolver.RenderOk()) return;
+    if(!wxGetApp().m_tilesolver.DecodeOk() || !m_imgsize.GetWidth()) return;
 
     auto clientpt = event.GetPosition();
     auto unscollpt = CalcUnscrolledPosition(clientpt);
@@ -271,11 +528,11 @@ void TileView::OnMouseLeftDown(wxMouseEvent& event)
         clientpt.x, clientpt.y, unscollpt.x, unscollpt.y); 
 
     // send to config window for click tile
-    int imgw = wxGetApp().m_tilesolver.m_bitmap.GetWidth();
-    int imgh = wxGetApp().m_tilesolver.m_bitmap.GetHeight();
+    int imgw = m_imgsize.GetWidth();
+    int imgh = m_imgsize.GetHeight();
     int x = wxMin<int>(DeScaleV(unscollpt.x), imgw - g_tilecfg.w);
     int y = wxMin<int>(DeScaleV(unscollpt.y), imgh - g_tilecfg.h);
-    int preindex = g_tilenav.index;
+    int64_t preindex = g_tilenav.index;
     g_tilenav.index = -1;
     g_tilenav.offset = -1;
     g_tilenav.x = x; g_tilenav.y = y;
@@ -325,9 +582,9 @@ mouse_wheel_next:
 
 void TileView::OnKeyDown(wxKeyEvent& event)
 {
-    int index = g_tilenav.index;
-    int nrow = g_tilecfg.nrow;
-    int col = (index - 1) % nrow;
+    int64_t index = g_tilenav.index;
+    int64_t nrow = g_tilecfg.nrow;
+    int64_t col = (index - 1) % nrow;
     enum wxOrientation orient = wxBOTH;
     if(event.CmdDown() || event.ControlDown() || event.AltDown()) goto key_down_next;
     
@@ -364,9 +621,9 @@ void TileView::OnKeyDown(wxKeyEvent& event)
 
     if(index != g_tilenav.index)
     {
-        auto ntiles = wxGetApp().m_tilesolver.m_tiles.size();
-        index = wxMax<int>(index, 0);
-        index = wxMin<int>(index, ntiles);
+        auto ntiles = wxGetApp().m_tilesolver.GetTileCount();
+        index = wxMax<int64_t>(index, 0);
+        index = wxMin<int64_t>(index, (int64_t)ntiles);
         g_tilenav.index = index;
         g_tilenav.offset = -1;
         sync_tilenav(&g_tilenav, &g_tilecfg);
@@ -391,39 +648,43 @@ TileWindow::TileWindow(wxWindow *parent)
     SetSizer(sizer);
 }
 
+TileWindow::~TileWindow()
+{
+    wxGetApp().m_tilesolver.Cancel(); // the worker posts events to this window
+}
+
 void TileWindow::OnDropFile(wxDropFilesEvent& event)
 {
     auto infile = wxFileName(event.GetFiles()[0]);
     wxLogMessage("[TileWindow::OnDropFile] open %s", infile.GetFullPath());
     wxGetApp().m_tilesolver.Close();
-    if(!wxGetApp().m_tilesolver.Open(infile)) goto drop_file_failed;
-    if(!wxGetApp().m_tilesolver.Decode(&g_tilecfg)) goto drop_file_failed;
-    if(!wxGetApp().m_tilesolver.Render()) goto drop_file_failed;
-    
-    reset_tilenav(&g_tilenav);
-    NOTIFY_UPDATE_TILENAV();
-    NOTIFY_UPDATE_TILES(); // notify all
-    return;
-
-drop_file_failed:
-    reset_tilenav(&g_tilenav);
-    NOTIFY_UPDATE_TILENAV();
-    NOTIFY_UPDATE_TILES(); // notify all
-    // wxMessageBox(wxString::Format("open %s failed !", infile.GetFullPath()), "error", wxICON_ERROR);
+    wxGetApp().m_tilesolver.Open(infile); // nothing to decode if failed
+    SCHEDULE_UPDATE(UPDATE_INPUT); // notify all
 }
 
 void TileWindow::OnUpdate(wxCommandEvent &event)
 {
-    m_view->PreRender();
-    m_view->PreStyle();
+    // the decode worker only needs the pages of finished tiles composed again
+    std::vector<struct tilejob_msg_t> msgs;
+    int flags = event.GetInt() == TILE_UPDATE_JOB ? UPDATE_PAINT : UPDATE_LAYOUT;
+    wxGetApp().m_tilesolver.PollJob(msgs);
+    for(auto& msg : msgs)
+    {
+        if(msg.type == TILE_JOB_TILES) m_view->InvalidateTiles(msg.first, msg.count);
+        else flags |= UPDATE_LAYOUT;
+    }
+    SCHEDULE_UPDATE(flags);
+}
+
+void TileWindow::UpdateView(int flags)
+{
+    if(flags & UPDATE_LAYOUT) m_view->PreRender();
+    if(flags & (UPDATE_LAYOUT | UPDATE_STYLE)) m_view->PreStyle();
     if(g_tilenav.scrollto) // go to the target position
     {
         m_view->ScrollPos(g_tilenav.x, g_tilenav.y);
         g_tilenav.scrollto = false;
     }
-
-update_next:
-    m_view->SetFocus();
+    if(flags & (UPDATE_LAYOUT | UPDATE_STYLE)) m_view->SetFocus();
     m_view->Refresh();
-    NOTIFY_UPDATE_STATUS();
 }
\ No newline at end of file
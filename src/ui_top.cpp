@@ -16,13 +16,12 @@ EVT_FSWATCHER(wxID_ANY, TopFrame::OnFileSystemEvent)
 EVT_COMMAND(wxID_ANY, EVENT_UPDATE_STATUS, TopFrame::OnUpdateStatus)
 wxEND_EVENT_TABLE()
 
-struct tilenav_t g_tilenav = {.index=0};
-struct tilestyle_t g_tilestyle = {.scale = 1.f, .style = TILE_STYLE_BOARDER};
-
 TopFrame::TopFrame() :
     wxFrame(NULL, wxID_ANY, "TileViewer " APP_VERSION , // if init base here, can not use XRCCTRL
             wxDefaultPosition, wxSize(960, 720)) 
 {
+    wxGetApp().m_scheduler = &m_scheduler; // children notify while creating
+
     // load resource
     wxString pluginDir = "./plugin";
 #ifdef _WIN32
@@ -62,31 +61,35 @@ TopFrame::TopFrame() :
     NOTIFY_UPDATE_STATUS();
 }
 
+TopFrame::~TopFrame()
+{
+    wxGetApp().m_scheduler = nullptr;
+}
+
 void TopFrame::OnFileSystemEvent(wxFileSystemWatcherEvent &event)
 {
+    // only reload the current plugin, and wait for the burst of writes
     int type = event.GetChangeType();
-    if(type==wxFSW_EVENT_MODIFY)
-    {
-        wxGetApp().m_tilesolver.Decode(&g_tilecfg, wxGetApp().m_tilesolver.m_pluginfile);
-        wxGetApp().m_tilesolver.Render();
-        NOTIFY_UPDATE_TILES();
-    }
+    if(type!=wxFSW_EVENT_MODIFY) return;
+    if(!event.GetPath().SameAs(wxGetApp().m_tilesolver.m_pluginfile)) return;
+    m_scheduler.ScheduleLater(UPDATE_DECODER);
 }
 
 void TopFrame::OnUpdateStatus(wxCommandEvent &event)
+{
+    UpdateStatus();
+}
+
+void TopFrame::UpdateStatus()
 {
     auto nameplugin = wxGetApp().m_tilesolver.m_pluginfile.GetFullName();
     auto nametile = wxGetApp().m_tilesolver.m_infile.GetFullName();
     SetStatusText(wxString::Format(
         "%s | %s", nametile, nameplugin), 1);
 
-    auto ntile = wxGetApp().m_tilesolver.m_tiles.size();
-    int imgw = 0, imgh = 0;
-    if(wxGetApp().m_tilesolver.RenderOk())
-    {
-        imgw = wxGetApp().m_tilesolver.m_bitmap.GetWidth();
-        imgh = wxGetApp().m_tilesolver.m_bitmap.GetHeight();
-    }
+    auto ntile = wxGetApp().m_tilesolver.GetTileCount();
+    auto imgsize = wxGetApp().m_tilesolver.GetImageSize(g_tilecfg.nrow);
+    int imgw = imgsize.w, imgh = imgsize.h;
     auto scale = g_tilestyle.scale;
     SetStatusText(wxString::Format(
         "%zu tiles | %dx%d image | %.0f%% scale", ntile, imgw, imgh, scale*100.f), 2);
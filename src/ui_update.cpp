@@ -0,0 +1,140 @@
+/**
+ * implement for the update scheduler, coalesce the ui updates
+ *   developed by devseed
+ *
+ *  events only mark the dirty stages, and the stages are done once in a frame:
+ *    input/decoder/decode -> layout -> style -> nav -> paint -> tilecfg -> status
+ */
+
+#include <wx/wx.h>
+#include <wx/thread.h>
+#include "ui.hpp"
+#include "core.hpp"
+
+extern struct tilecfg64_t g_tilecfg;
+
+enum UPDATE_TIMER_ID
+{
+    Timer_Frame = 1,
+    Timer_Delay
+};
+
+wxBEGIN_EVENT_TABLE(UpdateScheduler, wxEvtHandler)
+EVT_TIMER(Timer_Frame, UpdateScheduler::OnTimer)
+EVT_TIMER(Timer_Delay, UpdateScheduler::OnTimer)
+wxEND_EVENT_TABLE()
+
+UpdateScheduler::UpdateScheduler()
+    : m_frametimer(this, Timer_Frame), m_delaytimer(this, Timer_Delay)
+{
+    m_flags = m_delayed = 0;
+    m_pending = false;
+}
+
+void UpdateScheduler::Schedule(int flags)
+{
+    if(!wxThread::IsMain())
+    {
+        CallAfter([this, flags]{ Schedule(flags); });
+        return;
+    }
+    m_flags |= flags;
+    if(m_pending) return;
+    m_pending = true;
+    CallAfter(&UpdateScheduler::Run);
+}
+
+void UpdateScheduler::ScheduleLater(int flags, int ms)
+{
+    m_delayed |= flags;
+    m_delaytimer.StartOnce(ms);
+}
+
+void UpdateScheduler::OnTimer(wxTimerEvent& event)
+{
+    if(event.GetId() == Timer_Delay)
+    {
+        int flags = m_delayed;
+        m_delayed = 0;
+        Schedule(flags);
+    }
+    else Run();
+}
+
+void UpdateScheduler::Run()
+{
+    // wait for the next frame, the flags are still collected
+    long elapsed = m_lastrun.Time();
+    if(elapsed < UPDATE_FRAME_MS)
+    {
+        if(!m_frametimer.IsRunning()) m_frametimer.StartOnce(UPDATE_FRAME_MS - elapsed);
+        return;
+    }
+    m_pending = false;
+    int flags = m_flags;
+    m_flags = 0;
+    if(!flags) return;
+    m_lastrun.Start();
+
+    // at most one decoding, the previous one in flight is cancelled
+    auto& app = wxGetApp();
+    auto& solver = app.m_tilesolver;
+    if(flags & (UPDATE_INPUT | UPDATE_DECODER | UPDATE_DECODE))
+    {
+        auto pluginfile = (flags & UPDATE_DECODER) ? solver.m_pluginfile : wxFileName();
+        solver.DecodeAsync(&g_tilecfg, pluginfile);
+        if(flags & UPDATE_INPUT) reset_tilenav(&g_tilenav);
+        flags |= UPDATE_LAYOUT | UPDATE_TILECFG | UPDATE_NAV;
+    }
+    if(flags & (UPDATE_LAYOUT | UPDATE_STYLE)) flags |= UPDATE_STATUS;
+
+    if(flags & (UPDATE_LAYOUT | UPDATE_STYLE | UPDATE_NAV | UPDATE_PAINT))
+    {
+        app.m_tilewindow->UpdateView(flags);
+    }
+    if(flags & UPDATE_TILECFG) app.m_configwindow->LoadTilecfg(g_tilecfg);
+    if(flags & UPDATE_NAV) app.m_configwindow->LoadTilenav(g_tilenav);
+    if(flags & UPDATE_STATUS) static_cast<TopFrame*>(app.GetTopWindow())->UpdateStatus();
+    wxLogInfo("[UpdateScheduler::Run] flags 0x%x", flags);
+}
+
+void SolverListener::OnError(const wxString& msg, const wxString& title)
+{
+    // the message box is only for the main thread, others post it
+    if(wxThread::IsMain()) wxMessageBox(msg, title, wxICON_ERROR);
+    else wxGetApp().CallAfter([msg, title]{ wxMessageBox(msg, title, wxICON_ERROR); });
+}
+
+void SolverListener::OnPluginLoad(const wxString& plugincfg)
+{
+    auto configwindow = wxGetApp().m_configwindow;
+    if(!configwindow) return;
+    if(!plugincfg.Length())
+    {
+        configwindow->ClearPlugincfg();
+        return;
+    }
+    wxString text = plugincfg;
+    configwindow->SetPlugincfg(text);
+    NOTIFY_UPDATE_TILECFG();
+    NOTIFY_UPDATE_TILENAV();
+}
+
+wxString SolverListener::OnPluginConfig(const wxString& plugincfg)
+{
+    auto configwindow = wxGetApp().m_configwindow;
+    return configwindow ? configwindow->GetPlugincfg() : plugincfg;
+}
+
+void SolverListener::OnTilecfg(const struct tilecfg64_t& cfg)
+{
+    g_tilecfg.nrow = cfg.nrow; // the others are written by the decoding of g_tilecfg
+    sync_tilenav(&g_tilenav, &g_tilecfg);
+    NOTIFY_UPDATE_TILENAV();
+    NOTIFY_UPDATE_TILECFG();
+}
+
+void SolverListener::OnJob()
+{
+    NOTIFY_UPDATE_JOB();
+}